@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "benchmark.h"
+
+static bool enabled = false;
+static EnumMap<BenchmarkSection, steady_clock::duration> totalTime;
+static EnumMap<BenchmarkSection, int> count;
+static EnumMap<BenchmarkCounter, int> counters;
+// Only the outermost of recursive entries into the same section is timed.
+static EnumMap<BenchmarkSection, int> depth;
+
+BenchmarkTimer::BenchmarkTimer(BenchmarkSection s) : section(s), active(enabled) {
+  if (active && depth[section]++ == 0) {
+    running = true;
+    startTime = steady_clock::now();
+  }
+}
+
+BenchmarkTimer::~BenchmarkTimer() {
+  if (active)
+    --depth[section];
+  if (running) {
+    totalTime[section] += steady_clock::now() - startTime;
+    ++count[section];
+  }
+}
+
+void BenchmarkTimer::setEnabled(bool e) {
+  enabled = e;
+  depth.clear();
+}
+
+void BenchmarkTimer::reset() {
+  totalTime.clear();
+  count.clear();
+  counters.clear();
+}
+
+microseconds BenchmarkTimer::getTotalTime(BenchmarkSection section) {
+  return duration_cast<microseconds>(totalTime[section]);
+}
+
+int BenchmarkTimer::getCount(BenchmarkSection section) {
+  return count[section];
+}
+
+void BenchmarkTimer::increment(BenchmarkCounter counter) {
+  ++counters[counter];
+}
+
+int BenchmarkTimer::getCount(BenchmarkCounter counter) {
+  return counters[counter];
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "util.h"
+
+RICH_ENUM(BenchmarkSection,
+  MODEL_TICK,
+  CREATURE_MOVE,
+  COLLECTIVE_TICK,
+  SHORTEST_PATH,
+  FIELD_OF_VIEW,
+  LIGHTING,
+  EVENTS
+);
+
+RICH_ENUM(BenchmarkCounter,
+  PATH_CACHE_HIT,
+  PATH_CACHE_MISS,
+  PATH_CACHE_REPAIR,
+  PATH_FLOW_FIELD
+);
+
+/** Accumulates the time spent in the main simulation subsystems. Does nothing unless enabled,
+    which is only done by the --bench mode. Nested sections are counted inclusively.*/
+class BenchmarkTimer {
+  public:
+  BenchmarkTimer(BenchmarkSection);
+  ~BenchmarkTimer();
+
+  static void setEnabled(bool);
+  static void reset();
+  static microseconds getTotalTime(BenchmarkSection);
+  static int getCount(BenchmarkSection);
+  /** Counters are always on, since they are cheap.*/
+  static void increment(BenchmarkCounter);
+  static int getCount(BenchmarkCounter);
+
+  private:
+  BenchmarkSection section;
+  bool active;
+  bool running = false;
+  steady_clock::time_point startTime;
+};
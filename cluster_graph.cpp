@@ -0,0 +1,198 @@
+#include "stdafx.h"
+#include "cluster_graph.h"
+#include "sectors.h"
+
+ClusterGraph::ClusterGraph(Rectangle b, double maxDetour) : bounds(b), maxDetour(maxDetour),
+    clusters((bounds.width() + clusterSize - 1) / clusterSize, (bounds.height() + clusterSize - 1) / clusterSize) {
+}
+
+void ClusterGraph::invalidate(Vec2 pos) {
+  // The transitions on a border depend on the cells on both sides, so the neighboring clusters are invalidated too.
+  auto invalidateCluster = [this](Vec2 v) {
+    if (v.inRectangle(bounds))
+      clusters[(v - bounds.topLeft()) / clusterSize].dirty = true;
+  };
+  invalidateCluster(pos);
+  for (Vec2 v : pos.neighbors8())
+    invalidateCluster(v);
+}
+
+bool ClusterGraph::isPassable(const Sectors& sectors, Vec2 pos) const {
+  return pos.inRectangle(bounds) && sectors.contains(pos);
+}
+
+Rectangle ClusterGraph::getClusterArea(Vec2 pos) const {
+  Vec2 topLeft = bounds.topLeft() + (pos - bounds.topLeft()) / clusterSize * clusterSize;
+  return Rectangle(topLeft.x, topLeft.y, min(bounds.right(), topLeft.x + clusterSize),
+      min(bounds.bottom(), topLeft.y + clusterSize));
+}
+
+auto ClusterGraph::getCluster(const Sectors& sectors, const CostFun& costFun, Vec2 pos) -> Cluster& {
+  auto& cluster = clusters[(pos - bounds.topLeft()) / clusterSize];
+  if (cluster.dirty)
+    rebuild(sectors, costFun, getClusterArea(pos), cluster);
+  return cluster;
+}
+
+Table<double> ClusterGraph::getDistances(const Sectors& sectors, const CostFun& costFun, Rectangle area,
+    Vec2 from) const {
+  Table<double> ret(area, -1);
+  using QueueElem = pair<double, Vec2>;
+  priority_queue<QueueElem, vector<QueueElem>, std::greater<QueueElem>> q;
+  ret[from] = 0;
+  q.push({0, from});
+  while (!q.empty()) {
+    auto elem = q.top();
+    q.pop();
+    Vec2 pos = elem.second;
+    if (elem.first > ret[pos])
+      continue;
+    for (Vec2 v : pos.neighbors8())
+      if (v.inRectangle(area) && isPassable(sectors, v)) {
+        double distance = ret[pos] + costFun(v);
+        if (ret[v] < 0 || ret[v] > distance) {
+          ret[v] = distance;
+          q.push({distance, v});
+        }
+      }
+  }
+  return ret;
+}
+
+vector<pair<Vec2, Vec2>> ClusterGraph::getTransitions(const Sectors& sectors, Vec2 start, Vec2 along, Vec2 across,
+    int length) const {
+  auto inner = [&](int i) { return start + along * i; };
+  auto outer = [&](int i) { return start + along * i + across; };
+  vector<char> straight(length, false);
+  for (int i : Range(length))
+    straight[i] = isPassable(sectors, inner(i)) && isPassable(sectors, outer(i));
+  vector<pair<Vec2, Vec2>> ret;
+  // Every run of cells that can be crossed straight gets one transition in the middle.
+  for (int i = 0; i < length;)
+    if (straight[i]) {
+      int end = i;
+      while (end < length && straight[end])
+        ++end;
+      int middle = (i + end) / 2;
+      ret.push_back({inner(middle), outer(middle)});
+      i = end;
+    } else
+      ++i;
+  // Cells that can only be crossed diagonally get their own transitions.
+  for (int i : Range(length - 1))
+    if (!straight[i] && !straight[i + 1]) {
+      if (isPassable(sectors, inner(i)) && isPassable(sectors, outer(i + 1)))
+        ret.push_back({inner(i), outer(i + 1)});
+      if (isPassable(sectors, inner(i + 1)) && isPassable(sectors, outer(i)))
+        ret.push_back({inner(i + 1), outer(i)});
+    }
+  return ret;
+}
+
+void ClusterGraph::rebuild(const Sectors& sectors, const CostFun& costFun, Rectangle area, Cluster& cluster) const {
+  vector<pair<Vec2, Vec2>> transitions;
+  // Borders are always scanned from the side of the upper or left cluster, so that both clusters agree on them.
+  transitions.append(getTransitions(sectors, Vec2(area.right() - 1, area.top()), Vec2(0, 1), Vec2(1, 0),
+      area.height()));
+  transitions.append(getTransitions(sectors, Vec2(area.left(), area.bottom() - 1), Vec2(1, 0), Vec2(0, 1),
+      area.width()));
+  auto swapped = [](vector<pair<Vec2, Vec2>> elems) {
+    return elems.transform([](const pair<Vec2, Vec2>& elem) { return make_pair(elem.second, elem.first); });
+  };
+  transitions.append(swapped(getTransitions(sectors, Vec2(area.left() - 1, area.top()), Vec2(0, 1), Vec2(1, 0),
+      area.height())));
+  transitions.append(swapped(getTransitions(sectors, Vec2(area.left(), area.top() - 1), Vec2(1, 0), Vec2(0, 1),
+      area.width())));
+  for (Vec2 dir : Vec2::corners()) {
+    Vec2 corner(dir.x > 0 ? area.right() - 1 : area.left(), dir.y > 0 ? area.bottom() - 1 : area.top());
+    if (isPassable(sectors, corner) && isPassable(sectors, corner + dir))
+      transitions.push_back({corner, corner + dir});
+  }
+  auto& extraConnections = sectors.getExtraConnections();
+  for (Vec2 v : area)
+    if (auto other = extraConnections[v])
+      if (isPassable(sectors, v) && isPassable(sectors, *other))
+        transitions.push_back({v, *other});
+  cluster.nodes.clear();
+  cluster.links.clear();
+  for (auto& transition : transitions) {
+    auto index = cluster.nodes.findElement(transition.first);
+    if (!index) {
+      index = cluster.nodes.size();
+      cluster.nodes.push_back(transition.first);
+      cluster.links.emplace_back();
+    }
+    if (!cluster.links[*index].contains(transition.second))
+      cluster.links[*index].push_back(transition.second);
+  }
+  int numNodes = cluster.nodes.size();
+  cluster.distances = vector<double>(numNodes * numNodes, -1);
+  for (int i : All(cluster.nodes)) {
+    auto distances = getDistances(sectors, costFun, area, cluster.nodes[i]);
+    for (int j : All(cluster.nodes))
+      cluster.distances[i * numNodes + j] = distances[cluster.nodes[j]];
+  }
+  cluster.dirty = false;
+}
+
+optional<vector<Vec2>> ClusterGraph::findRoute(const Sectors& sectors, const CostFun& costFun, Vec2 from, Vec2 to,
+    double lowerBound) {
+  PROFILE;
+  if (!sectors.same(from, to))
+    return none;
+  double maxCost = maxDetour * lowerBound;
+  Rectangle toArea = getClusterArea(to);
+  auto fromDistances = getDistances(sectors, costFun, getClusterArea(from), from);
+  auto toDistances = getDistances(sectors, costFun, toArea, to);
+  struct Visit {
+    double distance;
+    Vec2 parent;
+  };
+  unordered_map<Vec2, Visit, CustomHash<Vec2>> visited;
+  using QueueElem = pair<double, Vec2>;
+  priority_queue<QueueElem, vector<QueueElem>, std::greater<QueueElem>> q;
+  auto relax = [&](Vec2 pos, Vec2 parent, double distance) {
+    // Entry costs aren't negative, so a route through a cell that is already too expensive can't get any cheaper.
+    if (distance > maxCost)
+      return;
+    auto it = visited.find(pos);
+    if (it == visited.end() || it->second.distance > distance) {
+      visited[pos] = Visit{distance, parent};
+      q.push({distance + pos.dist8(to), pos});
+    }
+  };
+  visited[from] = Visit{0, from};
+  if (to.inRectangle(fromDistances.getBounds()) && fromDistances[to] > -1)
+    relax(to, from, fromDistances[to]);
+  for (Vec2 node : getCluster(sectors, costFun, from).nodes)
+    if (fromDistances[node] > -1)
+      relax(node, from, fromDistances[node]);
+  while (!q.empty()) {
+    auto elem = q.top();
+    q.pop();
+    Vec2 pos = elem.second;
+    double distance = visited.at(pos).distance;
+    if (elem.first > distance + pos.dist8(to))
+      continue;
+    if (pos == to) {
+      vector<Vec2> ret;
+      for (; pos != from; pos = visited.at(pos).parent)
+        ret.push_back(pos);
+      return ret.reverse();
+    }
+    auto& cluster = getCluster(sectors, costFun, pos);
+    auto index = cluster.nodes.findElement(pos);
+    if (!index)
+      continue;
+    // The distances from the target pay for entering this cell instead of the target.
+    if (pos.inRectangle(toArea) && toDistances[pos] > -1)
+      relax(to, pos, distance + toDistances[pos] - costFun(pos) + costFun(to));
+    int numNodes = cluster.nodes.size();
+    for (int i : All(cluster.nodes))
+      if (i != *index && cluster.distances[*index * numNodes + i] > -1)
+        relax(cluster.nodes[i], pos, distance + cluster.distances[*index * numNodes + i]);
+    for (Vec2 link : cluster.links[*index])
+      relax(link, pos, distance + costFun(link));
+  }
+  return none;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "util.h"
+
+class Sectors;
+
+// An abstract graph used for hierarchical pathfinding. The level is split into square clusters, and the nodes of
+// the graph are the cells where a path crosses from one cluster into another, connected by their distances within
+// the cluster. Passability is taken from the Sectors of the same movement type, and the distances use the same
+// entry costs as the exact search, so they may only depend on the cells that invalidate the graph when changed.
+// Clusters are rebuilt lazily, after the positions inside or next to them have been invalidated.
+class ClusterGraph {
+  public:
+  using CostFun = function<double(Vec2)>;
+  ClusterGraph(Rectangle bounds, double maxDetour = 2);
+
+  void invalidate(Vec2);
+
+  // Returns the waypoints of the cheapest route from 'from' to 'to' in the graph, the last one being 'to'. Returns
+  // none if the target is unreachable, or if the route costs more than maxDetour times lowerBound, which should be
+  // a lower bound on the cost of the exact path. Refining the route can't make it more expensive, so the path stays
+  // within that bound of the exact one.
+  optional<vector<Vec2>> findRoute(const Sectors&, const CostFun&, Vec2 from, Vec2 to, double lowerBound);
+
+  static constexpr int clusterSize = 16;
+
+  private:
+  struct Cluster {
+    bool dirty = true;
+    vector<Vec2> nodes;
+    // For every node, the nodes in other clusters that are one step away.
+    vector<vector<Vec2>> links;
+    // Distances within the cluster between every pair of nodes, -1 if there is no path.
+    vector<double> distances;
+  };
+  Cluster& getCluster(const Sectors&, const CostFun&, Vec2);
+  Rectangle getClusterArea(Vec2) const;
+  void rebuild(const Sectors&, const CostFun&, Rectangle area, Cluster&) const;
+  Table<double> getDistances(const Sectors&, const CostFun&, Rectangle area, Vec2 from) const;
+  vector<pair<Vec2, Vec2>> getTransitions(const Sectors&, Vec2 start, Vec2 along, Vec2 across, int length) const;
+  bool isPassable(const Sectors&, Vec2) const;
+  Rectangle bounds;
+  double maxDetour;
+  Table<Cluster> clusters;
+};
@@ -53,13 +53,20 @@
 #include "position_matching.h"
 #include "storage_id.h"
 #include "game_config.h"
+#include "benchmark.h"
+#include "collective_item_index.h"
 
 template <class Archive>
 void Collective::serialize(Archive& ar, const unsigned int version) {
   ar(SUBCLASS(TaskCallback), SUBCLASS(UniqueEntity<Collective>), SUBCLASS(EventListener));
   ar(creatures, taskMap, tribe, control, byTrait, populationGroups);
   ar(territory, alarmInfo, markedItems, constructions, minionEquipment);
-  ar(delayedPos, knownTiles, technology, kills, points, currentActivity);
+  if (version < 1) {
+    // The dangerous positions are now kept in the level's DangerMap.
+    unordered_map<Position, LocalTime, CustomHash<Position>> delayedPos;
+    ar(delayedPos);
+  }
+  ar(knownTiles, technology, kills, points, currentActivity);
   ar(credit, level, immigration, teams, name, conqueredVillains);
   ar(config, warnings, knownVillains, knownVillainLocations, banished, positionMatching);
   ar(villainType, enemyId, workshops, zones, discoverable, quarters, populationIncrease, dungeonLevel);
@@ -190,8 +197,9 @@ void Collective::addCreature(WCreature c, EnumSet<MinionTrait> traits) {
   for (MinionTrait t : traits)
     byTrait[t].push_back(c);
   updateCreatureStatus(c);
-  for (WItem item : c->getEquipment().getItems())
-    CHECK(minionEquipment->tryToOwn(c, item));
+  if (usesEquipment(c))
+    for (WItem item : c->getEquipment().getItems())
+      CHECK(minionEquipment->tryToOwn(c, item));
   for (auto minion : getCreatures()) {
     c->removePrivateEnemy(minion);
     minion->removePrivateEnemy(c);
@@ -213,6 +221,7 @@ void Collective::removeCreature(WCreature c) {
     if (byTrait[t].contains(c))
       byTrait[t].removeElement(c);
   updateCreatureStatus(c);
+  minionEquipment->removeOwner(c);
 }
 
 void Collective::banishCreature(WCreature c) {
@@ -423,7 +432,7 @@ double Collective::getRebellionProbability() const {
 void Collective::considerRebellion() {
   if (Random.chance(getRebellionProbability() / 1000)) {
     Position escapeTarget = getLevel()->getLandingSquare(StairKey::transferLanding(),
-        Random.choose(Vec2::directions8()));
+        Random.choose(asVector<Vec2>(Vec2::directions8())));
     for (auto c : copyOf(getCreatures(MinionTrait::PRISONER))) {
       removeCreature(c);
       c->setController(makeOwner<Monster>(c, MonsterAIFactory::singleTask(
@@ -440,6 +449,7 @@ void Collective::considerRebellion() {
 
 void Collective::tick() {
   PROFILE_BLOCK("Collective::tick");
+  BenchmarkTimer timer(BenchmarkSection::COLLECTIVE_TICK);
   considerRebellion();
   dangerLevelCache = none;
   control->tick();
@@ -461,29 +471,24 @@ void Collective::tick() {
   if (Random.roll(5)) {
     auto& fetchInfo = getConfig().getFetchInfo();
     if (!fetchInfo.empty()) {
-      for (Position pos : territory->getAll())
-        if (!isDelayed(pos) && pos.canEnterEmpty(MovementTrait::WALK) && !pos.getItems().empty())
-          for (const ItemFetchInfo& elem : fetchInfo)
-            fetchItems(pos, elem);
-      for (Position pos : zones->getPositions(ZoneId::FETCH_ITEMS))
-        if (!isDelayed(pos) && pos.canEnterEmpty(MovementTrait::WALK))
-          for (const ItemFetchInfo& elem : fetchInfo)
-            fetchItems(pos, elem);
-      for (Position pos : zones->getPositions(ZoneId::PERMANENT_FETCH_ITEMS))
+      fetchTerritoryItems(fetchInfo);
+      auto fetchZones = zones->getPositions(ZoneId::FETCH_ITEMS);
+      fetchZones.sumWith(zones->getPositions(ZoneId::PERMANENT_FETCH_ITEMS));
+      for (Position pos : fetchZones)
         if (!isDelayed(pos) && pos.canEnterEmpty(MovementTrait::WALK))
           for (const ItemFetchInfo& elem : fetchInfo)
             fetchItems(pos, elem);
     }
   }
+  // Ownership is updated when minions and items come and go, this only catches whatever was missed.
   if (config->getManageEquipment() && Random.roll(40)) {
     minionEquipment->updateOwners(getCreatures());
     minionEquipment->updateItems(getAllItems(ItemIndex::MINION_EQUIPMENT, true));
+    for (auto c : getCreatures())
+      if (!usesEquipment(c))
+        minionEquipment->removeOwner(c);
   }
   workshops->scheduleItems(this);
-  for (auto c : getCreatures())
-    if (!usesEquipment(c))
-      for (auto it : minionEquipment->getItemsOwnedBy(c))
-        minionEquipment->discard(it);
 }
 
 const vector<WCreature>& Collective::getCreatures(MinionTrait trait) const {
@@ -498,6 +503,8 @@ void Collective::setTrait(WCreature c, MinionTrait t) {
   if (!hasTrait(c, t)) {
     byTrait[t].push_back(c);
     updateCreatureStatus(c);
+    if (!usesEquipment(c))
+      minionEquipment->removeOwner(c);
   }
 }
 
@@ -529,6 +536,22 @@ void Collective::onEvent(const GameEvent& event) {
   PROFILE;
   using namespace EventInfo;
   event.visit(
+      [&](const ItemsPickedUp& info) {
+        if (!getCreatures().contains(info.creature))
+          for (auto item : info.items)
+            minionEquipment->discard(item);
+      },
+      [&](const ItemsDropped& info) {
+        if (!territory->contains(info.creature->getPosition()))
+          for (auto item : info.items)
+            minionEquipment->discard(item);
+      },
+      [&](const ItemsChanged& info) {
+        if (territory->contains(info.position)) {
+          fetchPositions.insert(info.position);
+          itemIndex->squareChanged(info.position);
+        }
+      },
       [&](const Alarm& info) {
         static const auto alarmTime = 100_visible;
         if (getTerritory().contains(info.pos)) {
@@ -673,6 +696,8 @@ bool Collective::canClaimSquare(Position pos) const {
 void Collective::claimSquare(Position pos) {
   //CHECK(canClaimSquare(pos));
   territory->insert(pos);
+  fetchPositions.insert(pos);
+  itemIndex->squareChanged(pos);
   for (auto furniture : pos.modFurniture())
     if (!furniture->isWall()) {
       if (!constructions->containsFurniture(pos, furniture->getLayer()))
@@ -754,7 +779,7 @@ void Collective::returnResource(const CostInfo& amount) {
   if (auto storage = config->getResourceInfo(amount.id).storageId) {
     const auto& destination = getStoragePositions(*storage);
     if (!destination.empty()) {
-      Random.choose(destination).dropItems(config->getResourceInfo(amount.id).itemId.get(amount.value));
+      Random.choose(asVector<Position>(destination)).dropItems(config->getResourceInfo(amount.id).itemId.get(amount.value));
       return;
     }
   }
@@ -778,9 +803,7 @@ bool Collective::usesEquipment(WConstCreature c) const {
 }
 
 vector<WItem> Collective::getAllItems(bool includeMinions) const {
-  vector<WItem> allItems;
-  for (Position v : territory->getAll())
-    append(allItems, v.getItems());
+  vector<WItem> allItems = itemIndex->getItems(*territory);
   if (includeMinions)
     for (WCreature c : getCreatures())
       append(allItems, c->getEquipment().getItems());
@@ -788,9 +811,7 @@ vector<WItem> Collective::getAllItems(bool includeMinions) const {
 }
 
 vector<WItem> Collective::getAllItems(ItemPredicate predicate, bool includeMinions) const {
-  vector<WItem> allItems;
-  for (Position v : territory->getAll())
-    append(allItems, v.getItems().filter(predicate));
+  vector<WItem> allItems = itemIndex->getItems(*territory).filter(predicate);
   if (includeMinions)
     for (WCreature c : getCreatures())
       append(allItems, c->getEquipment().getItems().filter(predicate));
@@ -798,9 +819,7 @@ vector<WItem> Collective::getAllItems(ItemPredicate predicate, bool includeMinio
 }
 
 vector<WItem> Collective::getAllItems(ItemIndex index, bool includeMinions) const {
-  vector<WItem> allItems;
-  for (Position v : territory->getAll())
-    append(allItems, v.getItems(index));
+  vector<WItem> allItems = itemIndex->getItems(*territory, index);
   if (includeMinions)
     for (WCreature c : getCreatures())
       append(allItems, c->getEquipment().getItems(index));
@@ -808,9 +827,7 @@ vector<WItem> Collective::getAllItems(ItemIndex index, bool includeMinions) cons
 }
 
 int Collective::getNumItems(ItemIndex index, bool includeMinions) const {
-  int ret = 0;
-  for (Position v : territory->getAll())
-    ret += v.getItems(index).size();
+  int ret = itemIndex->getNumItems(*territory, index);
   if (includeMinions)
     for (WCreature c : getCreatures())
       ret += c->getEquipment().getItems(index).size();
@@ -844,8 +861,10 @@ bool Collective::isItemMarked(WConstItem it) const {
   return !!markedItems.getOrElse(it, nullptr);
 }
 
-void Collective::markItem(WConstItem it, WConstTask task) {
+void Collective::markItem(WConstItem it, WConstTask task, Position pos) {
   markedItems.set(it, task);
+  if (markingTasks.empty() || markingTasks.back().first != task)
+    markingTasks.push_back({task, pos});
 }
 
 void Collective::removeTrap(Position pos) {
@@ -958,8 +977,10 @@ bool Collective::isConstructionReachable(Position pos) {
 void Collective::onConstructed(Position pos, FurnitureType type) {
   if (pos.getFurniture(type)->forgetAfterBuilding()) {
     constructions->removeFurniture(pos, Furniture::getLayer(type));
-    if (territory->contains(pos))
+    if (territory->contains(pos)) {
       territory->remove(pos);
+      itemIndex->squareChanged(pos);
+    }
     return;
   }
   populationIncrease -= Furniture::getPopulationIncrease(type, constructions->getBuiltCount(type));
@@ -979,6 +1000,8 @@ void Collective::onDestructed(Position pos, FurnitureType type, const DestroyAct
       break;
     case DestroyAction::Type::DIG:
       territory->insert(pos);
+      fetchPositions.insert(pos);
+      itemIndex->squareChanged(pos);
       break;
     default:
       break;
@@ -1001,7 +1024,7 @@ void Collective::handleTrapPlacementAndProduction() {
         auto item = items.back().first;
         auto task = taskMap->addTask(Task::chain(Task::pickUpItem(pos, {item}), Task::applyItem(this, trapPos, {item})), pos,
             MinionActivity::CONSTRUCTION);
-        markItem(items.back().first, task);
+        markItem(items.back().first, task, pos);
         items.pop_back();
         trap.setTask(task);
       } else
@@ -1058,38 +1081,16 @@ void Collective::updateConstructions() {
   }
 }
 
-void Collective::delayDangerousTasks(const vector<Position>& enemyPos1, LocalTime delayTime) {
+void Collective::delayDangerousTasks(const vector<Position>& enemyPos, LocalTime delayTime) {
   PROFILE;
-  vector<Vec2> enemyPos = enemyPos1
+  level->markDanger(getTribeId(), enemyPos
       .filter([=] (const Position& p) { return p.isSameLevel(level); })
-      .transform([] (const Position& p) { return p.getCoord();});
-  int infinity = 1000000;
-  int radius = 10;
-  Table<int> dist(Rectangle::boundingBox(enemyPos)
-      .minusMargin(-radius)
-      .intersection(getLevel()->getBounds()), infinity);
-  queue<Vec2> q;
-  for (Vec2 v : enemyPos) {
-    dist[v] = 0;
-    q.push(v);
-  }
-  while (!q.empty()) {
-    Vec2 pos = q.front();
-    q.pop();
-    delayedPos[Position(pos, level)] = delayTime;
-    if (dist[pos] >= radius)
-      continue;
-    for (Vec2 v : pos.neighbors8())
-      if (v.inRectangle(dist.getBounds()) && dist[v] == infinity && territory->contains(Position(v, level))) {
-        dist[v] = dist[pos] + 1;
-        q.push(v);
-      }
-  }
+      .transform([] (const Position& p) { return p.getCoord();}), delayTime);
 }
 
 bool Collective::isDelayed(Position pos) {
   PROFILE
-  return delayedPos.count(pos) && delayedPos.at(pos) > getLocalTime();
+  return pos.isSameLevel(level) && level->isDangerous(getTribeId(), pos.getCoord());
 }
 
 static Position chooseClosest(Position pos, const PositionSet& squares) {
@@ -1127,15 +1128,72 @@ void Collective::fetchItems(Position pos, const ItemFetchInfo& elem) {
       auto task = taskMap->addTask(std::move(pickUpAndDrop.pickUp), pos, MinionActivity::HAULING);
       taskMap->addTask(std::move(pickUpAndDrop.drop), chooseClosest(pos, destination), MinionActivity::HAULING);
       for (WItem it : equipment)
-        markItem(it, task);
+        markItem(it, task, pos);
     } else
       warnings->setWarning(elem.warning, true);
   }
 }
 
+bool Collective::hasItemsToFetch(Position pos, const vector<ItemFetchInfo>& fetchInfo) const {
+  for (const ItemFetchInfo& elem : fetchInfo)
+    if (!getStoragePositions(elem.storageId).count(pos))
+      for (WConstItem item : pos.getItems(elem.index))
+        if (elem.predicate(this, item))
+          return true;
+  return false;
+}
+
+EnumSet<StorageId> Collective::getStorages(Position pos) const {
+  EnumSet<StorageId> ret;
+  for (auto storage : ENUM_ALL(StorageId))
+    if (getStoragePositions(storage).count(pos))
+      ret.insert(storage);
+  return ret;
+}
+
+void Collective::fetchTerritoryItems(const vector<ItemFetchInfo>& fetchInfo) {
+  PROFILE;
+  if (!fetchPositionsValid) {
+    for (Position pos : territory->getAll()) {
+      fetchPositions.insert(pos);
+      for (WConstItem item : pos.getItems())
+        if (auto task = markedItems.getOrElse(item, nullptr))
+          markingTasks.push_back({task, pos});
+    }
+    fetchPositionsValid = true;
+  }
+  for (int i : AllReverse(markingTasks))
+    if (!markingTasks[i].first) {
+      fetchPositions.insert(markingTasks[i].second);
+      markingTasks.removeIndex(i);
+    }
+  for (auto it = storedPositions.begin(); it != storedPositions.end();)
+    if (getStorages(it->first) != it->second) {
+      fetchPositions.insert(it->first);
+      it = storedPositions.erase(it);
+    } else
+      ++it;
+  PositionSet positions;
+  std::swap(positions, fetchPositions);
+  for (Position pos : positions)
+    if (territory->contains(pos)) {
+      if (!isDelayed(pos) && pos.canEnterEmpty(MovementTrait::WALK) && !pos.getItems().empty())
+        for (const ItemFetchInfo& elem : fetchInfo)
+          fetchItems(pos, elem);
+      // Items that weren't marked can still be fetched later, for example when the square stops being delayed or a
+      // storage is built, so the square is looked at again in the next pass.
+      if (hasItemsToFetch(pos, fetchInfo))
+        fetchPositions.insert(pos);
+      else {
+        auto storages = getStorages(pos);
+        if (!storages.isEmpty() && !pos.getItems().empty())
+          storedPositions[pos] = storages;
+      }
+    }
+}
+
 void Collective::handleSurprise(Position pos) {
   Vec2 rad(8, 8);
-  WCreature c = pos.getCreature();
   for (Position v : Random.permutation(pos.getRectangle(Rectangle(-rad, rad + Vec2(1, 1)))))
     if (WCreature other = v.getCreature())
       if (hasTrait(other, MinionTrait::FIGHTER) && other->getPosition().dist8(pos) > 1) {
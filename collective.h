@@ -49,6 +49,7 @@ class CollectiveWarnings;
 class Immigration;
 class Quarters;
 class PositionMatching;
+class CollectiveItemIndex;
 
 class Collective : public TaskCallback, public UniqueEntity<Collective>, public EventListener<Collective> {
   public:
@@ -240,6 +241,19 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   void onKilledSomeone(WCreature victim, WCreature killer);
 
   void fetchItems(Position, const ItemFetchInfo&);
+  void fetchTerritoryItems(const vector<ItemFetchInfo>&);
+  bool hasItemsToFetch(Position, const vector<ItemFetchInfo>&) const;
+  EnumSet<StorageId> getStorages(Position) const;
+  // Territory squares that fetchTerritoryItems() needs to look at: the ones whose items changed, the ones where items
+  // were left last time, and the ones whose marking task is gone. Not saved, the whole territory is checked after
+  // loading.
+  PositionSet fetchPositions;
+  // Storage squares whose items are already where they should be, with the storages they belonged to. They are
+  // looked at again if that changes.
+  unordered_map<Position, EnumSet<StorageId>, CustomHash<Position>> storedPositions;
+  bool fetchPositionsValid = false;
+  vector<pair<WConstTask, Position>> markingTasks;
+  mutable HeapAllocated<CollectiveItemIndex> itemIndex;
 
   void addMoraleForKill(WConstCreature killer, WConstCreature victim);
   void decreaseMoraleForKill(WConstCreature killer, WConstCreature victim);
@@ -253,7 +267,7 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   EnumMap<ResourceId, int> SERIAL(credit);
   HeapAllocated<TaskMap> SERIAL(taskMap);
   HeapAllocated<Technology> SERIAL(technology);
-  void markItem(WConstItem, WConstTask);
+  void markItem(WConstItem, WConstTask, Position);
   void unmarkItem(UniqueEntity<Item>::Id);
 
   HeapAllocated<KnownTiles> SERIAL(knownTiles);
@@ -278,7 +292,6 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   void scheduleAutoProduction(function<bool (WConstItem)> itemPredicate, int count);
   void delayDangerousTasks(const vector<Position>& enemyPos, LocalTime delayTime);
   bool isDelayed(Position);
-  unordered_map<Position, LocalTime, CustomHash<Position>> SERIAL(delayedPos);
   vector<Position> getEnemyPositions() const;
   EntitySet<Creature> SERIAL(kills);
   int SERIAL(points) = 0;
@@ -305,3 +318,5 @@ class Collective : public TaskCallback, public UniqueEntity<Collective>, public
   int SERIAL(populationIncrease) = 0;
   DungeonLevel SERIAL(dungeonLevel);
 };
+
+CEREAL_CLASS_VERSION(Collective, 1);
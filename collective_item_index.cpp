@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "collective_item_index.h"
+#include "territory.h"
+
+void CollectiveItemIndex::squareChanged(Position pos) {
+  changed.insert(pos);
+}
+
+void CollectiveItemIndex::update(const Territory& territory) {
+  if (!initialized) {
+    for (Position pos : territory.getAll())
+      changed.insert(pos);
+    initialized = true;
+  }
+  for (Position pos : changed) {
+    auto it = squareCounts.find(pos);
+    if (it != squareCounts.end()) {
+      for (auto index : ENUM_ALL(ItemIndex)) {
+        counts[index] -= it->second[index];
+        if (it->second[index] > 0)
+          positions[index].erase(pos);
+      }
+      squareCounts.erase(it);
+      allPositions.erase(pos);
+    }
+    if (territory.contains(pos) && !pos.getItems().empty()) {
+      auto& squareCount = squareCounts[pos];
+      for (auto index : ENUM_ALL(ItemIndex)) {
+        squareCount[index] = pos.getItems(index).size();
+        counts[index] += squareCount[index];
+        if (squareCount[index] > 0)
+          positions[index].insert(pos);
+      }
+      allPositions.insert(pos);
+    }
+  }
+  changed.clear();
+#ifndef RELEASE
+  if (++numQueries % 100 == 0)
+    checkConsistency(territory);
+#endif
+}
+
+void CollectiveItemIndex::checkConsistency(const Territory& territory) const {
+  vector<WItem> expected;
+  EnumMap<ItemIndex, int> expectedCounts;
+  for (Position pos : territory.getAll()) {
+    append(expected, pos.getItems());
+    for (auto index : ENUM_ALL(ItemIndex))
+      expectedCounts[index] += pos.getItems(index).size();
+  }
+  int numItems = 0;
+  for (Position pos : allPositions) {
+    CHECK(territory.contains(pos));
+    numItems += pos.getItems().size();
+  }
+  CHECK(numItems == expected.size()) << numItems << " " << expected.size();
+  for (auto index : ENUM_ALL(ItemIndex))
+    CHECK(counts[index] == expectedCounts[index]) << getName(index) << " " << counts[index] << " " <<
+        expectedCounts[index];
+}
+
+vector<WItem> CollectiveItemIndex::getItems(const Territory& territory) {
+  update(territory);
+  vector<WItem> ret;
+  for (Position pos : allPositions)
+    append(ret, pos.getItems());
+  return ret;
+}
+
+vector<WItem> CollectiveItemIndex::getItems(const Territory& territory, ItemIndex index) {
+  update(territory);
+  vector<WItem> ret;
+  ret.reserve(counts[index]);
+  for (Position pos : positions[index])
+    append(ret, pos.getItems(index));
+  return ret;
+}
+
+int CollectiveItemIndex::getNumItems(const Territory& territory, ItemIndex index) {
+  update(territory);
+  return counts[index];
+}
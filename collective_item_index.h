@@ -0,0 +1,30 @@
+#pragma once
+
+#include "util.h"
+#include "item_index.h"
+#include "position.h"
+
+class Territory;
+
+// The items lying in a collective's territory, grouped by ItemIndex. Squares are marked when their items change or
+// when they join or leave the territory, and they're read again the next time the index is queried.
+class CollectiveItemIndex {
+  public:
+  void squareChanged(Position);
+  vector<WItem> getItems(const Territory&);
+  vector<WItem> getItems(const Territory&, ItemIndex);
+  int getNumItems(const Territory&, ItemIndex);
+
+  private:
+  void update(const Territory&);
+  void checkConsistency(const Territory&) const;
+  // The number of items of every index on the squares that have any items.
+  unordered_map<Position, EnumMap<ItemIndex, int>, CustomHash<Position>> squareCounts;
+  EnumMap<ItemIndex, int> counts;
+  EnumMap<ItemIndex, PositionSet> positions;
+  PositionSet allPositions;
+  PositionSet changed;
+  // The index isn't saved, so it starts by reading the whole territory.
+  bool initialized = false;
+  int numQueries = 0;
+};
@@ -54,6 +54,7 @@
 #include "furniture_type.h"
 #include "furniture_usage.h"
 #include "fx_name.h"
+#include "benchmark.h"
 
 template <class Archive>
 void Creature::serialize(Archive& ar, const unsigned int version) {
@@ -421,6 +422,7 @@ void Creature::swapPosition(Vec2 direction) {
 }
 
 void Creature::makeMove() {
+  BenchmarkTimer timer(BenchmarkSection::CREATURE_MOVE);
   vision->update(this);
   CHECK(!isDead());
   if (hasCondition(CreatureCondition::SLEEPING)) {
@@ -715,7 +717,7 @@ CreatureAction Creature::hide() const {
         thirdPerson(getName().the() + " hides behind the " + furniture->getName());
         self->knownHiding.clear();
         self->modViewObject().setModifier(ViewObject::Modifier::HIDDEN);
-        for (WCreature other : getLevel()->getAllCreatures())
+        for (WCreature other : position.getAllCreatures(FieldOfView::sightRange))
           if (other->canSee(this) && other->isEnemy(this)) {
             self->knownHiding.insert(other);
             if (!isAffected(LastingEffect::BLIND))
@@ -887,6 +889,8 @@ TribeId Creature::getTribeId() const {
 }
 
 void Creature::setTribe(TribeId t) {
+  if (auto model = position.getModel())
+    model->onCreatureTribeChanged(this, tribe, t);
   tribe = t;
 }
 
@@ -1709,12 +1713,22 @@ CreatureAction Creature::moveTowards(Position pos, NavigationFlags flags) {
     return CreatureAction();
 }
 
+CreatureAction Creature::moveTowards(Position target, const PositionSet& targets, NavigationFlags flags) {
+  if (!target.isValid() || !target.isSameLevel(position))
+    return moveTowards(target, flags);
+  vector<Vec2> flowTargets;
+  for (auto& pos : targets)
+    if (pos.isSameLevel(position))
+      flowTargets.push_back(pos.getCoord());
+  return moveTowards(target, false, flags, std::move(flowTargets));
+}
+
 bool Creature::canNavigateTo(Position pos) const {
   PROFILE;
   return pos.canNavigateToOrNeighbor(position, getMovementType());
 }
 
-CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags flags) {
+CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags flags, vector<Vec2> flowTargets) {
   PROFILE;
   CHECK(pos.isSameLevel(position));
   if (flags.stepOnTile && !pos.canEnterEmpty(this))
@@ -1722,11 +1736,36 @@ CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags fl
   if (!away && !canNavigateTo(pos))
     return CreatureAction();
   optional<LevelShortestPath> currentPath = *shortestPath;
-  for (int i : Range(2)) {
+  bool wasRepaired = false;
+  // An old path can be repaired once after a failed move, before a new one is calculated.
+  for (int i : Range(3)) {
     bool wasNew = false;
     INFO << identify() << (away ? " retreating " : " navigating ") << position.getCoord() << " to " << pos.getCoord();
-    if (!currentPath || Random.roll(10) || currentPath->isReversed() != away ||
-        currentPath->getTarget().dist8(pos) > getPosition().dist8(pos) / 10) {
+    bool needsNewPath = !currentPath || Random.roll(10) || currentPath->isReversed() != away ||
+        currentPath->getTarget().dist8(pos) > getPosition().dist8(pos) / 10;
+    if (!needsNewPath) {
+      if (!currentPath->isOutdated())
+        BenchmarkTimer::increment(BenchmarkCounter::PATH_CACHE_HIT);
+      else if (currentPath->repair(this))
+        BenchmarkTimer::increment(BenchmarkCounter::PATH_CACHE_REPAIR);
+      else
+        needsNewPath = true;
+    }
+    if (needsNewPath) {
+      if (!away) {
+        if (flowTargets.empty())
+          flowTargets.push_back(pos.getCoord());
+        if (auto field = position.getLevel()->getFlowField(flowTargets, getMovementType(), position.getCoord()))
+          for (Vec2 v : field->getNextMoves(position.getCoord())) {
+            // The only neighbors that aren't adjacent are the other ends of portals.
+            auto action = v.dist8(position.getCoord()) > 1 ? applySquare(position) : move(position.withCoord(v));
+            if (action) {
+              BenchmarkTimer::increment(BenchmarkCounter::PATH_FLOW_FIELD);
+              return action.append([](WCreature c) { c->shortestPath = none; });
+            }
+          }
+      }
+      BenchmarkTimer::increment(BenchmarkCounter::PATH_CACHE_MISS);
       INFO << "Calculating new path";
       currentPath = LevelShortestPath(this, pos, position, away ? -1.5 : 0);
       wasNew = true;
@@ -1752,10 +1791,18 @@ CreatureAction Creature::moveTowards(Position pos, bool away, NavigationFlags fl
           if (auto bridgeAction = construct(getPosition().getDir(pos2), FurnitureType::BRIDGE))
             return bridgeAction.append([path = *currentPath](WCreature c) { c->shortestPath = path; });
         }
+        if (!wasNew && !wasRepaired && currentPath->repair(this, pos2)) {
+          INFO << "Repaired path";
+          BenchmarkTimer::increment(BenchmarkCounter::PATH_CACHE_REPAIR);
+          wasRepaired = true;
+          continue;
+        }
       }
     } else
       INFO << "Position unreachable";
+    // The path may also have ended at a waypoint before the target, so a new one should be calculated.
     shortestPath = none;
+    currentPath = none;
     if (wasNew)
       break;
     else
@@ -1805,12 +1852,19 @@ void Creature::updateVisibleCreatures() {
   int range = FieldOfView::sightRange;
   visibleEnemies.clear();
   visibleCreatures.clear();
-  for (WCreature c : position.getAllCreatures(range))
-    if (canSee(c) || isUnknownAttacker(c)) {
-      visibleCreatures.push_back(c->getPosition());
-      if (isEnemy(c))
-        visibleEnemies.push_back(c->getPosition());
-    }
+  auto add = [&](WCreature c) {
+    visibleCreatures.push_back(c->getPosition());
+    if (isEnemy(c))
+      visibleEnemies.push_back(c->getPosition());
+  };
+  if (!isAffected(LastingEffect::BLIND))
+    for (WCreature c : getLevel()->getVisibleCreatures(position.getCoord(), *vision))
+      if (canSeeInPosition(c) || isUnknownAttacker(c))
+        add(c);
+  if (!unknownAttackers.empty())
+    for (WCreature c : position.getAllCreatures(range))
+      if (isUnknownAttacker(c) && !visibleCreatures.contains(c->getPosition()))
+        add(c);
 }
 
 vector<WCreature> Creature::getVisibleEnemies() const {
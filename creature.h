@@ -210,6 +210,10 @@ class Creature : public Renderable, public UniqueEntity<Creature>, public OwnedO
     bool destroy;
   };
   CreatureAction moveTowards(Position, NavigationFlags = {});
+  // Moves towards the closest of the targets, which many creatures head for at the same time, like a storage. Once
+  // they are requested often enough, the next step is looked up on a flow field shared on the level. Until then,
+  // a path to 'target', which should be one of them, is searched.
+  CreatureAction moveTowards(Position target, const PositionSet& targets, NavigationFlags = {});
   CreatureAction moveAway(Position, bool pathfinding = true);
   CreatureAction continueMoving();
   CreatureAction stayIn(WLevel, Rectangle);
@@ -293,7 +297,7 @@ class Creature : public Renderable, public UniqueEntity<Creature>, public OwnedO
 
   private:
 
-  CreatureAction moveTowards(Position, bool away, NavigationFlags);
+  CreatureAction moveTowards(Position, bool away, NavigationFlags, vector<Vec2> flowTargets = {});
   optional<MovementInfo> spendTime(TimeInterval = 1_visible);
   int canCarry(const vector<WItem>&) const;
   TribeSet getFriendlyTribes() const;
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "creature_visibility.h"
+#include "field_of_view.h"
+#include "creature.h"
+
+CreatureVisibility::Entry* CreatureVisibility::getEntry(Vec2 from, VisionId vision) {
+  auto bucket = buckets[vision].find(from / bucketSize);
+  if (bucket == buckets[vision].end())
+    return nullptr;
+  auto it = bucket->second.find(from);
+  if (it == bucket->second.end())
+    return nullptr;
+  return &it->second;
+}
+
+void CreatureVisibility::erase(Vec2 from, VisionId vision) {
+  auto bucket = buckets[vision].find(from / bucketSize);
+  if (bucket != buckets[vision].end()) {
+    bucket->second.erase(from);
+    if (bucket->second.empty())
+      buckets[vision].erase(bucket);
+  }
+}
+
+const vector<WCreature>* CreatureVisibility::get(Vec2 from, VisionId vision) {
+  if (auto entry = getEntry(from, vision)) {
+    entry->used = true;
+    return &entry->creatures;
+  }
+  return nullptr;
+}
+
+const vector<WCreature>& CreatureVisibility::add(Vec2 from, VisionId vision, vector<WCreature> creatures) {
+  ++generation;
+  for (WCreature c : creatures)
+    viewers[c->getUniqueId()].push_back(Viewer{vision, from, generation});
+  auto& entry = buckets[vision][from / bucketSize][from];
+  entry = Entry{std::move(creatures), true, generation};
+  return entry.creatures;
+}
+
+void CreatureVisibility::creatureLeft(WConstCreature c) {
+  auto it = viewers.find(c->getUniqueId());
+  if (it == viewers.end())
+    return;
+  for (auto& viewer : it->second)
+    if (auto entry = getEntry(viewer.from, viewer.vision))
+      if (entry->generation == viewer.generation)
+        erase(viewer.from, viewer.vision);
+  viewers.erase(it);
+}
+
+template <typename Fun>
+void CreatureVisibility::eraseInRange(Vec2 pos, Fun predicate) {
+  const int range = FieldOfView::sightRange;
+  Vec2 minBucket = (pos - Vec2(range, range)) / bucketSize;
+  Vec2 maxBucket = (pos + Vec2(range, range)) / bucketSize;
+  for (VisionId vision : ENUM_ALL(VisionId))
+    for (int x = minBucket.x; x <= maxBucket.x; ++x)
+      for (int y = minBucket.y; y <= maxBucket.y; ++y) {
+        auto bucket = buckets[vision].find(Vec2(x, y));
+        if (bucket == buckets[vision].end())
+          continue;
+        auto& elems = bucket->second;
+        for (auto it = elems.begin(); it != elems.end();)
+          if (max(abs(it->first.x - pos.x), abs(it->first.y - pos.y)) <= range && predicate(it->first, vision))
+            it = elems.erase(it);
+          else
+            ++it;
+        if (elems.empty())
+          buckets[vision].erase(bucket);
+      }
+}
+
+void CreatureVisibility::creatureEntered(Vec2 pos, function<bool(Vec2, VisionId)> canSee) {
+  eraseInRange(pos, canSee);
+}
+
+void CreatureVisibility::squareChanged(Vec2 pos) {
+  eraseInRange(pos, [](Vec2, VisionId) { return true; });
+}
+
+void CreatureVisibility::clearUnused() {
+  viewers.clear();
+  for (VisionId vision : ENUM_ALL(VisionId)) {
+    auto& visionBuckets = buckets[vision];
+    for (auto bucket = visionBuckets.begin(); bucket != visionBuckets.end();) {
+      auto& elems = bucket->second;
+      for (auto it = elems.begin(); it != elems.end();)
+        if (!it->second.used)
+          it = elems.erase(it);
+        else {
+          it->second.used = false;
+          for (WCreature c : it->second.creatures)
+            viewers[c->getUniqueId()].push_back(Viewer{vision, it->first, it->second.generation});
+          ++it;
+        }
+      if (elems.empty())
+        bucket = visionBuckets.erase(bucket);
+      else
+        ++bucket;
+    }
+  }
+}
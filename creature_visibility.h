@@ -0,0 +1,42 @@
+#pragma once
+
+#include "util.h"
+#include "vision_id.h"
+#include "unique_entity.h"
+
+// The creatures that are in the field of view from a square, for every VisionId. The field of view isn't symmetric,
+// so every viewpoint is computed separately. A result is dropped when a creature in it leaves its square, when a
+// creature enters a square that it can see, or when a square within the sight range changes its transparency.
+// It's also dropped if it's not used for a whole turn.
+class CreatureVisibility {
+  public:
+  const vector<WCreature>* get(Vec2 from, VisionId);
+  const vector<WCreature>& add(Vec2 from, VisionId, vector<WCreature>);
+  void creatureLeft(WConstCreature);
+  void creatureEntered(Vec2, function<bool(Vec2 from, VisionId)> canSee);
+  void squareChanged(Vec2);
+  void clearUnused();
+
+  private:
+  struct Entry {
+    vector<WCreature> creatures;
+    bool used;
+    int generation;
+  };
+  // Results are bucketed by their viewpoint, so the ones around a square can be found without scanning all of them.
+  static constexpr int bucketSize = 8;
+  using Bucket = unordered_map<Vec2, Entry, CustomHash<Vec2>>;
+  EnumMap<VisionId, unordered_map<Vec2, Bucket, CustomHash<Vec2>>> buckets;
+  struct Viewer {
+    VisionId vision;
+    Vec2 from;
+    int generation;
+  };
+  // The results that contain a creature. A record is stale if its result was dropped or computed again since.
+  unordered_map<UniqueEntity<Creature>::Id, vector<Viewer>, CustomHash<UniqueEntity<Creature>::Id>> viewers;
+  int generation = 0;
+  Entry* getEntry(Vec2 from, VisionId);
+  void erase(Vec2 from, VisionId);
+  template <typename Fun>
+  void eraseInRange(Vec2, Fun predicate);
+};
@@ -0,0 +1,52 @@
+#include "stdafx.h"
+#include "danger_map.h"
+
+void DangerMap::markEnemies(TribeId tribe, Rectangle bounds, function<bool(Vec2)> canEnter,
+    const vector<Vec2>& enemies, LocalTime now, LocalTime until) {
+  auto it = tribes.find(tribe);
+  if (it == tribes.end())
+    it = tribes.insert(make_pair(tribe, TribeDanger{Table<LocalTime>(bounds, LocalTime()), {}})).first;
+  auto& danger = it->second;
+  for (auto elem = danger.marked.begin(); elem != danger.marked.end();)
+    if (elem->second <= now)
+      elem = danger.marked.erase(elem);
+    else
+      ++elem;
+  vector<Vec2> sources;
+  for (Vec2 v : enemies)
+    if (v.inRectangle(bounds)) {
+      auto& marked = danger.marked[v];
+      if (marked < until) {
+        marked = until;
+        sources.push_back(v);
+      }
+    }
+  if (sources.empty())
+    return;
+  // A single search from all sources visits every cell once, even if it's close to many of them.
+  const int infinity = 1000000;
+  Table<int> dist(Rectangle::boundingBox(sources).minusMargin(-radius).intersection(bounds), infinity);
+  queue<Vec2> q;
+  for (Vec2 v : sources) {
+    dist[v] = 0;
+    q.push(v);
+  }
+  while (!q.empty()) {
+    Vec2 pos = q.front();
+    q.pop();
+    if (danger.until[pos] < until)
+      danger.until[pos] = until;
+    if (dist[pos] >= radius || (dist[pos] > 0 && !canEnter(pos)))
+      continue;
+    for (Vec2 v : pos.neighbors8())
+      if (v.inRectangle(dist.getBounds()) && dist[v] == infinity) {
+        dist[v] = dist[pos] + 1;
+        q.push(v);
+      }
+  }
+}
+
+bool DangerMap::isDangerous(TribeId tribe, Vec2 pos, LocalTime now) const {
+  auto it = tribes.find(tribe);
+  return it != tribes.end() && it->second.until[pos] > now;
+}
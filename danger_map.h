@@ -0,0 +1,24 @@
+#pragma once
+
+#include "util.h"
+#include "game_time.h"
+#include "tribe.h"
+
+// The time until which every cell is close to an enemy of a tribe. Danger spreads only through cells that a walker
+// can enter, so it doesn't leak through walls, rock or water, but the blocking cells next to it are marked too.
+// It's kept per level and shared by all collectives of the tribe, and an enemy that was already marked until a later
+// time, for example by another collective, doesn't need another pass.
+class DangerMap {
+  public:
+  static const int radius = 10;
+  void markEnemies(TribeId, Rectangle bounds, function<bool(Vec2)> canEnter, const vector<Vec2>& enemies,
+      LocalTime now, LocalTime until);
+  bool isDangerous(TribeId, Vec2, LocalTime now) const;
+
+  private:
+  struct TribeDanger {
+    Table<LocalTime> until;
+    unordered_map<Vec2, LocalTime, CustomHash<Vec2>> marked;
+  };
+  unordered_map<TribeId, TribeDanger, CustomHash<TribeId>> tribes;
+};
@@ -88,7 +88,7 @@ static void airBlast(WCreature who, Position position, Vec2 direction) {
 
 void Effect::emitPoisonGas(Position pos, double amount, bool msg) {
   PROFILE;
-  for (Position v : pos.neighbors8())
+  for (int i : All(pos.neighbors8()))
     pos.addPoisonGas(amount / 2);
   pos.addPoisonGas(amount);
   if (msg) {
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "unique_entity.h"
+#include "util.h"
+
+// Maps UniqueEntity ids to positions in a dense array. It's an open addressing table with linear probing, and
+// erasing shifts the following entries back instead of leaving tombstones.
+template <typename T>
+class EntityIndex {
+  public:
+  using EntityId = typename UniqueEntity<T>::Id;
+
+  int find(EntityId id) const {
+    if (slots.empty())
+      return -1;
+    GenericId key = id.getGenericId();
+    for (int i = getBucket(key);; i = (i + 1) & mask)
+      if (slots[i].index == -1 || slots[i].key == key)
+        return slots[i].index;
+  }
+
+  void insert(EntityId id, int index) {
+    if (2 * (size + 1) > slots.size())
+      grow();
+    GenericId key = id.getGenericId();
+    int i = getBucket(key);
+    while (slots[i].index != -1) {
+      CHECK(slots[i].key != key);
+      i = (i + 1) & mask;
+    }
+    slots[i] = Slot{key, index};
+    ++size;
+  }
+
+  void update(EntityId id, int index) {
+    slots[findSlot(id.getGenericId())].index = index;
+  }
+
+  void erase(EntityId id) {
+    int hole = findSlot(id.getGenericId());
+    for (int i = (hole + 1) & mask; slots[i].index != -1; i = (i + 1) & mask) {
+      // An entry can move into the hole only if the hole lies between its bucket and its current slot.
+      int bucket = getBucket(slots[i].key);
+      if (((i - bucket) & mask) >= ((i - hole) & mask)) {
+        slots[hole] = slots[i];
+        hole = i;
+      }
+    }
+    slots[hole].index = -1;
+    --size;
+  }
+
+  void clear() {
+    slots.clear();
+    size = 0;
+    mask = 0;
+  }
+
+  private:
+  struct Slot {
+    GenericId key;
+    int index;
+  };
+
+  int getBucket(GenericId key) const {
+    return int((uint64_t(key) * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+  }
+
+  int findSlot(GenericId key) const {
+    CHECK(!slots.empty());
+    for (int i = getBucket(key);; i = (i + 1) & mask) {
+      CHECK(slots[i].index != -1);
+      if (slots[i].key == key)
+        return i;
+    }
+  }
+
+  void grow() {
+    vector<Slot> old = std::move(slots);
+    int capacity = max(8, 2 * old.size());
+    slots = vector<Slot>(capacity, Slot{0, -1});
+    mask = capacity - 1;
+    for (auto& slot : old)
+      if (slot.index != -1) {
+        int i = getBucket(slot.key);
+        while (slots[i].index != -1)
+          i = (i + 1) & mask;
+        slots[i] = slot;
+      }
+  }
+
+  vector<Slot> slots;
+  int size = 0;
+  int mask = 0;
+};
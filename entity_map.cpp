@@ -102,6 +102,7 @@ bool EntityMap<Key, Value>::empty() const {
 template <typename Key, typename Value>
 void EntityMap<Key, Value>::clear() {
   elems.clear();
+  index.clear();
 }
 
 template <typename Key, typename Value>
@@ -111,51 +112,71 @@ int EntityMap<Key, Value>::getSize() const {
 
 template <typename Key, typename Value>
 vector<typename UniqueEntity<Key>::Id> EntityMap<Key, Value>::getKeys() const {
-  return ::getKeys(elems);
+  return elems.transform([](const pair<EntityId, Value>& elem) { return elem.first; });
 }
 
 template <typename Key, typename Value>
 void EntityMap<Key, Value>::set(EntityId id, const Value& value) {
-  elems[id] = value;
+  getOrInit(id) = value;
 }
 
 template <typename Key, typename Value>
 void EntityMap<Key, Value>::erase(EntityId id) {
-  elems.erase(id);
+  int i = index.find(id);
+  if (i == -1)
+    return;
+  index.erase(id);
+  if (i < elems.size() - 1)
+    index.update(elems.back().first, i);
+  elems.removeIndex(i);
 }
 
 template <typename Key, typename Value>
 const Value& EntityMap<Key, Value>::getOrFail(EntityId id) const {
-  return elems.at(id);
+  int i = index.find(id);
+  CHECK(i != -1) << "Entity not found " << id.getGenericId();
+  return elems[i].second;
 }
 
 template <typename Key, typename Value>
 Value& EntityMap<Key, Value>::getOrFail(EntityId id) {
-  return elems.at(id);
+  int i = index.find(id);
+  CHECK(i != -1) << "Entity not found " << id.getGenericId();
+  return elems[i].second;
 }
 
 template <typename Key, typename Value>
 Value& EntityMap<Key, Value>::getOrInit(EntityId id) {
-  return elems[id];
+  int i = index.find(id);
+  if (i == -1) {
+    i = elems.size();
+    index.insert(id, i);
+    elems.emplace_back(id, Value());
+  }
+  return elems[i].second;
 }
 
 template <typename Key, typename Value>
 optional<Value> EntityMap<Key, Value>::getMaybe(EntityId id) const {
-  return getValueMaybe(elems, id);
+  int i = index.find(id);
+  if (i == -1)
+    return none;
+  else
+    return elems[i].second;
 }
 
 template <typename Key, typename Value>
 const Value& EntityMap<Key, Value>::getOrElse(EntityId id, const Value& value) const {
-  auto iter = elems.find(id);
-  if (iter != elems.end())
-    return iter->second;
-  else
+  int i = index.find(id);
+  if (i == -1)
     return value;
+  else
+    return elems[i].second;
 }
 
 template<typename Key, typename Value>
 bool EntityMap<Key,Value>::hasKey(EntityId key) const {
-  return elems.count(key);
+  return index.find(key) != -1;
 }
 
 template <typename Key, typename Value>
@@ -168,10 +189,24 @@ typename EntityMap<Key, Value>::Iter EntityMap<Key, Value>::end() const {
   return elems.end();
 }
 
+// Uses the same format as the map<EntityId, Value> that used to be here, but the entries are written in iteration
+// order rather than sorted by id.
 template <typename Key, typename Value>
 template <class Archive> 
 void EntityMap<Key, Value>::serialize(Archive& ar, const unsigned int version) {
-  ar(elems);
+  cereal::size_type size = elems.size();
+  ar(cereal::make_size_tag(size));
+  if (Archive::is_loading::value) {
+    clear();
+    for (int i : Range((int) size)) {
+      EntityId id(0);
+      Value value;
+      ar(cereal::make_map_item(id, value));
+      set(id, value);
+    }
+  } else
+    for (auto& elem : elems)
+      ar(cereal::make_map_item(elem.first, elem.second));
 }
 
 SERIALIZABLE_TMPL(EntityMap, Creature, double);
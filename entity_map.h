@@ -17,6 +17,7 @@
 
 #include "unique_entity.h"
 #include "util.h"
+#include "entity_index.h"
 
 template <typename Key, typename Value>
 class EntityMap {
@@ -60,12 +61,14 @@ class EntityMap {
   template <class Archive> 
   void serialize(Archive& ar, const unsigned int version);
 
-  typedef typename map<EntityId, Value>::const_iterator Iter;
+  // Iterates in insertion order, except that erasing moves the last element into the erased one's place.
+  typedef typename vector<pair<EntityId, Value>>::const_iterator Iter;
 
   Iter begin() const;
   Iter end() const;
 
   private:
-  map<EntityId, Value> SERIAL(elems);
+  vector<pair<EntityId, Value>> elems;
+  EntityIndex<Key> index;
 };
 
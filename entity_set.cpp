@@ -46,52 +46,62 @@ int EntitySet<T>::getSize() const {
 
 template <class T>
 void EntitySet<T>::insert(const T* e) {
-  elems.insert(e->getUniqueId());
+  insert(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::erase(const T* e) {
-  elems.erase(e->getUniqueId());
+  erase(e->getUniqueId());
 }
 
 template <class T>
 bool EntitySet<T>::contains(const T* e) const {
-  return elems.count(e->getUniqueId());
+  return contains(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::insert(WeakPointer<const T> e) {
-  elems.insert(e->getUniqueId());
+  insert(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::erase(WeakPointer<const T> e) {
-  elems.erase(e->getUniqueId());
+  erase(e->getUniqueId());
 }
 
 template <class T>
 bool EntitySet<T>::contains(WeakPointer<const T> e) const {
-  return elems.count(e->getUniqueId());
+  return contains(e->getUniqueId());
 }
 
 template <class T>
 void EntitySet<T>::insert(typename UniqueEntity<T>::Id e) {
-  elems.insert(e);
+  if (index.find(e) == -1) {
+    index.insert(e, elems.size());
+    elems.push_back(e);
+  }
 }
 
 template <class T>
 void EntitySet<T>::clear() {
   elems.clear();
+  index.clear();
 }
 
 template <class T>
 void EntitySet<T>::erase(typename UniqueEntity<T>::Id e) {
-  elems.erase(e);
+  int i = index.find(e);
+  if (i == -1)
+    return;
+  index.erase(e);
+  if (i < elems.size() - 1)
+    index.update(elems.back(), i);
+  elems.removeIndex(i);
 }
 
 template <class T>
 bool EntitySet<T>::contains(typename UniqueEntity<T>::Id e) const {
-  return elems.count(e);
+  return index.find(e) != -1;
 }
 
 template <class T>
@@ -109,8 +119,24 @@ ItemPredicate EntitySet<Item>::containsPredicate() const {
   return [this](WConstItem it) { return contains(it); };
 }
 
+// Uses the same format as the set<Id> that used to be here, but the elements are written in iteration order
+// rather than sorted by id.
 template <class T>
-SERIALIZE_TMPL(EntitySet<T>, elems)
+template <class Archive>
+void EntitySet<T>::serialize(Archive& ar, const unsigned int version) {
+  cereal::size_type size = elems.size();
+  ar(cereal::make_size_tag(size));
+  if (Archive::is_loading::value) {
+    clear();
+    for (int i : Range((int) size)) {
+      typename UniqueEntity<T>::Id id(0);
+      ar(id);
+      insert(id);
+    }
+  } else
+    for (auto& elem : elems)
+      ar(elem);
+}
 
 SERIALIZABLE_TMPL(EntitySet, Item);
 SERIALIZABLE_TMPL(EntitySet, Task);
@@ -17,6 +17,7 @@
 
 #include "unique_entity.h"
 #include "util.h"
+#include "entity_index.h"
 
 template <typename T>
 class EntitySet {
@@ -44,16 +45,22 @@ class EntitySet {
 
   ItemPredicate containsPredicate() const;
 
-  typedef typename set<typename UniqueEntity<T>::Id>::const_iterator Iter;
+  // Iterates in insertion order, except that erasing moves the last element into the erased one's place.
+  typedef typename vector<typename UniqueEntity<T>::Id>::const_iterator Iter;
 
   Iter begin() const;
   Iter end() const;
 
+  // Doesn't depend on the iteration order.
   size_t getHash() const {
-    return combineHashIter(elems.begin(), elems.end());
+    size_t ret = 0;
+    for (auto& elem : elems)
+      ret += combineHash(elem);
+    return ret;
   }
 
   private:
-  set<typename UniqueEntity<T>::Id> SERIAL(elems);
+  vector<typename UniqueEntity<T>::Id> elems;
+  EntityIndex<T> index;
 };
 
@@ -36,6 +36,10 @@ namespace EventInfo {
     vector<WItem> items;
   };
 
+  struct ItemsChanged {
+    Position position;
+  };
+
   struct Projectile {
     optional<FXInfo> fx;
     optional<ViewId> viewId;
@@ -114,9 +118,9 @@ namespace EventInfo {
     Position pos;
   };
 
-  class GameEvent : public variant<CreatureMoved, CreatureKilled, ItemsPickedUp, ItemsDropped, ItemsAppeared, Projectile,
-      ConqueredEnemy, WonGame, TechbookRead, Alarm, CreatureTortured, CreatureStunned, MovementChanged,
-      TrapTriggered, TrapDisarmed, FurnitureDestroyed, ItemsEquipped, CreatureEvent, VisibilityChanged, RetiredGame,
+  class GameEvent : public variant<CreatureMoved, CreatureKilled, ItemsPickedUp, ItemsDropped, ItemsAppeared,
+      ItemsChanged, Projectile, ConqueredEnemy, WonGame, TechbookRead, Alarm, CreatureTortured, CreatureStunned,
+      MovementChanged, TrapTriggered, TrapDisarmed, FurnitureDestroyed, ItemsEquipped, CreatureEvent, VisibilityChanged, RetiredGame,
       CreatureAttacked, FX> {
     using variant::variant;
   };
@@ -20,12 +20,26 @@
 #include "square_array.h"
 #include "level.h"
 #include "position.h"
+#include "benchmark.h"
 
 template <class Archive>
 void FieldOfView::serialize(Archive& ar, const unsigned int) {
-  ar(level, vision, blocking);
-  if (Archive::is_loading::value)
+  ar(level, vision);
+  if (Archive::is_loading::value) {
+    Table<bool> blockingTable;
+    ar(blockingTable);
+    blockingBounds = blockingTable.getBounds();
+    columnWords = (blockingBounds.height() + 63) / 64;
+    blocking = vector<uint64_t>(blockingBounds.width() * columnWords, ~uint64_t(0));
+    for (Vec2 v : blockingBounds)
+      setBlocking(v, blockingTable[v]);
     visibility = Table<unique_ptr<Visibility>>(level->getBounds());
+  } else {
+    Table<bool> blockingTable(blockingBounds);
+    for (Vec2 v : blockingBounds)
+      blockingTable[v] = isBlocking(v);
+    ar(blockingTable);
+  }
 }
 
 SERIALIZABLE(FieldOfView)
@@ -33,76 +47,103 @@ SERIALIZABLE(FieldOfView)
 SERIALIZATION_CONSTRUCTOR_IMPL(FieldOfView)
 
 FieldOfView::FieldOfView(WLevel l, VisionId v)
-    : level(l), visibility(l->getBounds()), vision(v), blocking(l->getBounds().minusMargin(-1), true) {
-  for (auto v : blocking.getBounds())
-    blocking[v] = !Position(v, level).canSeeThru(vision);
+    : level(l), visibility(l->getBounds()), vision(v), blockingBounds(l->getBounds().minusMargin(-1)),
+      columnWords((blockingBounds.height() + 63) / 64),
+      blocking(blockingBounds.width() * columnWords, ~uint64_t(0)) {
+  for (auto v : blockingBounds)
+    setBlocking(v, !Position(v, level).canSeeThru(vision));
 }
 
-bool FieldOfView::canSee(Vec2 from, Vec2 to) {
-  PROFILE;;
-  if ((from - to).lengthD() > sightRange)
-    return false;
-  if (!visibility[from])
-    visibility[from].reset(new Visibility(level->getBounds(), blocking, from.x, from.y));
-  return visibility[from]->checkVisible(to.x - from.x, to.y - from.y);
+bool FieldOfView::isBlocking(Vec2 pos) const {
+  int y = pos.y - blockingBounds.top();
+  return (blocking[(pos.x - blockingBounds.left()) * columnWords + y / 64] >> (y % 64)) & 1;
 }
-  
-void FieldOfView::squareChanged(Vec2 pos) {
-  blocking[pos] = !Position(pos, level).canSeeThru(vision);
-  vector<Vec2> updateList;
-  if (!visibility[pos])
-    visibility[pos].reset(new Visibility(level->getBounds(), blocking, pos.x, pos.y));
-  vector<Vec2> visible = visibility[pos]->getVisibleTiles();
-  for (Vec2 v : visible)
-    if (visibility[v] && visibility[v]->checkVisible(pos.x - v.x, pos.y - v.y)) {
-      visibility[v].reset();
-    }
+
+void FieldOfView::setBlocking(Vec2 pos, bool value) {
+  int y = pos.y - blockingBounds.top();
+  uint64_t& word = blocking[(pos.x - blockingBounds.left()) * columnWords + y / 64];
+  uint64_t bit = uint64_t(1) << (y % 64);
+  if (value)
+    word |= bit;
+  else
+    word &= ~bit;
+}
+
+// Returns the bits of column x from y downwards. Cells outside of the table block vision.
+uint64_t FieldOfView::getBlockingBits(int x, int y) const {
+  if (x < blockingBounds.left() || x >= blockingBounds.right())
+    return ~uint64_t(0);
+  const uint64_t* column = &blocking[(x - blockingBounds.left()) * columnWords];
+  auto getWord = [&](int index) {
+    return index >= 0 && index < columnWords ? column[index] : ~uint64_t(0);
+  };
+  int start = y - blockingBounds.top();
+  int index = start >= 0 ? start / 64 : (start - 63) / 64;
+  int offset = start - index * 64;
+  if (offset == 0)
+    return getWord(index);
+  else
+    return (getWord(index) >> offset) | (getWord(index + 1) << (64 - offset));
 }
 
-void FieldOfView::Visibility::setVisible(Rectangle bounds, int x, int y) {
-  if (Vec2(px + x, py + y).inRectangle(bounds) &&
-      !visible[x + sightRange][y + sightRange] && x * x + y * y <= sightRange * sightRange) {
-    visible[x + sightRange][y + sightRange] = 1;
-    visibleTiles.push_back(Vec2(px + x, py + y));
+auto FieldOfView::getVisibility(Vec2 pos) -> Visibility& {
+  auto& elem = visibility[pos];
+  if (!elem) {
+    uint64_t blockingWindow[sightDiameter];
+    for (int i : Range(sightDiameter))
+      blockingWindow[i] = getBlockingBits(pos.x - sightRange + i, pos.y - sightRange);
+    elem.reset(new Visibility(level->getBounds(), blockingWindow, pos.x, pos.y));
+    cacheSize += elem->getMemoryUsage();
   }
+  elem->lastUsed = ++useCounter;
+  return *elem;
 }
 
-FieldOfView::Visibility::Visibility(Rectangle bounds, const Table<bool>& blocking, int x, int y) : px(x), py(y) {
-  PROFILE;
-  memset(visible, 0, (2 * sightRange + 1) * (2 * sightRange + 1));
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x + px, y + py)]; },
-      [&](int px, int py) { setVisible(bounds, px, py); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange, 2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x + py, y - px)]; },
-      [&](int px, int py) { setVisible(bounds, py, -px); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x - px, y - py)]; },
-      [&](int px, int py) { setVisible(bounds, -px, -py); });
-  calculate(2 * sightRange, 2 * sightRange,2 * sightRange,2,-1,1,1,1,
-      [&](int px, int py) { return blocking[Vec2(x - py, y + px)]; },
-      [&](int px, int py) { setVisible(bounds, -py, px); });
-  setVisible(bounds, 0, 0);
-/*  ++numSamples;
-  totalIter += visibleTiles.size();
-  if (numSamples%100 == 0)
-    INFO << numSamples << " iterations " << totalIter / numSamples << " avg";*/
+bool FieldOfView::canSee(Vec2 from, Vec2 to) {
+  PROFILE;;
+  if ((from - to).lengthD() > sightRange)
+    return false;
+  return getVisibility(from).checkVisible(to.x - from.x, to.y - from.y);
 }
 
-const vector<Vec2>& FieldOfView::Visibility::getVisibleTiles() const {
-  return visibleTiles;
+void FieldOfView::squareChanged(Vec2 pos) {
+  bool blocks = !Position(pos, level).canSeeThru(vision);
+  if (blocks == isBlocking(pos))
+    return;
+  setBlocking(pos, blocks);
+  for (Vec2 v : Rectangle::centered(pos, sightRange).intersection(visibility.getBounds()))
+    if (auto& elem = visibility[v])
+      if (elem->dependsOn(pos.x - v.x, pos.y - v.y)) {
+        cacheSize -= elem->getMemoryUsage();
+        elem.reset();
+      }
 }
 
-const vector<Vec2>& FieldOfView::getVisibleTiles(Vec2 from) {
-  if (!visibility[from]) {
-    visibility[from].reset(new Visibility(level->getBounds(), blocking, from.x, from.y));
+void FieldOfView::trimCache() {
+  if (cacheSize <= cacheBudget)
+    return;
+  vector<Vec2> cached;
+  for (Vec2 v : visibility.getBounds())
+    if (visibility[v])
+      cached.push_back(v);
+  std::sort(cached.begin(), cached.end(),
+      [&](Vec2 v1, Vec2 v2) { return visibility[v1]->lastUsed < visibility[v2]->lastUsed; });
+  // Trim some more, so that it doesn't happen on every turn.
+  for (Vec2 v : cached) {
+    if (cacheSize <= cacheBudget * 3 / 4)
+      break;
+    cacheSize -= visibility[v]->getMemoryUsage();
+    visibility[v].reset();
   }
-  return visibility[from]->getVisibleTiles();
 }
 
+void FieldOfView::setCacheBudget(int bytes) {
+  cacheBudget = bytes;
+}
 
-void FieldOfView::Visibility::calculate(int left, int right, int up, int h, int x1, int y1, int x2, int y2,
-    function<bool (int, int)> isBlocking, function<void (int, int)> setVisible){
+template <typename IsBlocking, typename SetVisible>
+static void calculate(int left, int right, int up, int h, int x1, int y1, int x2, int y2,
+    IsBlocking& isBlocking, SetVisible& setVisible){
   if (y2*x1>=y1*x2) return;
   if (h>up) return;
   int leftx=x1, lefty=y1, rightx=x2, righty=y2;
@@ -140,9 +181,58 @@ void FieldOfView::Visibility::calculate(int left, int right, int up, int h, int
   calculate(left, right, up, h + 2, leftx, lefty, rightx, righty, isBlocking, setVisible);
 }
 
-bool FieldOfView::Visibility::checkVisible(int x, int y) const {
-  return x >= -sightRange && y >= -sightRange && x <= sightRange && y <= sightRange && 
-    visible[sightRange + x][sightRange + y] == 1;
+FieldOfView::Visibility::Visibility(Rectangle bounds, const uint64_t* blocking, int px, int py) {
+  PROFILE;
+  BenchmarkTimer timer(BenchmarkSection::FIELD_OF_VIEW);
+  memset(visible, 0, sizeof(visible));
+  memset(queried, 0, sizeof(queried));
+  static thread_local vector<Vec2> tiles;
+  tiles.clear();
+  auto isBlocking = [&](int x, int y) {
+    queried[x + sightRange] |= uint64_t(1) << (y + sightRange);
+    return (blocking[x + sightRange] >> (y + sightRange)) & 1;
+  };
+  auto setVisible = [&](int x, int y) {
+    uint64_t& word = visible[x + sightRange];
+    uint64_t bit = uint64_t(1) << (y + sightRange);
+    if (!(word & bit) && x * x + y * y <= sightRange * sightRange && Vec2(px + x, py + y).inRectangle(bounds)) {
+      word |= bit;
+      tiles.push_back(Vec2(px + x, py + y));
+    }
+  };
+  // Every quarter of the circle is computed with the same function, with coordinates rotated.
+  auto isBlocking1 = [&](int x, int y) { return isBlocking(y, -x); };
+  auto setVisible1 = [&](int x, int y) { setVisible(y, -x); };
+  auto isBlocking2 = [&](int x, int y) { return isBlocking(-x, -y); };
+  auto setVisible2 = [&](int x, int y) { setVisible(-x, -y); };
+  auto isBlocking3 = [&](int x, int y) { return isBlocking(-y, x); };
+  auto setVisible3 = [&](int x, int y) { setVisible(-y, x); };
+  calculate(2 * sightRange, 2 * sightRange, 2 * sightRange, 2, -1, 1, 1, 1, isBlocking, setVisible);
+  calculate(2 * sightRange, 2 * sightRange, 2 * sightRange, 2, -1, 1, 1, 1, isBlocking1, setVisible1);
+  calculate(2 * sightRange, 2 * sightRange, 2 * sightRange, 2, -1, 1, 1, 1, isBlocking2, setVisible2);
+  calculate(2 * sightRange, 2 * sightRange, 2 * sightRange, 2, -1, 1, 1, 1, isBlocking3, setVisible3);
+  setVisible(0, 0);
+  visibleTiles = vector<Vec2>(tiles.begin(), tiles.end());
 }
 
+const vector<Vec2>& FieldOfView::Visibility::getVisibleTiles() const {
+  return visibleTiles;
+}
 
+int FieldOfView::Visibility::getMemoryUsage() const {
+  return sizeof(Visibility) + visibleTiles.size() * sizeof(Vec2);
+}
+
+const vector<Vec2>& FieldOfView::getVisibleTiles(Vec2 from) {
+  return getVisibility(from).getVisibleTiles();
+}
+
+bool FieldOfView::Visibility::checkVisible(int x, int y) const {
+  return x >= -sightRange && y >= -sightRange && x <= sightRange && y <= sightRange &&
+    ((visible[sightRange + x] >> (sightRange + y)) & 1);
+}
+
+bool FieldOfView::Visibility::dependsOn(int x, int y) const {
+  return x >= -sightRange && y >= -sightRange && x <= sightRange && y <= sightRange &&
+    ((queried[sightRange + x] >> (sightRange + y)) & 1);
+}
@@ -26,37 +26,51 @@ class FieldOfView {
   bool canSee(Vec2 from, Vec2 to);
   const vector<Vec2>& getVisibleTiles(Vec2 from);
   void squareChanged(Vec2 pos);
+  // Drops the least recently used viewpoints if the cache is over its memory budget. The references returned by
+  // getVisibleTiles() are only invalidated here and in squareChanged().
+  void trimCache();
+  void setCacheBudget(int bytes);
 
   SERIALIZATION_DECL(FieldOfView)
 
   const static int sightRange = 30;
+  const static int defaultCacheBudget = 16 * 1024 * 1024;
 
   private:
-
+  const static int sightDiameter = 2 * sightRange + 1;
 
   class Visibility {
     public:
+    Visibility(Rectangle bounds, const uint64_t* blocking, int x, int y);
 
-    bool checkVisible(int x,int y) const;
+    bool checkVisible(int x, int y) const;
+    // Returns true if the result depends on the cell at the given offset.
+    bool dependsOn(int x, int y) const;
     const vector<Vec2>& getVisibleTiles() const;
+    int getMemoryUsage() const;
 
-    Visibility(Rectangle bounds, const Table<bool>& blocking, int x, int y);
+    long long lastUsed = 0;
 
     private:
-    char visible[sightRange * 2 + 1][sightRange * 2 + 1];
+    // Both are indexed by x offset, with one bit for every y offset.
+    uint64_t visible[sightDiameter];
+    uint64_t queried[sightDiameter];
     vector<Vec2> visibleTiles;
-    void calculate(int,int,int,int, int, int, int, int,
-        function<bool (int, int)> isBlocking,
-        function<void (int, int)> setVisible);
-    void setVisible(Rectangle bounds, int, int);
-
-    int px;
-    int py;
   };
-  
+
+  Visibility& getVisibility(Vec2);
+  bool isBlocking(Vec2) const;
+  void setBlocking(Vec2, bool);
+  uint64_t getBlockingBits(int x, int y) const;
+
   WLevel SERIAL(level);
   Table<unique_ptr<Visibility>> visibility;
   VisionId SERIAL(vision);
-  Table<bool> SERIAL(blocking);
+  // One bit for every cell that blocks vision, stored column by column. Saved as a Table<bool>.
+  Rectangle blockingBounds;
+  int columnWords = 0;
+  vector<uint64_t> blocking;
+  int cacheSize = 0;
+  int cacheBudget = defaultCacheBudget;
+  long long useCounter = 0;
 };
-
@@ -326,6 +326,10 @@ double Furniture::getLightEmission() const {
     return lightEmission;
 }
 
+double Furniture::getBaseLightEmission() const {
+  return lightEmission;
+}
+
 bool Furniture::canHide() const {
   return canHideHere;
 }
@@ -63,6 +63,8 @@ class Furniture : public OwnedObject<Furniture> {
   void onConstructedBy(WCreature);
   FurnitureLayer getLayer() const;
   double getLightEmission() const;
+  // The light that the furniture emits when it's not burning. Fire adds a separate creature light source.
+  double getBaseLightEmission() const;
   bool canHide() const;
   bool emitsWarning(WConstCreature) const;
   bool canRemoveWithCreaturePresent() const;
@@ -344,6 +344,25 @@ optional<ExitInfo> Game::updateModel(WModel model, double totalTime) {
   } while (1);
 }
 
+// With SIMULATE_INACTIVE_SITES every site that the player isn't on is advanced in chunks of this many turns.
+// The sites are staggered so that only a fraction of them is simulated on any given global turn.
+static const int inactiveModelUpdateInterval = 10;
+
+void Game::updateInactiveModels(GlobalTime time) {
+  WModel currentModel = getCurrentModel();
+  int index = 0;
+  for (Vec2 v : models.getBounds())
+    if (WModel model = models[v].get()) {
+      ++index;
+      auto id = model->getTopLevel()->getUniqueId();
+      if (model == currentModel || !localTime.count(id) ||
+          (time.getVisibleInt() + index) % inactiveModelUpdateInterval != 0)
+        continue;
+      localTime[id] += inactiveModelUpdateInterval;
+      updateModel(model, localTime[id]);
+    }
+}
+
 bool Game::isVillainActive(WConstCollective col) {
   const WModel m = col->getModel();
   return m == getMainModel().get() || campaign->isInInfluence(getModelCoords(m));
@@ -372,6 +391,8 @@ void Game::tick(GlobalTime time) {
     if (isVillainActive(col))
       col->update(col->getModel() == getCurrentModel());
   }
+  if (options && options->getBoolValue(OptionId::SIMULATE_INACTIVE_SITES))
+    updateInactiveModels(time);
 }
 
 void Game::exitAction() {
@@ -99,6 +99,7 @@ class Game : public OwnedObject<Game> {
   void tick(GlobalTime);
   Vec2 getModelCoords(const WModel) const;
   optional<ExitInfo> updateModel(WModel, double totalTime);
+  void updateInactiveModels(GlobalTime);
   string getPlayerName() const;
   void uploadEvent(const string& name, const map<string, string>&);
 
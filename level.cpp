@@ -39,6 +39,18 @@
 #include "furniture_array.h"
 #include "portals.h"
 #include "roof_support.h"
+#include "lighting.h"
+#include "creature_visibility.h"
+#include "danger_map.h"
+#include "benchmark.h"
+
+static Table<int> getMovementRegionTable(Rectangle bounds) {
+  return Table<int>(Rectangle(Level::getMovementRegion(bounds.bottomRight() - Vec2(1, 1)) + Vec2(1, 1)), 0);
+}
+
+// Increase it when the rules of movement in Position::canNavigate change, so that the sectors saved by older
+// versions are recomputed.
+static const int sectorsVersion = 1;
 
 template <class Archive> 
 void Level::serialize(Archive& ar, const unsigned int version) {
@@ -47,8 +59,19 @@ void Level::serialize(Archive& ar, const unsigned int version) {
   ar(name, sunlight, bucketMap, lightAmount, unavailable);
   ar(levelId, noDiagonalPassing, lightCapAmount, creatureIds, memoryUpdates);
   ar(furniture, tickingFurniture, covered, roofSupport, portals);
-  if (Archive::is_loading::value) // some code requires these Sectors to be always initialized
+  // The saved sectors are only used if they were computed with the same rules of movement.
+  int savedSectorsVersion = sectorsVersion;
+  if (version >= 2)
+    ar(savedSectorsVersion, sectors);
+  else if (version == 1)
+    ar(sectors);
+  if (Archive::is_loading::value) {
+    if (version < 2 || savedSectorsVersion != sectorsVersion)
+      sectors.clear();
+    // some code requires these Sectors to be always initialized
     getSectors({MovementTrait::WALK});
+    movementChanges = getMovementRegionTable(getBounds());
+  }
 }  
 
 SERIALIZABLE(Level);
@@ -64,7 +87,7 @@ Level::Level(Private, SquareArray s, FurnitureArray f, WModel m, const string& n
       name(n), sunlight(sun), roofSupport(squares->getBounds()),
       bucketMap(squares->getBounds().width(), squares->getBounds().height(),
       FieldOfView::sightRange), lightAmount(squares->getBounds(), 0), lightCapAmount(squares->getBounds(), 1),
-      levelId(id), portals(squares->getBounds()) {
+      movementChanges(getMovementRegionTable(squares->getBounds())), levelId(id), portals(squares->getBounds()) {
 }
 
 PLevel Level::create(SquareArray s, FurnitureArray f, WModel m, const string& n,
@@ -83,7 +106,8 @@ PLevel Level::create(SquareArray s, FurnitureArray f, WModel m, const string& n,
   for (VisionId vision : ENUM_ALL(VisionId))
     (*ret->fieldOfView)[vision] = FieldOfView(ret.get(), vision);
   for (auto pos : ret->getAllPositions()) {
-    ret->addLightSource(pos.getCoord(), pos.getLightEmission(), 1);
+    for (auto f : pos.getFurniture())
+      ret->addLightSource(pos.getCoord(), f->getBaseLightEmission(), 1);
     if (pos.isBuildingSupport())
       ret->roofSupport->add(pos.getCoord());
   }
@@ -132,28 +156,35 @@ void Level::removeLightSource(Vec2 pos, double radius) {
 }
 
 void Level::addLightSource(Vec2 pos, double radius, int numLight) {
-  if (radius > 0) {
-    for (Vec2 v : getVisibleTilesNoDarkness(pos, VisionId::NORMAL)) {
-      double dist = (v - pos).lengthD();
-      if (dist <= radius) {
-        lightAmount[v] += min(1.0, 1 - (dist) / radius) * numLight;
-        setNeedsRenderUpdate(v, true);
-      }
-    }
-  }
+  if (radius > 0)
+    lighting->addSource(pos, radius, false, numLight);
 }
 
 void Level::addDarknessSource(Vec2 pos, double radius, int numDarkness) {
-  if (radius > 0) {
-    for (Vec2 v : getVisibleTilesNoDarkness(pos, VisionId::NORMAL)) {
-      double dist = (v - pos).lengthD();
-      if (dist <= radius) {
-        lightCapAmount[v] -= min(1.0, 1 - (dist) / radius) * numDarkness;
-        setNeedsRenderUpdate(v, true);
-      }
-//      updateConnectivity(v);
+  if (radius > 0)
+    lighting->addSource(pos, radius, true, numDarkness);
+}
+
+void Level::updateLighting() const {
+  if (lighting->needsUpdate())
+    lighting->update(getFieldOfView(VisionId::NORMAL), lightAmount, lightCapAmount, [this](Vec2 v) {
+      renderUpdates[v] = true;
+      memoryUpdates[v] = true;
+    });
+}
+
+void Level::initializeLighting() {
+  *lighting = Lighting();
+  lightAmount = Table<double>(getBounds(), 0);
+  lightCapAmount = Table<double>(getBounds(), 1);
+  for (auto pos : getAllPositions())
+    for (auto f : pos.getFurniture()) {
+      addLightSource(pos.getCoord(), f->getBaseLightEmission(), 1);
+      if (f->getFire() && f->getFire()->isBurning())
+        addLightSource(pos.getCoord(), getCreatureLightRadius(), 1);
     }
-  }
+  for (auto c : creatures)
+    updateCreatureLight(c->getPosition().getCoord(), 1);
 }
 
 void Level::updateCreatureLight(Vec2 pos, int diff) {
@@ -168,16 +199,11 @@ void Level::updateCreatureLight(Vec2 pos, int diff) {
 }
 
 void Level::updateVisibility(Vec2 changedSquare) {
-  for (Vec2 pos : getVisibleTilesNoDarkness(changedSquare, VisionId::NORMAL)) {
-    addLightSource(pos, Position(pos, this).getLightEmission(), -1);
-    updateCreatureLight(pos, -1);
-  }
+  BenchmarkTimer timer(BenchmarkSection::LIGHTING);
+  lighting->squareChanged(changedSquare);
+  creatureVisibility->squareChanged(changedSquare);
   for (VisionId vision : ENUM_ALL(VisionId))
     getFieldOfView(vision).squareChanged(changedSquare);
-  for (Vec2 pos : getVisibleTilesNoDarkness(changedSquare, VisionId::NORMAL)) {
-    addLightSource(pos, Position(pos, this).getLightEmission(), 1);
-    updateCreatureLight(pos, 1);
-  }
   for (Vec2 pos : getVisibleTilesNoDarkness(changedSquare, VisionId::NORMAL))
     getModel()->addEvent(EventInfo::VisibilityChanged{Position(pos, this)});
 }
@@ -205,11 +231,13 @@ bool Level::isCovered(Vec2 pos) const {
 }
 
 bool Level::isInSunlight(Vec2 pos) const {
+  updateLighting();
   return !isCovered(pos) && lightCapAmount[pos] >= 1 &&
       getGame()->getSunlightInfo().getState() == SunlightState::DAY;
 }
 
 double Level::getLight(Vec2 pos) const {
+  updateLighting();
   return min(1.0, max(0.0, min(isCovered(pos) ? 1.0 : lightCapAmount[pos], lightAmount[pos] +
       sunlight[pos] * getGame()->getSunlightInfo().getLightAmount())));
 }
@@ -435,6 +463,38 @@ bool Level::canSee(Vec2 from, Vec2 to, const Vision& vision) const {
   return isWithinVision(from, to, vision) && getFieldOfView(vision.getId()).canSee(from, to);
 }
 
+vector<WCreature> Level::getCreaturesInView(Vec2 from, VisionId vision) const {
+  PROFILE;
+  if (auto ret = creatureVisibility->get(from, vision))
+    return *ret;
+  vector<WCreature> ret;
+  auto& fov = getFieldOfView(vision);
+  for (WCreature c : getAllCreatures(Rectangle::centered(from, FieldOfView::sightRange)))
+    if (fov.canSee(from, c->getPosition().getCoord()))
+      ret.push_back(c);
+  return creatureVisibility->add(from, vision, std::move(ret));
+}
+
+vector<WCreature> Level::getVisibleCreatures(Vec2 from, const Vision& vision) const {
+  PROFILE;
+  vector<WCreature> ret;
+  for (WCreature c : getCreaturesInView(from, vision.getId()))
+    if (isWithinVision(from, c->getPosition().getCoord(), vision))
+      ret.push_back(c);
+  return ret;
+}
+
+void Level::markDanger(TribeId tribe, const vector<Vec2>& enemies, LocalTime until) {
+  PROFILE;
+  dangerMap->markEnemies(tribe, getBounds(),
+      [this](Vec2 v) { return Position(v, this).canEnterEmpty({MovementTrait::WALK}); },
+      enemies, model->getLocalTime(), until);
+}
+
+bool Level::isDangerous(TribeId tribe, Vec2 pos) const {
+  return dangerMap->isDangerous(tribe, pos, model->getLocalTime());
+}
+
 void Level::moveCreature(WCreature creature, Vec2 direction) {
   Vec2 position = creature->getPosition().getCoord();
   unplaceCreature(creature, position);
@@ -443,6 +503,7 @@ void Level::moveCreature(WCreature creature, Vec2 direction) {
 
 void Level::unplaceCreature(WCreature creature, Vec2 pos) {
   bucketMap->removeElement(pos, creature);
+  creatureVisibility->creatureLeft(creature);
   updateCreatureLight(pos, -1);
   modSafeSquare(pos)->removeCreature(Position(pos, this));
 }
@@ -451,6 +512,8 @@ void Level::placeCreature(WCreature creature, Vec2 pos) {
   Position position(pos, this);
   creature->setPosition(position);
   bucketMap->addElement(pos, creature);
+  creatureVisibility->creatureEntered(pos, [this, pos](Vec2 from, VisionId vision) {
+      return getFieldOfView(vision).canSee(from, pos); });
   modSafeSquare(pos)->putCreature(creature);
   updateCreatureLight(pos, 1);
   position.onEnter(creature);
@@ -503,6 +566,10 @@ void Level::addTickingFurniture(Vec2 pos) {
 }
 
 void Level::tick() {
+  updateLighting();
+  creatureVisibility->clearUnused();
+  for (VisionId vision : ENUM_ALL(VisionId))
+    getFieldOfView(vision).trimCache();
   for (Vec2 pos : tickingSquares)
     squares->getWritable(pos)->tick(Position(pos, this));
   for (Vec2 pos : tickingFurniture)
@@ -533,16 +600,21 @@ Sectors& Level::getSectorsDontCreate(const MovementType& movement) const {
 }
 
 static Sectors::ExtraConnections getOrCreateExtraConnections(Rectangle bounds,
-    const unordered_map<MovementType, Sectors>& sectors) {
-  if (sectors.empty())
-    return Sectors::ExtraConnections(bounds);
-  else
+    const unordered_map<MovementType, Sectors>& sectors, const Portals& portals) {
+  if (sectors.empty()) {
+    Sectors::ExtraConnections ret(bounds);
+    for (auto& connection : portals.getConnections()) {
+      ret[connection.first] = connection.second;
+      ret[connection.second] = connection.first;
+    }
+    return ret;
+  } else
     return sectors.begin()->second.getExtraConnections();
 }
 
 Sectors& Level::getSectors(const MovementType& movement) const {
   if (!sectors.count(movement)) {
-    sectors.insert(make_pair(movement, Sectors(getBounds(), getOrCreateExtraConnections(getBounds(), sectors))));
+    sectors.insert(make_pair(movement, Sectors(getBounds(), getOrCreateExtraConnections(getBounds(), sectors, *portals))));
     Sectors& newSectors = sectors.at(movement);
     for (Position pos : getAllPositions())
       if (pos.canNavigate(movement))
@@ -551,14 +623,86 @@ Sectors& Level::getSectors(const MovementType& movement) const {
   return sectors.at(movement);
 }
 
+ClusterGraph& Level::getClusterGraph(const MovementType& movement) const {
+  if (!clusterGraphs.count(movement))
+    clusterGraphs.insert(make_pair(movement, ClusterGraph(getBounds())));
+  return clusterGraphs.at(movement);
+}
+
 bool Level::isChokePoint(Vec2 pos, const MovementType& movement) const {
   return getSectors(movement).isChokePoint(pos);
 }
 
+// A field costs about as much as a few searches on a large level, so it's only computed after that many requests.
+const int minFlowFieldRequests = 4;
+const int maxFlowFields = 16;
+
+const FlowField* Level::getFlowField(const vector<Vec2>& targets, const MovementType& movement, Vec2 from) const {
+  PROFILE;
+  ++numFlowFieldRequests;
+  FlowFieldInfo* info = nullptr;
+  for (auto& elem : flowFields)
+    if (elem.targets == targets && elem.movement == movement)
+      info = &elem;
+  if (!info) {
+    if (flowFields.size() >= maxFlowFields) {
+      int oldest = 0;
+      for (int i : All(flowFields))
+        if (flowFields[i].lastRequest < flowFields[oldest].lastRequest)
+          oldest = i;
+      flowFields.removeIndex(oldest);
+    }
+    flowFields.push_back(FlowFieldInfo{targets, movement, 0, 0, none});
+    info = &flowFields.back();
+  }
+  info->lastRequest = numFlowFieldRequests;
+  if (++info->numRequests < minFlowFieldRequests)
+    return nullptr;
+  if (info->field && !info->field->isValid(from))
+    info->field = none;
+  if (!info->field)
+    info->field = LevelShortestPath::makeFlowField(getThis().removeConst(), targets, movement);
+  return &*info->field;
+}
+
+void Level::onMovementChanged(Vec2 pos) {
+  movementChanges[getMovementRegion(pos)] = ++movementCounter;
+  for (auto& elem : flowFields)
+    if (elem.field)
+      elem.field->onChanged(pos);
+}
+
+const int movementRegionSize = 8;
+
+Vec2 Level::getMovementRegion(Vec2 pos) {
+  return pos / movementRegionSize;
+}
+
+int Level::getMovementCounter() const {
+  return movementCounter;
+}
+
+bool Level::movementChangedSince(Vec2 region, int counter) const {
+  return movementChanges[region] > counter;
+}
+
 void Level::updateSunlightMovement() {
-  for (auto movement : getKeys(sectors))
-    if (movement.isSunlightVulnerable())
-      sectors.erase(movement);
+  PROFILE;
+  // Only cells open to the sky depend on the roofs, and the ones that are neither roofed nor navigable stay blocked.
+  for (auto& elem : sectors)
+    if (elem.first.isSunlightVulnerable())
+      for (Vec2 v : getBounds())
+        if (!covered[v] && (elem.second.contains(v) || roofSupport->isRoof(v))) {
+          bool changed = Position(v, this).canNavigate(elem.first) ? elem.second.add(v) : elem.second.remove(v);
+          if (changed) {
+            if (clusterGraphs.count(elem.first))
+              clusterGraphs.at(elem.first).invalidate(v);
+            onMovementChanged(v);
+          }
+        }
+  for (auto& elem : flowFields)
+    if (elem.movement.isSunlightVulnerable())
+      elem.field = none;
 }
 
 int Level::getNumGeneratedSquares() const {
@@ -575,6 +719,7 @@ void Level::setNeedsMemoryUpdate(Vec2 pos, bool s) {
 }
 
 bool Level::needsRenderUpdate(Vec2 pos) const {
+  updateLighting();
   return renderUpdates[pos];
 }
 
@@ -584,6 +729,7 @@ void Level::setNeedsRenderUpdate(Vec2 pos, bool s) {
 }
 
 bool Level::needsMemoryUpdate(Vec2 pos) const {
+  updateLighting();
   return memoryUpdates[pos];
 }
 
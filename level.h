@@ -20,10 +20,13 @@
 #include "unique_entity.h"
 #include "movement_type.h"
 #include "sectors.h"
+#include "cluster_graph.h"
+#include "shortest_path.h"
 #include "stair_key.h"
 #include "entity_set.h"
 #include "vision_id.h"
 #include "furniture_layer.h"
+#include "game_time.h"
 
 class Model;
 class Square;
@@ -33,6 +36,7 @@ class Attack;
 class ProgressMeter;
 class Sectors;
 class Tribe;
+class TribeId;
 class Attack;
 class PlayerMessage;
 class CreatureBucketMap;
@@ -44,6 +48,9 @@ class Vision;
 class FieldOfView;
 class Portals;
 class RoofSupport;
+class Lighting;
+class CreatureVisibility;
+class DangerMap;
 
 /** A class representing a single level of the dungeon or the overworld. All events occuring on the level are performed by this class.*/
 class Level : public OwnedObject<Level> {
@@ -142,6 +149,18 @@ class Level : public OwnedObject<Level> {
   /** Returns if it's possible to see the given square.*/
   bool canSee(Vec2 from, Vec2 to, const Vision&) const;
 
+  /** Returns the creatures in the field of view from the given square, regardless of darkness.*/
+  vector<WCreature> getCreaturesInView(Vec2 from, VisionId) const;
+
+  /** Returns the creatures that can be seen from the given square, not counting their own visibility.*/
+  vector<WCreature> getVisibleCreatures(Vec2 from, const Vision&) const;
+
+  /** Marks the squares close to the given enemies of the tribe as dangerous until the given time.*/
+  void markDanger(TribeId, const vector<Vec2>& enemies, LocalTime until);
+
+  /** Returns if the square was close to an enemy of the tribe recently.*/
+  bool isDangerous(TribeId, Vec2) const;
+
   /** Returns all tiles visible by a creature.*/
   vector<Vec2> getVisibleTiles(Vec2 pos, const Vision&) const;
 
@@ -155,6 +174,10 @@ class Level : public OwnedObject<Level> {
   void addLightSource(Vec2, double radius);
   void removeLightSource(Vec2, double radius);
 
+  /** Registers the light sources of furniture and creatures again. They aren't saved, so this is called after
+      the model has been loaded.*/
+  void initializeLighting();
+
   /** Returns the amount of light in the square, capped within (0, 1).*/
   double getLight(Vec2) const;
 
@@ -166,6 +189,18 @@ class Level : public OwnedObject<Level> {
 
   bool isChokePoint(Vec2, const MovementType&) const;
 
+  /** Returns a flow field towards the targets once enough paths to them were requested for it to pay off,
+   * otherwise returns nullptr. A field is recomputed when the movement on the level has changed in a way that can
+   * affect the distance from the given position.*/
+  const FlowField* getFlowField(const vector<Vec2>& targets, const MovementType&, Vec2 from) const;
+
+  /** Movement changes are tracked in square regions, so that paths can check if they need to be repaired.*/
+  static Vec2 getMovementRegion(Vec2);
+  /** Returns a counter that increases with every movement change on the level.*/
+  int getMovementCounter() const;
+  /** Returns true if the movement changed in the region after the counter had the given value.*/
+  bool movementChangedSince(Vec2 region, int counter) const;
+
   void updateSunlightMovement();
 
   int getNumGeneratedSquares() const;
@@ -188,8 +223,9 @@ class Level : public OwnedObject<Level> {
   WSquare modSafeSquare(Vec2);
   HeapAllocated<SquareArray> SERIAL(squares);
   HeapAllocated<FurnitureArray> SERIAL(furniture);
-  Table<bool> SERIAL(memoryUpdates);
-  Table<bool> renderUpdates = Table<bool>(getMaxBounds(), true);
+  // These are also set when the lighting is brought up to date, which can happen in const methods.
+  mutable Table<bool> SERIAL(memoryUpdates);
+  mutable Table<bool> renderUpdates = Table<bool>(getMaxBounds(), true);
   Table<bool> SERIAL(unavailable);
   unordered_map<StairKey, vector<Position>> SERIAL(landingSquares);
   set<Vec2> SERIAL(tickingSquares);
@@ -206,13 +242,32 @@ class Level : public OwnedObject<Level> {
   Table<bool> SERIAL(covered);
   HeapAllocated<RoofSupport> SERIAL(roofSupport);
   HeapAllocated<CreatureBucketMap> SERIAL(bucketMap);
-  Table<double> SERIAL(lightAmount);
-  Table<double> SERIAL(lightCapAmount);
+  mutable Table<double> SERIAL(lightAmount);
+  mutable Table<double> SERIAL(lightCapAmount);
+  mutable HeapAllocated<Lighting> lighting;
+  mutable HeapAllocated<CreatureVisibility> creatureVisibility;
+  HeapAllocated<DangerMap> dangerMap;
+  void updateLighting() const;
   mutable unordered_map<MovementType, Sectors> sectors;
   Sectors& getSectors(const MovementType&) const;
   Sectors& getSectorsDontCreate(const MovementType&) const;
+  mutable unordered_map<MovementType, ClusterGraph> clusterGraphs;
+  ClusterGraph& getClusterGraph(const MovementType&) const;
+  struct FlowFieldInfo {
+    vector<Vec2> targets;
+    MovementType movement;
+    int numRequests;
+    int lastRequest;
+    optional<FlowField> field;
+  };
+  mutable vector<FlowFieldInfo> flowFields;
+  mutable int numFlowFieldRequests = 0;
+  Table<int> movementChanges;
+  int movementCounter = 0;
+  void onMovementChanged(Vec2);
 
   friend class LevelBuilder;
+  friend class LevelShortestPath;
   struct Private {};
 
   static PLevel create(SquareArray s, FurnitureArray f, WModel m, const string& n, Table<double> sun, LevelId id,
@@ -234,3 +289,4 @@ class Level : public OwnedObject<Level> {
   bool isCovered(Vec2) const;
 };
 
+CEREAL_CLASS_VERSION(Level, 2);
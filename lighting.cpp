@@ -0,0 +1,59 @@
+#include "stdafx.h"
+#include "lighting.h"
+#include "field_of_view.h"
+#include "benchmark.h"
+
+void Lighting::addSource(Vec2 pos, double radius, bool darkness, int count) {
+  changed = true;
+  for (auto& source : sources)
+    if (source.pos == pos && source.radius == radius && source.darkness == darkness) {
+      source.count += count;
+      return;
+    }
+  sources.push_back(Source{pos, radius, darkness, count, 0, {}, false});
+}
+
+void Lighting::squareChanged(Vec2 pos) {
+  // Only the sources that have the square within their radius can see it, so only they need to be recomputed.
+  for (auto& source : sources)
+    if (max(abs(pos.x - source.pos.x), abs(pos.y - source.pos.y)) <= source.radius) {
+      source.visibilityChanged = true;
+      changed = true;
+    }
+}
+
+bool Lighting::needsUpdate() const {
+  return changed;
+}
+
+void Lighting::update(FieldOfView& fov, Table<double>& lightAmount, Table<double>& lightCapAmount,
+    function<void(Vec2)> onChanged) {
+  BenchmarkTimer timer(BenchmarkSection::LIGHTING);
+  auto apply = [&](const Source& source, Vec2 v, int count) {
+    double amount = min(1.0, 1 - (v - source.pos).lengthD() / source.radius);
+    if (source.darkness)
+      lightCapAmount[v] -= amount * count;
+    else
+      lightAmount[v] += amount * count;
+    onChanged(v);
+  };
+  for (int i : AllReverse(sources)) {
+    auto& source = sources[i];
+    if (source.visibilityChanged || source.count != source.appliedCount) {
+      for (Vec2 v : source.cells)
+        apply(source, v, -source.appliedCount);
+      source.cells.clear();
+      if (source.count != 0)
+        for (Vec2 v : fov.getVisibleTiles(source.pos))
+          if ((v - source.pos).lengthD() <= source.radius) {
+            apply(source, v, source.count);
+            source.cells.push_back(v);
+          }
+      source.appliedCount = source.count;
+      source.visibilityChanged = false;
+    }
+    if (source.count == 0)
+      sources.removeIndex(i);
+  }
+  changed = false;
+}
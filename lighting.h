@@ -0,0 +1,33 @@
+#pragma once
+
+#include "util.h"
+
+class FieldOfView;
+
+// The light and darkness that sources add to the cells that they can see. Every source keeps the cells that it has
+// lit, so that its light can be taken back without another field of view query. Changes are collected until
+// update() is called, and a cell that changes its transparency only affects the sources that are close to it.
+class Lighting {
+  public:
+  // A negative count removes sources.
+  void addSource(Vec2, double radius, bool darkness, int count);
+  void squareChanged(Vec2);
+  bool needsUpdate() const;
+  // Brings the light tables up to date and calls onChanged for every cell that was modified.
+  void update(FieldOfView&, Table<double>& lightAmount, Table<double>& lightCapAmount,
+      function<void(Vec2)> onChanged);
+
+  private:
+  struct Source {
+    Vec2 pos;
+    double radius;
+    bool darkness;
+    int count;
+    // The count and the cells that are currently added to the tables.
+    int appliedCount;
+    vector<Vec2> cells;
+    bool visibilityChanged;
+  };
+  vector<Source> sources;
+  bool changed = false;
+};
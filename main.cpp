@@ -197,6 +197,7 @@ static po::parser getCommandLineFlags() {
   flags["data_dir"].type(po::string).description("Directory containing the game data");
   flags["restore_settings"].description("Restore settings to default values.");
   flags["run_tests"].description("Run all unit tests and exit");
+  flags["run_benchmarks"].description("Run all performance tests and exit");
   flags["worldgen_test"].type(po::i32).description("Test how often world generation fails");
   flags["worldgen_maps"].type(po::string).description("List of maps or enemy types in world generation test. Skip to test all.");
   flags["battle_level"].type(po::string).description("Path to battle test level");
@@ -205,6 +206,8 @@ static po::parser getCommandLineFlags() {
   flags["endless_enemy"].type(po::string).description("Endless mode enemy index");
   flags["battle_view"].description("Open game window and display battle");
   flags["battle_rounds"].type(po::i32).description("Number of battle rounds");
+  flags["battle_workers"].type(po::i32).description("Number of worker processes running battle rounds in parallel");
+  flags["battle_output"].type(po::string).description("Write battle test results to a .json or .csv file");
   flags["stderr"].description("Log to stderr");
   flags["nolog"].description("No logging");
   flags["free_mode"].description("Run in free ascii mode");
@@ -212,6 +215,11 @@ static po::parser getCommandLineFlags() {
   flags["quick_game"].description("Skip main menu and load the last save file or start a single map game");
 #endif
   flags["seed"].type(po::i32).description("Use given seed");
+#ifndef EASY_PROFILER
+  flags["profile"].description("Record profiling data and write it to profile.json and profile.txt on exit");
+#endif
+  flags["bench"].type(po::string).description("Load given save file and measure how fast it simulates");
+  flags["turns"].type(po::i32).description("Number of turns to simulate in the benchmark");
   flags["record"].type(po::string).description("Record game to file");
   flags["replay"].type(po::string).description("Replay game from file");
   return flags;
@@ -284,6 +292,16 @@ static int keeperMain(po::parser& commandLineFlags) {
     std::cout << commandLineFlags << endl;
     return 0;
   }
+#ifndef EASY_PROFILER
+  if (commandLineFlags["profile"].was_set())
+    Profiler::setEnabled(true);
+  DestructorFunction dumpProfile([] {
+    if (Profiler::isEnabled()) {
+      Profiler::setEnabled(false);
+      Profiler::dump("profile.json", "profile.txt");
+    }
+  });
+#endif
   bool useSingleThread =
 #ifndef RELEASE
       true;
@@ -301,7 +319,8 @@ static int keeperMain(po::parser& commandLineFlags) {
 #endif
   FatalLog.addOutput(DebugOutput::toString(
       [](const string& s) { ofstream("stacktrace.out") << s << "\n" << std::flush; } ));
-  if (commandLineFlags["stderr"].was_set() || commandLineFlags["run_tests"].was_set())
+  if (commandLineFlags["stderr"].was_set() || commandLineFlags["run_tests"].was_set()
+      || commandLineFlags["run_benchmarks"].was_set())
     InfoLog.addOutput(DebugOutput::toStream(std::cerr));
   Skill::init();
   Spell::init();
@@ -309,6 +328,10 @@ static int keeperMain(po::parser& commandLineFlags) {
     testAll();
     return 0;
   }
+  if (commandLineFlags["run_benchmarks"].was_set()) {
+    benchmarkAll();
+    return 0;
+  }
   DirectoryPath dataPath([&]() -> string {
     if (commandLineFlags["data_dir"].was_set())
       return commandLineFlags["data_dir"].get().string;
@@ -379,7 +402,10 @@ static int keeperMain(po::parser& commandLineFlags) {
   if (commandLineFlags["restore_settings"].was_set())
     remove(settingsPath.getPath());
   Options options(settingsPath);
-  int seed = commandLineFlags["seed"].was_set() ? commandLineFlags["seed"].get().i32 : int(time(0));
+  // Benchmark runs need to be reproducible, so they don't seed from the clock.
+  const int benchmarkSeed = 12345;
+  int seed = commandLineFlags["seed"].was_set() ? commandLineFlags["seed"].get().i32 :
+      commandLineFlags["bench"].was_set() ? benchmarkSeed : int(time(0));
   Random.init(seed);
   auto installId = getInstallId(userPath.file("installId.txt"), Random);
   SoundLibrary* soundLibrary = nullptr;
@@ -405,12 +431,26 @@ static int keeperMain(po::parser& commandLineFlags) {
     loop.modelGenTest(commandLineFlags["worldgen_test"].get().i32, types, Random, &options);
     return 0;
   }
+  if (commandLineFlags["bench"].was_set()) {
+    DummyView view(&clock);
+    MainLoop loop(&view, &highscores, &fileSharing, freeDataPath, userPath, &options, &jukebox, &sokobanInput,
+        &gameConfig, true, 0);
+    int numTurns = commandLineFlags["turns"].was_set() ? commandLineFlags["turns"].get().i32 : 1000;
+    // The setup above may have drawn random numbers, for example to generate the install id.
+    Random.init(seed);
+    loop.benchmark(FilePath::fromFullPath(commandLineFlags["bench"].get().string), numTurns);
+    return 0;
+  }
   auto battleTest = [&] (View* view) {
     MainLoop loop(view, &highscores, &fileSharing, freeDataPath, userPath, &options, &jukebox, &sokobanInput,
         &gameConfig, useSingleThread, 0);
     auto level = commandLineFlags["battle_level"].get().string;
     auto info = commandLineFlags["battle_info"].get().string;
     auto numRounds = commandLineFlags["battle_rounds"].get().i32;
+    if (commandLineFlags["battle_workers"].was_set())
+      loop.setBattleTestWorkers(commandLineFlags["battle_workers"].get().i32);
+    if (commandLineFlags["battle_output"].was_set())
+      loop.setBattleTestResultsPath(FilePath::fromFullPath(commandLineFlags["battle_output"].get().string));
     try {
       if (commandLineFlags["endless_enemy"].was_set()) {
         auto enemy = commandLineFlags["endless_enemy"].get().string;
@@ -36,6 +36,12 @@
 #include "game_config.h"
 #include "avatar_menu_option.h"
 #include "creature_name.h"
+#include "benchmark.h"
+
+#ifndef WINDOWS
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 MainLoop::MainLoop(View* v, Highscores* h, FileSharing* fSharing, const DirectoryPath& freePath,
     const DirectoryPath& uPath, Options* o, Jukebox* j, SokobanInput* soko, GameConfig* gameConfig, bool singleThread,
@@ -582,8 +588,10 @@ void MainLoop::battleTest(int numTries, const FilePath& levelPath, const FilePat
   for (int i : Range(cnt)) {
     auto creatureList = readAlly(input);
     std::cout << creatureList.getSummary() << ": ";
-    battleTest(numTries, levelPath, creatureList, CreatureList(maxEnemies, enemyId), random);
+    auto result = battleTest(numTries, levelPath, creatureList, CreatureList(maxEnemies, enemyId), random);
+    battleTestResults.push_back({creatureList.getSummary() + " vs " + enemy, result});
   }
+  writeBattleTestResults();
 }
 
 void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath,
@@ -602,69 +610,219 @@ void MainLoop::endlessTest(int numTries, const FilePath& levelPath, const FilePa
       int totalWins = 0;
       for (auto& allyInfo : allies) {
         std::cerr << allyInfo.getSummary() << ": ";
-        int numWins = battleTest(numTries, levelPath, allyInfo, wave->enemy.creatures, random);
-        totalWins += numWins;
+        auto result = battleTest(numTries, levelPath, allyInfo, wave->enemy.creatures, random);
+        battleTestResults.push_back({"Turn " + toString(turn) + ": " + wave->enemy.name + ": " +
+            allyInfo.getSummary(), result});
+        totalWins += result.alliesWon;
       }
       std::cerr << totalWins << " wins\n";
       std::cout << "Turn " << turn << ": " << wave->enemy.name << ": " << totalWins << "\n";
     }
+  writeBattleTestResults();
 }
 
-int MainLoop::battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemies,
-    RandomGen& random) {
+void MainLoop::setBattleTestWorkers(int num) {
+  CHECK(num >= 1);
+  battleTestWorkers = num;
+}
+
+void MainLoop::setBattleTestResultsPath(const FilePath& path) {
+  battleTestResultsPath = path;
+}
+
+MainLoop::ExitCondition MainLoop::runBattle(const FilePath& levelPath, CreatureList ally, CreatureList enemies,
+    RandomGen& random, int seed, int& turns) {
+  random.init(seed);
   ProgressMeter meter(1);
-  int numAllies = 0;
-  int numEnemies = 0;
-  int numUnknown = 0;
   auto allyTribe = TribeId::getDarkKeeper();
-  std::cout.flush();
-  for (int i : Range(numTries)) {
-    auto game = Game::splashScreen(ModelBuilder(&meter, Random, options, sokobanInput, gameConfig)
-        .battleModel(levelPath, ally, enemies), CampaignBuilder::getEmptyCampaign());
-    auto exitCondition = [&](WGame game) -> optional<ExitCondition> {
-      unordered_set<TribeId, CustomHash<TribeId>> tribes;
-      for (auto& m : game->getAllModels())
-        for (auto c : m->getAllCreatures())
-          tribes.insert(c->getTribeId());
-      if (tribes.size() == 1) {
-        if (*tribes.begin() == allyTribe)
-          return ExitCondition::ALLIES_WON;
-        else
-          return ExitCondition::ENEMIES_WON;
-      }
-      if (game->getGlobalTime().getVisibleInt() > 200)
-        return ExitCondition::TIMEOUT;
-      if (tribes.empty())
-        return ExitCondition::UNKNOWN;
+  auto game = Game::splashScreen(ModelBuilder(&meter, random, options, sokobanInput, gameConfig)
+      .battleModel(levelPath, ally, enemies), CampaignBuilder::getEmptyCampaign());
+  auto exitCondition = [&](WGame game) -> optional<ExitCondition> {
+    turns = game->getGlobalTime().getVisibleInt();
+    // The models keep track of their tribe populations, so this doesn't need to look at every creature.
+    vector<TribeId> tribes;
+    for (auto& m : game->getAllModels())
+      for (auto tribe : m->getTribesPresent())
+        if (!tribes.contains(tribe))
+          tribes.push_back(tribe);
+    if (tribes.size() == 1) {
+      if (tribes[0] == allyTribe)
+        return ExitCondition::ALLIES_WON;
       else
-        return none;
-    };
-    auto result = playGame(std::move(game), false, true, exitCondition);
-    switch (result) {
+        return ExitCondition::ENEMIES_WON;
+    }
+    if (turns > 200)
+      return ExitCondition::TIMEOUT;
+    if (tribes.empty())
+      return ExitCondition::UNKNOWN;
+    else
+      return none;
+  };
+  return playGame(std::move(game), false, true, exitCondition);
+}
+
+MainLoop::BattleTestResult MainLoop::battleTest(int numTries, const FilePath& levelPath, CreatureList ally,
+    CreatureList enemies, RandomGen& random) {
+  BattleTestResult result;
+  // Seeds are drawn up front so that the outcome doesn't depend on the number of workers.
+  vector<int> seeds;
+  for (int i : Range(numTries))
+    seeds.push_back(random.get(1000000000));
+  int nextSeed = random.get(1000000000);
+  // Only the battles that reported a result are counted, so that a crashed worker doesn't skew the averages.
+  auto addResult = [&] (ExitCondition condition, int turns) {
+    ++result.numTries;
+    result.totalTurns += turns;
+    switch (condition) {
       case ExitCondition::ALLIES_WON:
-        ++numAllies;
+        ++result.alliesWon;
         std::cerr << "a";
         break;
       case ExitCondition::ENEMIES_WON:
-        ++numEnemies;
+        ++result.enemiesWon;
         std::cerr << "e";
         break;
       case ExitCondition::TIMEOUT:
-        ++numUnknown;
+        ++result.timeouts;
         std::cerr << "t";
         break;
       case ExitCondition::UNKNOWN:
-        ++numUnknown;
+        ++result.unknown;
         std::cerr << "u";
         break;
     }
     std::cerr.flush();
+  };
+  std::cout.flush();
+  auto startTime = Clock::getRealMillis();
+#ifndef WINDOWS
+  if (battleTestWorkers > 1 && numTries > 1) {
+    // Every battle builds its own Game and reseeds the global generator, so the workers are separate
+    // processes rather than threads. Each one reports "<exit condition> <turns>" lines through a pipe.
+    vector<pair<pid_t, int>> workers;
+    for (int worker : Range(min(battleTestWorkers, numTries))) {
+      int fd[2];
+      CHECK(pipe(fd) == 0);
+      pid_t pid = fork();
+      CHECK(pid >= 0);
+      if (pid == 0) {
+        close(fd[0]);
+        for (int i = worker; i < numTries; i += battleTestWorkers) {
+          int turns = 0;
+          auto condition = runBattle(levelPath, ally, enemies, random, seeds[i], turns);
+          string line = toString(int(condition)) + " " + toString(turns) + "\n";
+          CHECK(write(fd[1], line.data(), line.size()) == line.size());
+        }
+        close(fd[1]);
+        _exit(0);
+      }
+      close(fd[1]);
+      workers.push_back({pid, fd[0]});
+    }
+    for (auto& worker : workers) {
+      FILE* file = fdopen(worker.second, "r");
+      int condition, turns;
+      while (fscanf(file, "%d %d", &condition, &turns) == 2)
+        addResult(ExitCondition(condition), turns);
+      fclose(file);
+      int status = 0;
+      CHECK(waitpid(worker.first, &status, 0) == worker.first);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        std::cerr << "\nBattle test worker " << worker.first << " crashed\n";
+    }
+  } else
+#endif
+  for (int i : Range(numTries)) {
+    int turns = 0;
+    auto condition = runBattle(levelPath, ally, enemies, random, seeds[i], turns);
+    addResult(condition, turns);
   }
-  std::cerr << " " << numAllies << ":" << numEnemies;
+  result.wallTime = Clock::getRealMillis() - startTime;
+  random.init(nextSeed);
+  if (result.numTries < numTries)
+    std::cerr << "\nOnly " << result.numTries << " out of " << numTries << " battles finished";
+  std::cerr << " " << result.alliesWon << ":" << result.enemiesWon;
+  int numUnknown = result.timeouts + result.unknown;
   if (numUnknown > 0)
     std::cerr << " (" << numUnknown << ") unknown";
   std::cerr << "\n";
-  return numAllies;
+  return result;
+}
+
+void MainLoop::writeBattleTestResults() {
+  if (!battleTestResultsPath)
+    return;
+  ofstream output(battleTestResultsPath->getPath());
+  auto averageTurns = [](const BattleTestResult& result) {
+    return result.numTries > 0 ? double(result.totalTurns) / result.numTries : 0.0;
+  };
+  if (battleTestResultsPath->hasSuffix(".json")) {
+    auto quote = [](const string& s) {
+      string ret = "\"";
+      for (char c : s) {
+        if (c == '"' || c == '\\')
+          ret += '\\';
+        ret += c;
+      }
+      return ret + "\"";
+    };
+    output << "[\n";
+    for (int i : All(battleTestResults)) {
+      auto& result = battleTestResults[i].second;
+      output << "  {\"scenario\": " << quote(battleTestResults[i].first)
+          << ", \"tries\": " << result.numTries
+          << ", \"alliesWon\": " << result.alliesWon
+          << ", \"enemiesWon\": " << result.enemiesWon
+          << ", \"timeouts\": " << result.timeouts
+          << ", \"unknown\": " << result.unknown
+          << ", \"averageTurns\": " << averageTurns(result)
+          << ", \"wallTimeMs\": " << result.wallTime.count() << "}"
+          << (i + 1 < battleTestResults.size() ? ",\n" : "\n");
+    }
+    output << "]\n";
+  } else {
+    output << "scenario,tries,allies_won,enemies_won,timeouts,unknown,average_turns,wall_time_ms\n";
+    for (auto& elem : battleTestResults) {
+      auto& result = elem.second;
+      output << "\"" << elem.first << "\"," << result.numTries << "," << result.alliesWon << ","
+          << result.enemiesWon << "," << result.timeouts << "," << result.unknown << ","
+          << averageTurns(result) << "," << result.wallTime.count() << "\n";
+    }
+  }
+}
+
+void MainLoop::benchmark(const FilePath& savePath, int numTurns) {
+  PGame game = loadGame(savePath);
+  if (!game) {
+    std::cerr << "Failed to load " << savePath << "\n";
+    return;
+  }
+  if (!game->getPlayerCreatures().empty()) {
+    // Directly controlled creatures would wait for input forever.
+    std::cerr << "Can't benchmark a game with directly controlled creatures\n";
+    return;
+  }
+  game->initialize(options, highscores, view, fileSharing, gameConfig);
+  auto endTime = game->getGlobalTime() + TimeInterval(numTurns);
+  BenchmarkTimer::reset();
+  BenchmarkTimer::setEnabled(true);
+  auto startTime = steady_clock::now();
+  while (game->getGlobalTime() < endTime)
+    if (game->update(1))
+      break;
+  auto totalTime = duration_cast<microseconds>(steady_clock::now() - startTime);
+  BenchmarkTimer::setEnabled(false);
+  auto toMillis = [](microseconds t) { return double(t.count()) / 1000; };
+  std::cout << "Simulated " << numTurns << " turns in " << toMillis(totalTime) << " ms, "
+      << double(numTurns) * 1000000 / max<long long>(1, totalTime.count()) << " turns/s\n";
+  for (auto section : ENUM_ALL(BenchmarkSection)) {
+    auto time = BenchmarkTimer::getTotalTime(section);
+    std::cout << EnumInfo<BenchmarkSection>::getString(section) << ": " << toMillis(time) << " ms ("
+        << 100 * double(time.count()) / max<long long>(1, totalTime.count()) << "%), "
+        << BenchmarkTimer::getCount(section) << " calls\n";
+  }
+  for (auto counter : ENUM_ALL(BenchmarkCounter))
+    std::cout << EnumInfo<BenchmarkCounter>::getString(counter) << ": " << BenchmarkTimer::getCount(counter) << "\n";
 }
 
 PModel MainLoop::getBaseModel(ModelBuilder& modelBuilder, CampaignSetup& setup, const AvatarInfo& avatarInfo) {
@@ -33,8 +33,10 @@ class MainLoop {
   void start(bool tilesPresent, bool quickGame);
   void modelGenTest(int numTries, const vector<std::string>& types, RandomGen&, Options*);
   void battleTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, string enemyId, RandomGen&);
-  int battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemyId, RandomGen&);
   void endlessTest(int numTries, const FilePath& levelPath, const FilePath& battleInfoPath, RandomGen&, optional<int> numEnemy);
+  void setBattleTestWorkers(int);
+  void setBattleTestResultsPath(const FilePath&);
+  void benchmark(const FilePath& savePath, int numTurns);
 
   static TimeInterval getAutosaveFreq();
   static void reloadModel(const FilePath& path);
@@ -59,6 +61,24 @@ class MainLoop {
   PGame prepareCampaign(RandomGen&);
   enum class ExitCondition;
   ExitCondition playGame(PGame, bool withMusic, bool noAutoSave, function<optional<ExitCondition> (WGame)> = nullptr);
+  struct BattleTestResult {
+    // The number of battles that reported a result.
+    int numTries = 0;
+    int alliesWon = 0;
+    int enemiesWon = 0;
+    int timeouts = 0;
+    int unknown = 0;
+    int totalTurns = 0;
+    milliseconds wallTime {0};
+  };
+  BattleTestResult battleTest(int numTries, const FilePath& levelPath, CreatureList ally, CreatureList enemies,
+      RandomGen&);
+  ExitCondition runBattle(const FilePath& levelPath, CreatureList ally, CreatureList enemies, RandomGen&, int seed,
+      int& turns);
+  void writeBattleTestResults();
+  int battleTestWorkers = 1;
+  optional<FilePath> battleTestResultsPath;
+  vector<pair<string, BattleTestResult>> battleTestResults;
   void splashScreen();
   void showCredits(const FilePath& path, View*);
 
@@ -1096,7 +1096,7 @@ void MapGui::considerRedrawingSquareHighlight(Renderer& renderer, milliseconds c
   if (!lastHighlighted.creaturePos) {
     Rectangle allTiles = layout->getAllTiles(getBounds(), levelBounds, getScreenPos());
     Vec2 topLeftCorner = projectOnScreen(allTiles.topLeft());
-    for (Vec2 v : concat({pos}, pos.neighbors8()))
+    for (Vec2 v : concat<Vec2>({pos}, pos.neighbors8()))
       if (v.inRectangle(objects.getBounds()) && (!objects[v] || objects[v]->noObjects())) {
         drawSquareHighlight(renderer, topLeftCorner + (pos - allTiles.topLeft()).mult(size), size);
         break;
@@ -64,7 +64,7 @@ const MapMemory& MapMemory::empty() {
   return mem;
 } 
 
-const unordered_set<Position, CustomHash<Position>>& MapMemory::getUpdated(WConstLevel level) const {
+const PositionSet& MapMemory::getUpdated(WConstLevel level) const {
   return updated[level->getUniqueId()];
 }
 
@@ -28,7 +28,7 @@ class MapMemory {
   MapMemory();
   void addObject(Position, const ViewObject&);
   void update(Position, const ViewIndex&);
-  const unordered_set<Position, CustomHash<Position>>& getUpdated(WConstLevel) const;
+  const PositionSet& getUpdated(WConstLevel) const;
   void clearUpdated(WConstLevel) const;
   void clearSquare(Position pos);
   static const MapMemory& empty();
@@ -40,6 +40,6 @@ class MapMemory {
   private:
   void updateUpdated(Position);
   optional<ViewIndex&> getViewIndex(Position);
-  HeapAllocated<PositionMap<ViewIndex>> SERIAL(table);
+  HeapAllocated<PositionMap<ViewIndex, PositionMapType::SPARSE>> SERIAL(table);
   mutable map<int, PositionSet> updated;
 };
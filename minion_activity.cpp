@@ -35,7 +35,7 @@ static optional<Position> getRandomCloseTile(Position from, const vector<Positio
 
 static optional<Position> getTileToExplore(WConstCollective collective, WConstCreature c, MinionActivity task) {
   PROFILE;
-  vector<Position> border = Random.permutation(collective->getKnownTiles().getBorderTiles());
+  vector<Position> border = Random.permutation(asVector<Position>(collective->getKnownTiles().getBorderTiles()));
   switch (task) {
     case MinionActivity::EXPLORE_CAVES:
       if (auto pos = getRandomCloseTile(c->getPosition(), border,
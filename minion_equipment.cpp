@@ -26,6 +26,7 @@
 #include "item_class.h"
 #include "corpse_info.h"
 #include "weapon_info.h"
+#include "entity_set.h"
 
 static bool isCombatConsumable(Effect type) {
   return type.visit(
@@ -141,15 +142,10 @@ bool MinionEquipment::isOwner(WConstItem it, WConstCreature c) const {
 const static vector<WItem> emptyItems;
 
 void MinionEquipment::updateOwners(const vector<WCreature>& creatures) {
-  auto oldItemMap = myItems;
-  myItems.clear();
-  owners.clear();
-  for (auto c : creatures)
-    for (auto item : oldItemMap.getOrElse(c, emptyItems))
-      if (item) {
-        owners.set(item, c->getUniqueId());
-        myItems.getOrInit(c).push_back(item);
-      }
+  EntitySet<Creature> current(creatures);
+  for (auto id : myItems.getKeys())
+    if (!current.contains(id))
+      removeOwner(id);
   for (auto c : creatures)
     for (auto item : getItemsOwnedBy(c))
       if (!needsItem(c, item))
@@ -157,14 +153,44 @@ void MinionEquipment::updateOwners(const vector<WCreature>& creatures) {
 }
 
 void MinionEquipment::updateItems(const vector<WItem>& items) {
-  auto oldOwners = owners;
-  myItems.clear();
-  owners.clear();
-  for (auto it : items)
-    if (auto owner = oldOwners.getMaybe(it)) {
-      myItems.getOrInit(*owner).push_back(it);
-      owners.set(it->getUniqueId(), *owner);
-    }
+  EntitySet<Item> current(items);
+  for (auto id : owners.getKeys())
+    if (!current.contains(id))
+      discard(id);
+  // Destroyed items leave empty pointers behind, and their ids were discarded above.
+  for (auto id : myItems.getKeys()) {
+    auto& ownedItems = myItems.getOrFail(id);
+    for (int i : AllReverse(ownedItems))
+      if (!ownedItems[i])
+        ownedItems.removeIndexPreserveOrder(i);
+    if (ownedItems.empty())
+      myItems.erase(id);
+  }
+}
+
+void MinionEquipment::removeOwner(WConstCreature c) {
+  removeOwner(c->getUniqueId());
+}
+
+void MinionEquipment::removeOwner(UniqueEntity<Creature>::Id id) {
+  if (!myItems.hasKey(id))
+    return;
+  bool destroyedItems = false;
+  for (auto& item : myItems.getOrFail(id))
+    if (item) {
+      locked.erase(make_pair(id, item->getUniqueId()));
+      owners.erase(item->getUniqueId());
+    } else
+      destroyedItems = true;
+  if (destroyedItems) {
+    vector<UniqueEntity<Item>::Id> toErase;
+    for (auto& elem : owners)
+      if (elem.second == id)
+        toErase.push_back(elem.first);
+    for (auto itemId : toErase)
+      owners.erase(itemId);
+  }
+  myItems.erase(id);
 }
 
 vector<WItem> MinionEquipment::getItemsOwnedBy(WConstCreature c, ItemPredicate predicate) const {
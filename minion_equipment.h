@@ -32,6 +32,8 @@ class MinionEquipment {
   bool tryToOwn(WConstCreature, WItem);
   void discard(WConstItem);
   void discard(UniqueEntity<Item>::Id);
+  void removeOwner(WConstCreature);
+  // Drops the owners that aren't on the list, and the items that they don't need any more.
   void updateOwners(const vector<WCreature>&);
   vector<WItem> getItemsOwnedBy(WConstCreature, ItemPredicate = nullptr) const;
 
@@ -42,6 +44,7 @@ class MinionEquipment {
   bool isLocked(WConstCreature, UniqueEntity<Item>::Id) const;
   void sortByEquipmentValue(WConstCreature, vector<WItem>& items) const;
   void autoAssign(WConstCreature, vector<WItem> possibleItems);
+  // Drops the ownership of items that aren't on the list, including the ones that were destroyed.
   void updateItems(const vector<WItem>& items);
 
   private:
@@ -51,6 +54,7 @@ class MinionEquipment {
   optional<int> getEquipmentLimit(EquipmentType type) const;
   WItem getWorstItem(WConstCreature, vector<WItem>) const;
   int getItemValue(WConstCreature, WConstItem) const;
+  void removeOwner(UniqueEntity<Creature>::Id);
 
   EntityMap<Item, UniqueEntity<Creature>::Id> SERIAL(owners);
   EntityMap<Creature, vector<WItem>> SERIAL(myItems);
@@ -55,6 +55,7 @@
 #include "unknown_locations.h"
 #include "avatar_info.h"
 #include "collective_config.h"
+#include "benchmark.h"
 
 template <class Archive> 
 void Model::serialize(Archive& ar, const unsigned int version) {
@@ -62,6 +63,11 @@ void Model::serialize(Archive& ar, const unsigned int version) {
   ar & SUBCLASS(OwnedObject<Model>);
   ar(levels, collectives, timeQueue, deadCreatures, currentTime, woodCount, game, lastTick);
   ar(stairNavigation, cemetery, topLevel, eventGenerator, externalEnemies);
+  if (Archive::is_loading::value) {
+    initializeTribePopulation();
+    for (auto& level : levels)
+      level->initializeLighting();
+  }
 }
 
 SERIALIZATION_CONSTRUCTOR_IMPL(Model)
@@ -138,6 +144,7 @@ bool Model::update(double totalTime) {
 }
 
 void Model::tick(LocalTime time) { PROFILE
+  BenchmarkTimer timer(BenchmarkSection::MODEL_TICK);
   for (WCreature c : timeQueue->getAllCreatures()) {
     c->tick();
   }
@@ -156,9 +163,39 @@ void Model::addCreature(PCreature c) {
 void Model::addCreature(PCreature c, TimeInterval delay) {
   if (auto game = getGame())
     c->setGlobalTime(getGame()->getGlobalTime());
+  updateTribePopulation(c->getTribeId(), 1);
   timeQueue->addCreature(std::move(c), getLocalTime() + delay);
 }
 
+void Model::updateTribePopulation(TribeId tribe, int diff) {
+  int& cnt = tribePopulation[tribe];
+  cnt += diff;
+  CHECK(cnt >= 0);
+  if (cnt == 0)
+    tribePopulation.erase(tribe);
+}
+
+void Model::initializeTribePopulation() {
+  tribePopulation.clear();
+  for (WCreature c : timeQueue->getAllCreatures())
+    updateTribePopulation(c->getTribeId(), 1);
+}
+
+int Model::getPopulation(TribeId tribe) const {
+  return getValueMaybe(tribePopulation, tribe).value_or(0);
+}
+
+vector<TribeId> Model::getTribesPresent() const {
+  return getKeys(tribePopulation);
+}
+
+void Model::onCreatureTribeChanged(WConstCreature c, TribeId previous, TribeId current) {
+  if (previous != current && timeQueue->contains(c)) {
+    updateTribePopulation(previous, -1);
+    updateTribePopulation(current, 1);
+  }
+}
+
 WLevel Model::buildLevel(LevelBuilder&& b, PLevelMaker maker) {
   LevelBuilder builder(std::move(b));
   levels.push_back(builder.build(this, maker.get(), Random.getLL()));
@@ -273,11 +310,13 @@ WLevel Model::getTopLevel() const {
 }
 
 void Model::killCreature(WCreature c) {
+  updateTribePopulation(c->getTribeId(), -1);
   deadCreatures.push_back(timeQueue->removeCreature(c));
   cemetery->landCreature(cemetery->getAllPositions(), c);
 }
 
 PCreature Model::extractCreature(WCreature c) {
+  updateTribePopulation(c->getTribeId(), -1);
   PCreature ret = timeQueue->removeCreature(c);
   c->getLevel()->removeCreature(c);
   return ret;
@@ -325,5 +364,6 @@ void Model::clearExternalEnemies() {
 }
 
 void Model::addEvent(const GameEvent& e) {
+  BenchmarkTimer timer(BenchmarkSection::EVENTS);
   eventGenerator->addEvent(e);
 }
@@ -73,6 +73,9 @@ class Model : public OwnedObject<Model> {
   void tick(LocalTime);
   vector<WCollective> getCollectives() const;
   vector<WCreature> getAllCreatures() const;
+  int getPopulation(TribeId) const;
+  vector<TribeId> getTribesPresent() const;
+  void onCreatureTribeChanged(WConstCreature, TribeId previous, TribeId current);
   vector<WLevel> getLevels() const;
   void addCollective(PCollective);
 
@@ -131,5 +134,8 @@ class Model : public OwnedObject<Model> {
   void checkCreatureConsistency();
   HeapAllocated<optional<ExternalEnemies>> SERIAL(externalEnemies);
   int moveCounter = 0;
+  void updateTribePopulation(TribeId, int diff);
+  void initializeTribePopulation();
+  unordered_map<TribeId, int, CustomHash<TribeId>> tribePopulation;
 };
 
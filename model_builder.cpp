@@ -456,7 +456,7 @@ PModel ModelBuilder::tryModel(int width, const string& levelName, vector<EnemyIn
   optional<CreatureFactory> wildlife;
   if (hasWildlife)
     wildlife = CreatureFactory::forrest(TribeId::getWildlife());
-  WLevel top =  model->buildTopLevel(
+  model->buildTopLevel(
       LevelBuilder(meter, random, width, width, levelName, false),
       LevelMaker::topLevel(random, wildlife, topLevelSettlements, width,
         keeperTribe, biomeId));
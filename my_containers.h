@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <set>
+#include <array>
 #include <type_traits>
 #include "extern/optional.h"
 #include "debug.h"
@@ -31,6 +32,9 @@ class vector {
   vector(const std::vector<T>& v) : impl(v) {}
   vector(std::vector<T>&& v) noexcept : impl(std::move(v)) {}
 
+  template <size_t N>
+  vector(const std::array<T, N>& a) : impl(a.begin(), a.end()) {}
+
   vector(int size, const T& elem) : impl(size, elem) {}
   vector(int size) : impl(size) {}
 
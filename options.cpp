@@ -36,6 +36,7 @@ const EnumMap<OptionId, Options::Value> defaults {
   {OptionId::AUTOSAVE, 1},
   {OptionId::WASD_SCROLLING, 0},
   {OptionId::FAST_IMMIGRATION, 0},
+  {OptionId::SIMULATE_INACTIVE_SITES, 0},
   {OptionId::STARTING_RESOURCE, 0},
   {OptionId::START_WITH_NIGHT, 0},
   {OptionId::PLAYER_NAME, string("")},
@@ -66,6 +67,7 @@ const map<OptionId, string> names {
   {OptionId::AUTOSAVE, "Autosave"},
   {OptionId::WASD_SCROLLING, "WASD scrolling"},
   {OptionId::FAST_IMMIGRATION, "Fast immigration"},
+  {OptionId::SIMULATE_INACTIVE_SITES, "Simulate inactive sites"},
   {OptionId::STARTING_RESOURCE, "Resource bonus"},
   {OptionId::START_WITH_NIGHT, "Start with night"},
   {OptionId::PLAYER_NAME, "First name"},
@@ -93,7 +95,9 @@ const map<OptionId, string> hints {
     "The save file will be used to recover in case of a crash."},
   {OptionId::WASD_SCROLLING, "Scroll the map using W-A-S-D keys. In this mode building shortcuts are accessed "
     "using alt + letter."},
-  {OptionId::GENERATE_MANA, "Your minions will generate mana while working in the library."}
+  {OptionId::GENERATE_MANA, "Your minions will generate mana while working in the library."},
+  {OptionId::SIMULATE_INACTIVE_SITES, "Keep time running on the other sites of the world map, not only on the one "
+      "you are currently on. May slow down the game."}
 };
 
 const map<OptionSet, vector<OptionId>> optionSets {
@@ -114,6 +118,7 @@ const map<OptionSet, vector<OptionId>> optionSets {
       OptionId::GAME_EVENTS,
       OptionId::AUTOSAVE,
       OptionId::WASD_SCROLLING,
+      OptionId::SIMULATE_INACTIVE_SITES,
 #ifndef RELEASE
       OptionId::KEEP_SAVEFILES,
       OptionId::SHOW_MAP,
@@ -229,6 +234,7 @@ string Options::getValueString(OptionId id) {
     case OptionId::KEEP_SAVEFILES:
     case OptionId::SHOW_MAP:
     case OptionId::FAST_IMMIGRATION:
+    case OptionId::SIMULATE_INACTIVE_SITES:
     case OptionId::STARTING_RESOURCE:
     case OptionId::ONLINE:
     case OptionId::GAME_EVENTS:
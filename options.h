@@ -36,6 +36,7 @@ RICH_ENUM(OptionId,
   DISABLE_CURSOR,
 
   FAST_IMMIGRATION,
+  SIMULATE_INACTIVE_SITES,
 
   PLAYER_NAME,
   KEEPER_SEED,
@@ -0,0 +1,56 @@
+#include "stdafx.h"
+#include "owner_pointer.h"
+
+// Slot 0 is never allocated and always has generation 0, which is what the null WeakPointer refers to.
+static std::atomic<uint32_t> firstPage[1 << 16];
+
+std::atomic<uint32_t>* OwnedObjectSlots::pages[numPages] = { firstPage };
+
+namespace {
+struct FreeSlots {
+  std::mutex mutex;
+  vector<uint32_t> indexes;
+  uint64_t nextIndex = 1;
+};
+
+// Never destroyed, because owned objects in static storage may release their slots after it would be.
+FreeSlots& getFreeSlots() {
+  static FreeSlots* ret = new FreeSlots();
+  return *ret;
+}
+}
+
+uint32_t OwnedObjectSlots::allocate(uint32_t& generation) {
+  static_assert(sizeof(firstPage) / sizeof(firstPage[0]) == pageMask + 1, "");
+  auto& freeSlots = getFreeSlots();
+  uint32_t index;
+  {
+    std::lock_guard<std::mutex> lock(freeSlots.mutex);
+    if (!freeSlots.indexes.empty())
+      index = freeSlots.indexes.back(), freeSlots.indexes.pop_back();
+    else {
+      CHECK(freeSlots.nextIndex <= std::numeric_limits<uint32_t>::max()) << "Out of owned object slots";
+      index = (uint32_t) freeSlots.nextIndex++;
+      auto& page = pages[index >> pageBits];
+      if (!page)
+        page = new std::atomic<uint32_t>[pageMask + 1]();
+    }
+  }
+  auto& slot = pages[index >> pageBits][index & pageMask];
+  generation = slot.load(std::memory_order_relaxed);
+  if (generation == 0) {
+    generation = 1;
+    slot.store(generation, std::memory_order_relaxed);
+  }
+  return index;
+}
+
+void OwnedObjectSlots::release(uint32_t index) {
+  auto& slot = pages[index >> pageBits][index & pageMask];
+  // Generation 0 is reserved for slot 0, so skip it when wrapping around.
+  uint32_t generation = slot.load(std::memory_order_relaxed) + 1;
+  slot.store(generation == 0 ? 1 : generation, std::memory_order_relaxed);
+  auto& freeSlots = getFreeSlots();
+  std::lock_guard<std::mutex> lock(freeSlots.mutex);
+  freeSlots.indexes.push_back(index);
+}
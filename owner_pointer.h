@@ -66,7 +66,20 @@ class OwnerPointer {
     return weak_ptr<T>(elem);
   }*/
 
-  SERIALIZE_ALL(elem)
+  template <class Archive>
+  void save(Archive& ar1, const unsigned int) const {
+    ar1(elem);
+  }
+
+  template <class Archive>
+  void load(Archive& ar1, const unsigned int) {
+    shared_ptr<T> loaded;
+    ar1(loaded);
+    if (loaded)
+      *this = OwnerPointer<T>(std::move(loaded));
+    else
+      clear();
+  }
 
   private:
   template <typename>
@@ -79,69 +92,119 @@ class OwnerPointer {
   shared_ptr<T> SERIAL(elem);
 };
 
+// Every OwnedObject takes a slot in this table when it is constructed and bumps the slot's generation when it is
+// destroyed. A WeakPointer remembers the slot and generation of its target, so checking whether the target is
+// still alive is a single load and compare, rather than locking a weak_ptr on every access.
+class OwnedObjectSlots {
+  public:
+  static uint32_t allocate(uint32_t& generation);
+  static void release(uint32_t index);
+
+  static bool isAlive(uint32_t index, uint32_t generation) {
+    return pages[index >> pageBits][index & pageMask].load(std::memory_order_relaxed) == generation;
+  }
+
+  private:
+  static constexpr int pageBits = 16;
+  static constexpr uint32_t pageMask = (1u << pageBits) - 1;
+  static constexpr int numPages = 1 << (32 - pageBits);
+  static std::atomic<uint32_t>* pages[numPages];
+};
+
+// Common base of all OwnedObjects, so that WeakPointer can find the slot of any derived type.
+class OwnedObjectBase {
+  public:
+  OwnedObjectBase() : slotIndex(OwnedObjectSlots::allocate(slotGeneration)) {}
+  // A copy is a different object, so it gets its own slot and isn't owned until wrapped in an OwnerPointer.
+  OwnedObjectBase(const OwnedObjectBase&) : OwnedObjectBase() {}
+  OwnedObjectBase& operator = (const OwnedObjectBase&) { return *this; }
+  // The slot is normally released by the owner before destruction starts, see OwnerPointer(shared_ptr<T>). This
+  // covers objects that were never owned.
+  ~OwnedObjectBase() {
+    releaseSlot();
+  }
+
+  private:
+  template <typename>
+  friend class OwnerPointer;
+  template <typename>
+  friend class WeakPointer;
+  template <typename>
+  friend class OwnedObject;
+  bool isOwned() const {
+    return !owner.expired();
+  }
+  void releaseSlot() {
+    if (slotIndex != 0) {
+      OwnedObjectSlots::release(slotIndex);
+      slotIndex = 0;
+    }
+  }
+  uint32_t slotGeneration;
+  uint32_t slotIndex;
+  // Only used to give cereal a shared_ptr when serializing, and to check ownership.
+  mutable weak_ptr<const void> owner;
+};
+
 template <typename T>
 class WeakPointer {
   public:
 
   template <typename U>
-  WeakPointer(const WeakPointer<U>& o) : elem(o.elem) {
+  WeakPointer(const WeakPointer<U>& o) : ptr(o.ptr), slotIndex(o.slotIndex), slotGeneration(o.slotGeneration) {
   }
 
-  template <typename U>
-  WeakPointer(WeakPointer<U>&& o) : elem(std::move(o.elem)) {
+  WeakPointer(T* t) : WeakPointer(t, *t) {
+    CHECK(t->OwnedObjectBase::isOwned());
   }
 
-  WeakPointer(T* t) : WeakPointer(t->getThis().template dynamicCast<T>()) {}
-
   WeakPointer() {}
   WeakPointer(std::nullptr_t) {}
 
-  template <typename U>
-  WeakPointer<T>& operator = (WeakPointer<U>&& o) {
-    elem = std::move(o.elem);
-    return *this;
-  }
-
   template <typename U>
   WeakPointer<T>& operator = (const WeakPointer<U>& o) {
-    elem = o.elem;
+    ptr = o.ptr;
+    slotIndex = o.slotIndex;
+    slotGeneration = o.slotGeneration;
     return *this;
   }
 
   WeakPointer<T>& operator = (std::nullptr_t) {
-    elem.reset();
+    clear();
     return *this;
   }
 
   template <typename U>
   WeakPointer<U> dynamicCast() {
-    return WeakPointer<U>(std::dynamic_pointer_cast<U>(elem.lock()));
+    if (auto p = dynamic_cast<U*>(get()))
+      return WeakPointer<U>(p, slotIndex, slotGeneration);
+    return nullptr;
   }
 
   using NoConst = typename std::remove_const<T>::type;
 
   WeakPointer<NoConst> removeConst() {
-    return WeakPointer<NoConst>(std::const_pointer_cast<NoConst>(elem.lock()));
+    return WeakPointer<NoConst>(const_cast<NoConst*>(ptr), slotIndex, slotGeneration);
   }
 
   void clear() {
-    elem.reset();
+    *this = WeakPointer<T>();
   }
 
   T* operator -> () const {
-    return elem.lock().get();
+    return get();
   }
 
   T& operator * () const {
-    return *elem.lock().get();
+    return *get();
   }
 
   explicit operator bool() const {
-    return !!elem.lock();
+    return !!get();
   }
 
   bool operator !() const {
-    return !elem.lock();
+    return !get();
   }
 
   template <typename U>
@@ -163,23 +226,43 @@ class WeakPointer {
   }
 
   bool operator == (std::nullptr_t) const {
-    return !elem.lock();
+    return !get();
   }
 
   bool operator != (std::nullptr_t) const {
-    return !!elem.lock();
+    return !!get();
   }
 
   T* get() const {
-    return elem.lock().get();
+    // The null pointer uses slot 0, which is never allocated, so it passes this check and returns nullptr.
+    return OwnedObjectSlots::isAlive(slotIndex, slotGeneration) ? ptr : nullptr;
   }
 
   int getHash() const {
-    auto sp = elem.lock();
-    return std::hash<decltype(sp)>()(sp);
+    return std::hash<T*>()(get());
   }
 
-  SERIALIZE_ALL(elem)
+  // Saved as a weak_ptr, which is how cereal tracks shared objects.
+  template <class Archive>
+  void save(Archive& ar1, const unsigned int) const {
+    shared_ptr<T> sptr;
+    if (auto p = get())
+      if (auto owner = p->OwnedObjectBase::owner.lock())
+        sptr = shared_ptr<T>(owner, p);
+    ar1(weak_ptr<T>(sptr));
+  }
+
+  template <class Archive>
+  void load(Archive& ar1, const unsigned int) {
+    weak_ptr<T> elem;
+    ar1(elem);
+    if (auto sptr = elem.lock()) {
+      // The object may not have been loaded yet, so this is also how it finds out its owner.
+      sptr->OwnedObjectBase::owner = sptr;
+      *this = WeakPointer<T>(sptr.get(), *sptr);
+    } else
+      clear();
+  }
 
   private:
   template<class U>
@@ -188,10 +271,16 @@ class WeakPointer {
   template <typename>
   friend class OwnerPointer;
   template <typename>
+  friend class OwnedObject;
+  template <typename>
   friend class WeakPointer;
-  WeakPointer(const shared_ptr<T>& e) : elem(e) {}
+  WeakPointer(T* p, const OwnedObjectBase& slot)
+      : ptr(p), slotIndex(slot.slotIndex), slotGeneration(slot.slotGeneration) {}
+  WeakPointer(T* p, uint32_t index, uint32_t generation) : ptr(p), slotIndex(index), slotGeneration(generation) {}
 
-  weak_ptr<T> SERIAL(elem);
+  T* ptr = nullptr;
+  uint32_t slotIndex = 0;
+  uint32_t slotGeneration = 0;
 };
 
 template<typename T>
@@ -207,34 +296,43 @@ std::ostream& operator<<(std::ostream& d, const WeakPointer<T>& p){
 }
 
 template <typename T>
-class OwnedObject {
+class OwnedObject : public OwnedObjectBase {
   public:
   WeakPointer<T> getThis() {
-    CHECK(!!weakPointer);
-    return weakPointer;
+    CHECK(isOwned());
+    return WeakPointer<T>(static_cast<T*>(this), *this);
   }
 
   WeakPointer<const T> getThis() const {
-    CHECK(!!weakPointer);
-    return weakPointer;
+    CHECK(isOwned());
+    return WeakPointer<const T>(static_cast<const T*>(this), *this);
   }
 
-  SERIALIZE_ALL(weakPointer)
-
-  private:
-  template <typename>
-  friend class OwnerPointer;
-  WeakPointer<T> SERIAL(weakPointer);
+  // Stored as a pointer to itself in the save file, so that loading it restores the owner.
+  template <class Archive>
+  void serialize(Archive& ar1, const unsigned int) {
+    WeakPointer<T> weakPointer;
+    if (Archive::is_saving::value)
+      weakPointer = WeakPointer<T>(static_cast<T*>(this), *this);
+    ar1(weakPointer);
+  }
 };
 
+// The owned object is kept alive by a second shared_ptr, whose deleter releases the slot before destroying it. So,
+// like with weak_ptr, WeakPointers read as null as soon as the last owner is gone, even from within the destructor.
 template <typename T>
-OwnerPointer<T>::OwnerPointer(shared_ptr<T> t) : elem(t) {
-  elem->weakPointer = WeakPointer<T>(elem);
+OwnerPointer<T>::OwnerPointer(shared_ptr<T> t) : elem(t.get(), [t](T* p) mutable {
+      p->OwnedObjectBase::releaseSlot();
+      t.reset();
+    }) {
+  elem->OwnedObjectBase::owner = elem;
 }
 
 template <typename T>
 WeakPointer<T> OwnerPointer<T>::get() const {
-  return WeakPointer<T>(elem);
+  if (!elem)
+    return nullptr;
+  return WeakPointer<T>(elem.get(), *elem);
 }
 
 template <typename T, typename... Args>
@@ -1005,7 +1005,6 @@ void Player::refreshGameInfo(GameInfo& gameInfo) const {
   auto& info = *gameInfo.playerInfo.getReferenceMaybe<PlayerInfo>();
   info.controlMode = getGame()->getPlayerCreatures().size() == 1 ? PlayerInfo::LEADER : PlayerInfo::FULL;
   auto team = getTeam();
-  auto leader = team[0];
   if (team.size() > 1) {
     auto& timeQueue = getModel()->getTimeQueue();
     auto timeCmp = [&timeQueue](WConstCreature c1, WConstCreature c2) {
@@ -818,7 +818,7 @@ void PlayerControl::handleTrading(WCollective ally) {
     for (WItem it : available)
       if (it->getUniqueId() == *index && it->getPrice() <= budget) {
         collective->takeResource({ResourceId::GOLD, it->getPrice()});
-        Random.choose(storage).dropItem(ally->buyItem(it));
+        Random.choose(asVector<Position>(storage)).dropItem(ally->buyItem(it));
       }
     getView()->updateView(this, true);
   }
@@ -887,7 +887,7 @@ void PlayerControl::handlePillage(WCollective col) {
     if (!index)
       break;
     CHECK(!options[*index].storage.empty());
-    Random.choose(options[*index].storage).dropItems(retrievePillageItems(col, options[*index].items));
+    Random.choose(asVector<Position>(options[*index].storage)).dropItems(retrievePillageItems(col, options[*index].items));
     getView()->updateView(this, true);
   }
 }
@@ -1,77 +1,113 @@
 #include "stdafx.h"
 #include "portals.h"
-#include "shortest_path.h"
 #include "level.h"
+#include "movement_type.h"
 
-SERIALIZE_DEF(Portals, matchings, distanceToNearest)
+template <class Archive>
+void Portals::serialize(Archive& ar, const unsigned int) {
+  ar(matchings, distanceToNearest);
+  if (Archive::is_loading::value) {
+    indexes = Table<int>(distanceToNearest.getBounds(), -1);
+    for (int i : All(matchings))
+      if (matchings[i])
+        indexes[*matchings[i]] = i;
+  }
+}
+
+SERIALIZABLE(Portals);
 SERIALIZATION_CONSTRUCTOR_IMPL(Portals)
 
 optional<int> Portals::getPortalIndex(Vec2 position) const {
-  return matchings.findElement(position).map([](int a) {return a / 2;});
+  int index = indexes[position];
+  if (index > -1)
+    return index / 2;
+  else
+    return none;
 }
 
 void Portals::removePortal(Position position) {
-  if (auto index = matchings.findElement(position.getCoord())) {
-    matchings[*index] = none;
+  int& index = indexes[position.getCoord()];
+  if (index > -1) {
+    matchings[index] = none;
+    index = -1;
     recalculateDistances(position.getLevel());
   }
 }
 
-optional<int> Portals::getDistanceToNearest(Vec2 pos) const {
-  return distanceToNearest[pos];
+bool Portals::isEmpty() const {
+  for (auto& portal : matchings)
+    if (portal)
+      return false;
+  return true;
+}
+
+vector<pair<Vec2, Vec2>> Portals::getConnections() const {
+  vector<pair<Vec2, Vec2>> ret;
+  for (int i = 0; i + 1 < matchings.size(); i += 2)
+    if (matchings[i] && matchings[i + 1])
+      ret.push_back({*matchings[i], *matchings[i + 1]});
+  return ret;
 }
 
 void Portals::recalculateDistances(WLevel level) {
+  distanceToNearest = Table<optional<int>>(distanceToNearest.getBounds());
   vector<Vec2> portals;
   for (auto& portal : matchings)
     if (portal)
       portals.push_back(*portal);
-  if (!level) {
-    distanceToNearest = Table<optional<int>>(1, 1);
-    return;
-  }
-  distanceToNearest = Table<optional<int>>(level->getBounds());
-  auto entryFun = [&](Vec2 pos) {
-    if (Position(pos, level).canEnterEmpty({MovementTrait::WALK}))
-      return 1;
-    else
-      return 100000;
-  };
-  Dijkstra dijkstra(distanceToNearest.getBounds(), portals, 100000, entryFun);
-  for (auto& pos : dijkstra.getAllReachable())
-    distanceToNearest[pos.first] = (int) pos.second;
+  updateDistances(level, portals);
 }
 
-Portals::Portals(Rectangle bounds) : distanceToNearest(bounds) {
+// Lowers the distances to the ones from the given portals. Every walkable cell costs 1 to enter, and other cells
+// are only reached if they're next to a portal.
+void Portals::updateDistances(WLevel level, vector<Vec2> portals) {
+  const int blockedDistance = 100000;
+  queue<Vec2> q;
+  for (Vec2 v : portals) {
+    distanceToNearest[v] = 0;
+    q.push(v);
+  }
+  while (!q.empty()) {
+    Vec2 pos = q.front();
+    q.pop();
+    int distance = *distanceToNearest[pos];
+    for (Vec2 v : pos.neighbors8())
+      if (v.inRectangle(distanceToNearest.getBounds()) &&
+          distanceToNearest[v].value_or(blockedDistance + 1) > distance + 1) {
+        if (Position(v, level).canEnterEmpty({MovementTrait::WALK})) {
+          distanceToNearest[v] = distance + 1;
+          q.push(v);
+        } else if (distance == 0)
+          distanceToNearest[v] = blockedDistance;
+      }
+  }
 }
 
-int getOtherIndex(int index) {
-  return index - index % 2 + (index + 1) % 2;
+Portals::Portals(Rectangle bounds) : distanceToNearest(bounds), indexes(bounds, -1) {
 }
 
-optional<Vec2> Portals::getOtherPortal(Vec2 position) const {
-  if (auto index = matchings.findElement(position)) {
-    auto otherIndex = getOtherIndex(*index);
-    if (otherIndex < matchings.size())
-      return matchings[otherIndex];
-  }
-  return none;
+static int getOtherIndex(int index) {
+  return index ^ 1;
 }
 
 bool Portals::registerPortal(Position pos) {
-  if (!matchings.contains(pos.getCoord())) {
+  Vec2 coord = pos.getCoord();
+  if (indexes[coord] == -1) {
     bool foundInactive = false;
     for (int i : All(matchings)) {
       int other = getOtherIndex(i);
       if (!matchings[i] && other < matchings.size() && matchings[other]) {
-        matchings[i] = pos.getCoord();
+        matchings[i] = coord;
+        indexes[coord] = i;
         foundInactive = true;
         break;
       }
     }
-    if (!foundInactive)
-      matchings.push_back(pos.getCoord());
-    recalculateDistances(pos.getLevel());
+    if (!foundInactive) {
+      indexes[coord] = matchings.size();
+      matchings.push_back(coord);
+    }
+    updateDistances(pos.getLevel(), {coord});
     return true;
   }
   return false;
@@ -3,19 +3,32 @@
 #include "util.h"
 #include "position.h"
 
+// Keeps the pairs of portals on a level. The index of every portal, and the distance from every cell to the nearest
+// portal, are kept in tables, so that the pathfinder can read them on every expansion.
 class Portals {
   public:
   Portals(Rectangle bounds);
-  optional<Vec2> getOtherPortal(Vec2) const;
+  optional<Vec2> getOtherPortal(Vec2 pos) const {
+    int index = indexes[pos];
+    if (index > -1 && (index ^ 1) < matchings.size())
+      return matchings[index ^ 1];
+    return none;
+  }
   optional<int> getPortalIndex(Vec2) const;
   bool registerPortal(Position);
   void removePortal(Position);
-  optional<int> getDistanceToNearest(Vec2) const;
+  optional<int> getDistanceToNearest(Vec2 pos) const {
+    return distanceToNearest[pos];
+  }
+  bool isEmpty() const;
+  vector<pair<Vec2, Vec2>> getConnections() const;
 
   SERIALIZATION_DECL(Portals)
 
   private:
   void recalculateDistances(WLevel);
+  void updateDistances(WLevel, vector<Vec2> portals);
   vector<optional<Vec2>> SERIAL(matchings);
   Table<optional<int>> SERIAL(distanceToNearest);
+  Table<int> indexes;
 };
@@ -192,18 +192,29 @@ optional<Position> Position::getOtherPortal() const {
 
 void Position::registerPortal() {
   if (isValid()) {
-    level->portals->registerPortal(*this);
-    if (auto other = level->portals->getOtherPortal(coord))
+    if (!level->portals->registerPortal(*this))
+      return;
+    if (auto other = level->portals->getOtherPortal(coord)) {
       for (auto& sectors : level->sectors)
         sectors.second.addExtraConnection(coord, *other);
+      for (auto& graph : level->clusterGraphs) {
+        graph.second.invalidate(coord);
+        graph.second.invalidate(*other);
+      }
+    }
   }
 }
 
 void Position::removePortal() {
   if (isValid()) {
-    if (auto other = level->portals->getOtherPortal(coord))
+    if (auto other = level->portals->getOtherPortal(coord)) {
       for (auto& sectors : level->sectors)
         sectors.second.removeExtraConnection(coord, *other);
+      for (auto& graph : level->clusterGraphs) {
+        graph.second.invalidate(coord);
+        graph.second.invalidate(*other);
+      }
+    }
     level->portals->removePortal(*this);
   }
 }
@@ -524,7 +535,7 @@ void Position::addFurniture(PFurniture f) const {
   updateConnectivity();
   updateVisibility();
   updateBuildingSupport();
-  level->addLightSource(coord, furniture->getLightEmission());
+  level->addLightSource(coord, furniture->getBaseLightEmission());
   setNeedsRenderUpdate(true);
 }
 
@@ -550,7 +561,9 @@ void Position::removeCreatureLight(bool darkness) {
 
 void Position::removeFurniture(WConstFurniture f, PFurniture replace) const {
   PROFILE;
-  level->removeLightSource(coord, f->getLightEmission());
+  level->removeLightSource(coord, f->getBaseLightEmission());
+  if (f->getFire() && f->getFire()->isBurning())
+    level->addLightSource(coord, Level::getCreatureLightRadius(), -1);
   auto replacePtr = replace.get();
   auto layer = f->getLayer();
   CHECK(layer != FurnitureLayer::GROUND || !!replace);
@@ -567,7 +580,7 @@ void Position::removeFurniture(WConstFurniture f, PFurniture replace) const {
   updateSupport();
   updateBuildingSupport();
   if (replacePtr)
-    level->addLightSource(coord, replacePtr->getLightEmission());
+    level->addLightSource(coord, replacePtr->getBaseLightEmission());
   setNeedsRenderUpdate(true);
 }
 
@@ -775,6 +788,9 @@ void Position::updateConnectivity() const {
         elem.second.add(coord);
       else
         elem.second.remove(coord);
+    for (auto& elem : level->clusterGraphs)
+      elem.second.invalidate(coord);
+    level->onMovementChanged(coord);
   }
   if (couldEnter != movementEventPredicate())
     if (auto game = getGame())
@@ -839,15 +855,19 @@ optional<DestroyAction> Position::getBestDestroyAction(const MovementType& movem
 
 optional<double> Position::getNavigationCost(const MovementType& movement) const {
   PROFILE;
-  if (canEnterEmpty(movement)) {
-    if (auto c = getCreature()) {
+  if (auto c = getCreature())
+    if (canEnterEmpty(movement)) {
       if (c->getAttributes().isBoulder())
         return none;
       else
         return 5.0;
-    } else
-      return 1.0;
-  }
+    }
+  return getEmptyNavigationCost(movement);
+}
+
+optional<double> Position::getEmptyNavigationCost(const MovementType& movement) const {
+  if (canEnterEmpty(movement))
+    return 1.0;
   if (auto furniture = getFurniture(FurnitureLayer::MIDDLE))
     if (auto destroyAction = getBestDestroyAction(movement))
       return *furniture->getStrength(*destroyAction) / 10;
@@ -883,8 +903,10 @@ bool Position::isVisibleBy(WConstCreature c) const {
 
 void Position::clearItemIndex(ItemIndex index) const {
   PROFILE;
-  if (isValid())
+  if (isValid()) {
     modSquare()->clearItemIndex(index);
+    getModel()->addEvent(EventInfo::ItemsChanged{*this});
+  }
 }
 
 bool Position::isChokePoint(const MovementType& movement) const {
@@ -983,3 +1005,278 @@ void Position::putCreature(WCreature c) {
   CHECK(isValid());
   level->putCreature(coord, c);
 }
+
+static int getLowestBit(uint64_t word) {
+  return __builtin_ctzll(word);
+}
+
+PositionSet::Grid::Grid(Level* level) : level(level) {
+}
+
+bool PositionSet::Grid::set(Vec2 v) {
+  if (!inBounds(v))
+    extend(v);
+  int index = getIndex(v);
+  uint64_t& word = bits[index / 64];
+  uint64_t bit = uint64_t(1) << (index % 64);
+  if (word & bit)
+    return false;
+  word |= bit;
+  return true;
+}
+
+bool PositionSet::Grid::reset(Vec2 v) {
+  if (!contains(v))
+    return false;
+  int index = getIndex(v);
+  bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+  return true;
+}
+
+void PositionSet::Grid::extend(Vec2 v) {
+  // Grow by more than needed, so that adding positions one by one takes amortized constant time.
+  int margin = 8 + max(width, height) / 2;
+  Grid old = *this;
+  if (old.width == 0) {
+    left = v.x - margin;
+    top = v.y - margin;
+    width = height = 2 * margin + 1;
+  } else {
+    left = min(old.left, v.x - margin);
+    top = min(old.top, v.y - margin);
+    width = max(old.left + old.width, v.x + margin + 1) - left;
+    height = max(old.top + old.height, v.y + margin + 1) - top;
+  }
+  bits = vector<uint64_t>((width * height + 63) / 64, 0);
+  for (int i : All(old.bits))
+    for (uint64_t word = old.bits[i]; word; word &= word - 1)
+      set(old.getPosition(i * 64 + getLowestBit(word)).coord);
+}
+
+Position PositionSet::Grid::getPosition(int index) const {
+  Position ret;
+  ret.coord = Vec2(left + index / height, top + index % height);
+  ret.level = level;
+  ret.valid = true;
+  return ret;
+}
+
+PositionSet::PositionSet(initializer_list<Position> elems) : PositionSet(elems.begin(), elems.end()) {
+}
+
+auto PositionSet::getOrInitGrid(Level* level) -> Grid& {
+  for (auto& grid : grids)
+    if (grid.level == level)
+      return grid;
+  grids.push_back(Grid(level));
+  return grids.back();
+}
+
+auto PositionSet::getGrid(const Level* level) const -> const Grid* {
+  for (auto& grid : grids)
+    if (grid.level == level)
+      return &grid;
+  return nullptr;
+}
+
+auto PositionSet::getGrid(const Level* level) -> Grid* {
+  return const_cast<Grid*>(static_cast<const PositionSet*>(this)->getGrid(level));
+}
+
+bool PositionSet::insert(const Position& pos) {
+  if (!useGrids && others.size() >= maxVectorSize)
+    switchToGrids();
+  if (useGrids && pos.valid) {
+    if (!getOrInitGrid(pos.level).set(pos.coord))
+      return false;
+  } else {
+    if (others.contains(pos))
+      return false;
+    others.push_back(pos);
+  }
+  ++numElems;
+  return true;
+}
+
+int PositionSet::erase(const Position& pos) {
+  if (useGrids && pos.valid) {
+    auto grid = getGrid(pos.level);
+    if (!grid || !grid->reset(pos.coord))
+      return 0;
+  } else if (!others.removeElementMaybe(pos))
+    return 0;
+  --numElems;
+  return 1;
+}
+
+int PositionSet::size() const {
+  return numElems;
+}
+
+bool PositionSet::empty() const {
+  return numElems == 0;
+}
+
+void PositionSet::clear() {
+  others.clear();
+  grids.clear();
+  useGrids = false;
+  numElems = 0;
+}
+
+void PositionSet::switchToGrids() {
+  auto elems = std::move(others);
+  others.clear();
+  numElems = 0;
+  useGrids = true;
+  for (auto& pos : elems)
+    insert(pos);
+}
+
+void PositionSet::countElems() {
+  numElems = others.size();
+  for (auto& grid : grids)
+    for (auto word : grid.bits)
+      numElems += bitset<64>(word).count();
+}
+
+bool PositionSet::Grid::sameBounds(const Grid& other) const {
+  return left == other.left && top == other.top && width == other.width && height == other.height;
+}
+
+void PositionSet::sumWith(const PositionSet& other) {
+  if (!useGrids && numElems + other.numElems > maxVectorSize)
+    switchToGrids();
+  if (!useGrids) {
+    for (auto pos : other)
+      insert(pos);
+    return;
+  }
+  for (auto& pos : other.others)
+    insert(pos);
+  for (auto& otherGrid : other.grids) {
+    auto& grid = getOrInitGrid(otherGrid.level);
+    if (grid.sameBounds(otherGrid)) {
+      for (int i : All(grid.bits))
+        grid.bits[i] |= otherGrid.bits[i];
+    } else
+      for (int i : All(otherGrid.bits))
+        for (uint64_t word = otherGrid.bits[i]; word; word &= word - 1)
+          grid.set(otherGrid.getPosition(i * 64 + getLowestBit(word)).coord);
+  }
+  countElems();
+}
+
+void PositionSet::intersectWith(const PositionSet& other) {
+  others = others.filter([&](const Position& pos) { return other.contains(pos); });
+  for (auto& grid : grids) {
+    auto otherGrid = other.useGrids ? other.getGrid(grid.level) : nullptr;
+    if (otherGrid && grid.sameBounds(*otherGrid)) {
+      for (int i : All(grid.bits))
+        grid.bits[i] &= otherGrid->bits[i];
+    } else
+      for (int i : All(grid.bits))
+        for (uint64_t word = grid.bits[i]; word; word &= word - 1) {
+          int bit = getLowestBit(word);
+          if (!other.contains(grid.getPosition(i * 64 + bit)))
+            grid.bits[i] &= ~(uint64_t(1) << bit);
+        }
+  }
+  countElems();
+}
+
+void PositionSet::subtract(const PositionSet& other) {
+  if (useGrids && other.useGrids) {
+    for (auto& grid : grids)
+      if (auto otherGrid = other.getGrid(grid.level)) {
+        if (grid.sameBounds(*otherGrid)) {
+          for (int i : All(grid.bits))
+            grid.bits[i] &= ~otherGrid->bits[i];
+        } else
+          for (int i : All(otherGrid->bits))
+            for (uint64_t word = otherGrid->bits[i]; word; word &= word - 1)
+              grid.reset(otherGrid->getPosition(i * 64 + getLowestBit(word)).coord);
+      }
+    for (auto& pos : other.others)
+      others.removeElementMaybe(pos);
+    countElems();
+  } else
+    for (auto pos : other)
+      erase(pos);
+}
+
+PositionSet::Iter::Iter(const PositionSet* set, int otherIndex, int gridIndex)
+    : set(set), otherIndex(otherIndex), gridIndex(gridIndex) {
+}
+
+void PositionSet::Iter::findSetBit() {
+  if (otherIndex < set->others.size()) {
+    current = set->others[otherIndex];
+    return;
+  }
+  while (gridIndex < set->grids.size()) {
+    auto& grid = set->grids[gridIndex];
+    int wordIndex = bitIndex / 64;
+    if (wordIndex >= grid.bits.size()) {
+      ++gridIndex;
+      bitIndex = 0;
+      continue;
+    }
+    if (uint64_t word = grid.bits[wordIndex] & (~uint64_t(0) << (bitIndex % 64))) {
+      bitIndex = wordIndex * 64 + getLowestBit(word);
+      current = grid.getPosition(bitIndex);
+      return;
+    }
+    bitIndex = (wordIndex + 1) * 64;
+  }
+}
+
+const Position& PositionSet::Iter::operator* () const {
+  return current;
+}
+
+auto PositionSet::Iter::operator++ () -> Iter& {
+  if (otherIndex < set->others.size())
+    ++otherIndex;
+  else
+    ++bitIndex;
+  findSetBit();
+  return *this;
+}
+
+bool PositionSet::Iter::operator == (const Iter& other) const {
+  return otherIndex == other.otherIndex && gridIndex == other.gridIndex && bitIndex == other.bitIndex;
+}
+
+bool PositionSet::Iter::operator != (const Iter& other) const {
+  return !(*this == other);
+}
+
+auto PositionSet::begin() const -> Iter {
+  Iter ret(this, 0, 0);
+  ret.findSetBit();
+  return ret;
+}
+
+auto PositionSet::end() const -> Iter {
+  return Iter(this, others.size(), grids.size());
+}
+
+template <class Archive>
+void PositionSet::serialize(Archive& ar) {
+  cereal::size_type size = numElems;
+  ar(cereal::make_size_tag(size));
+  if (Archive::is_loading::value) {
+    clear();
+    for (int i : Range((int) size)) {
+      Position pos;
+      ar(pos);
+      insert(pos);
+    }
+  } else
+    for (auto pos : *this)
+      ar(pos);
+}
+
+template void PositionSet::serialize(InputArchive&);
+template void PositionSet::serialize(OutputArchive&);
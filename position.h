@@ -102,6 +102,8 @@ class Position {
   bool canNavigate(const MovementType&) const;
   bool canNavigateToOrNeighbor(Position from, const MovementType&) const;
   optional<double> getNavigationCost(const MovementType&) const;
+  /** Same as getNavigationCost, but ignores any creature on the square.*/
+  optional<double> getEmptyNavigationCost(const MovementType&) const;
   optional<DestroyAction> getBestDestroyAction(const MovementType&) const;
   vector<Position> getVisibleTiles(const Vision&);
   void updateConnectivity() const;
@@ -145,6 +147,7 @@ class Position {
   bool SERIAL(valid) = false;
   void updateSupport() const;
   void updateBuildingSupport() const;
+  friend class PositionSet;
 };
 
 template <>
@@ -154,4 +157,115 @@ inline string toString(const Position& t) {
 	return ss.str();
 }
 
-using PositionSet = unordered_set<Position, CustomHash<Position>>;
+// A set of positions that keeps a grid of bits for every level, so that membership tests don't hash anything.
+// Each grid covers the bounding box of the set's positions on its level. Small sets, and invalid positions, are
+// kept in a vector instead.
+class PositionSet {
+  public:
+  PositionSet() {}
+  PositionSet(initializer_list<Position>);
+  template <typename Iter, typename = RequireInputIter<Iter>>
+  PositionSet(Iter begin, Iter end) {
+    for (; begin != end; ++begin)
+      insert(*begin);
+  }
+
+  bool contains(const Position& pos) const {
+    if (useGrids && pos.valid) {
+      for (auto& grid : grids)
+        if (grid.level == pos.level)
+          return grid.contains(pos.coord);
+      return false;
+    }
+    return others.contains(pos);
+  }
+
+  int count(const Position& pos) const {
+    return contains(pos) ? 1 : 0;
+  }
+
+  // Returns true if the position wasn't in the set before.
+  bool insert(const Position&);
+  // Returns the number of erased positions.
+  int erase(const Position&);
+  int size() const;
+  bool empty() const;
+  void clear();
+
+  template <typename Fun>
+  auto transform(Fun fun) const {
+    vector<decltype(fun(std::declval<Position>()))> ret;
+    ret.reserve(size());
+    for (const auto& elem : *this)
+      ret.push_back(fun(elem));
+    return ret;
+  }
+
+  void sumWith(const PositionSet&);
+  void intersectWith(const PositionSet&);
+  void subtract(const PositionSet&);
+
+  class Iter : public std::iterator<std::forward_iterator_tag, Position> {
+    public:
+    const Position& operator* () const;
+    Iter& operator++ ();
+    bool operator == (const Iter&) const;
+    bool operator != (const Iter&) const;
+
+    private:
+    friend class PositionSet;
+    Iter(const PositionSet*, int otherIndex, int gridIndex);
+    void findSetBit();
+    const PositionSet* set;
+    int otherIndex;
+    int gridIndex;
+    int bitIndex = 0;
+    Position current;
+  };
+
+  Iter begin() const;
+  Iter end() const;
+
+  // Saved in the same format as the unordered_set that used to be here, so it's not versioned.
+  template <class Archive>
+  void serialize(Archive&);
+
+  private:
+  struct Grid {
+    Grid(Level*);
+    bool inBounds(Vec2 v) const {
+      return v.x >= left && v.y >= top && v.x < left + width && v.y < top + height;
+    }
+    int getIndex(Vec2 v) const {
+      return (v.x - left) * height + v.y - top;
+    }
+    bool contains(Vec2 v) const {
+      if (!inBounds(v))
+        return false;
+      int index = getIndex(v);
+      return (bits[index / 64] >> (index % 64)) & 1;
+    }
+    // Returns true if the bit wasn't set before.
+    bool set(Vec2);
+    bool reset(Vec2);
+    void extend(Vec2);
+    bool sameBounds(const Grid&) const;
+    Position getPosition(int index) const;
+    Level* level;
+    int left = 0;
+    int top = 0;
+    int width = 0;
+    int height = 0;
+    vector<uint64_t> bits;
+  };
+  Grid& getOrInitGrid(Level*);
+  const Grid* getGrid(const Level*) const;
+  Grid* getGrid(const Level*);
+  void switchToGrids();
+  void countElems();
+  vector<Position> others;
+  vector<Grid> grids;
+  bool useGrids = false;
+  int numElems = 0;
+  static constexpr int maxVectorSize = 16;
+};
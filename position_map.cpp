@@ -9,167 +9,218 @@
 #include "furniture_layer.h"
 #include "construction_map.h"
 
-template <typename T>
-optional<T&> getReferenceOptional(optional<T>& t) {
-  if (t)
-    return *t;
+template <class T, PositionMapType Type>
+PositionMap<T, Type>::LevelData::LevelData(LevelId id, Rectangle bounds) : id(id), bounds(bounds) {
+  if (Type == PositionMapType::DENSE)
+    cells = Table<optional<T>>(bounds);
   else
-    return none;
+    indexes = Table<int>(bounds, -1);
 }
 
-template <typename T>
-optional<const T&> getReferenceOptional(const optional<T>& t) {
-  if (t)
-    return *t;
-  else
-    return none;
+template <class T, PositionMapType Type>
+const T* PositionMap<T, Type>::LevelData::find(Vec2 v) const {
+  if (v.inRectangle(bounds)) {
+    if (Type == PositionMapType::DENSE) {
+      auto& elem = cells[v];
+      return elem ? &*elem : nullptr;
+    } else {
+      int index = indexes[v];
+      return index == -1 ? nullptr : &values[index].second;
+    }
+  }
+  auto it = outliers.find(v);
+  return it == outliers.end() ? nullptr : &it->second;
 }
 
-template <class T>
-optional<const T&> PositionMap<T>::getReferenceMaybe(Position pos) const {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  try {
-    const auto& table = tables.at(levelId);
-    if (pos.getCoord().inRectangle(table.getBounds()))
-      return getReferenceOptional(table[pos.getCoord()]);
-    else
-      return outliers.at(levelId).at(pos.getCoord());
-  } catch (std::out_of_range) {
-    return none;
+template <class T, PositionMapType Type>
+T& PositionMap<T, Type>::LevelData::getOrInit(Vec2 v) {
+  if (v.inRectangle(bounds)) {
+    if (Type == PositionMapType::DENSE) {
+      auto& elem = cells[v];
+      if (!elem)
+        elem = T();
+      return *elem;
+    } else {
+      int& index = indexes[v];
+      if (index == -1) {
+        index = values.size();
+        values.emplace_back(v, T());
+      }
+      return values[index].second;
+    }
   }
+  return outliers[v];
 }
 
-template <class T>
-optional<T&> PositionMap<T>::getReferenceMaybe(Position pos) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  try {
-    auto& table = tables.at(levelId);
-    if (pos.getCoord().inRectangle(table.getBounds()))
-      return getReferenceOptional(table[pos.getCoord()]);
-    else
-      return outliers.at(levelId).at(pos.getCoord());
-  } catch (std::out_of_range) {
-    return none;
+template <class T, PositionMapType Type>
+void PositionMap<T, Type>::LevelData::erase(Vec2 v) {
+  if (!v.inRectangle(bounds))
+    outliers.erase(v);
+  else if (Type == PositionMapType::DENSE)
+    cells[v] = none;
+  else {
+    int index = indexes[v];
+    if (index == -1)
+      return;
+    indexes[v] = -1;
+    if (index < values.size() - 1)
+      indexes[values.back().first] = index;
+    values.removeIndex(index);
   }
 }
 
-template<class T>
-optional<T> PositionMap<T>::getValueMaybe(Position pos) const {
+template <class T, PositionMapType Type>
+auto PositionMap<T, Type>::getLevelData(LevelId id) const -> const LevelData* {
+  if (lastLevel < levels.size() && levels[lastLevel].id == id)
+    return &levels[lastLevel];
+  for (int i : All(levels))
+    if (levels[i].id == id) {
+      lastLevel = i;
+      return &levels[i];
+    }
+  return nullptr;
+}
+
+template <class T, PositionMapType Type>
+auto PositionMap<T, Type>::getLevelData(LevelId id) -> LevelData* {
+  return const_cast<LevelData*>(static_cast<const PositionMap*>(this)->getLevelData(id));
+}
+
+template <class T, PositionMapType Type>
+auto PositionMap<T, Type>::getOrInitLevelData(Position pos) -> LevelData& {
+  LevelId levelId = pos.getLevel()->getUniqueId();
+  if (auto data = getLevelData(levelId))
+    return *data;
+  lastLevel = levels.size();
+  levels.push_back(LevelData(levelId, pos.getLevel()->getBounds().minusMargin(-20)));
+  return levels.back();
+}
+
+template <class T, PositionMapType Type>
+optional<const T&> PositionMap<T, Type>::getReferenceMaybe(Position pos) const {
+  if (auto data = getLevelData(pos.getLevel()->getUniqueId()))
+    if (auto elem = data->find(pos.getCoord()))
+      return *elem;
+  return none;
+}
+
+template <class T, PositionMapType Type>
+optional<T&> PositionMap<T, Type>::getReferenceMaybe(Position pos) {
+  if (auto data = getLevelData(pos.getLevel()->getUniqueId()))
+    if (auto elem = data->find(pos.getCoord()))
+      return const_cast<T&>(*elem);
+  return none;
+}
+
+template <class T, PositionMapType Type>
+optional<T> PositionMap<T, Type>::getValueMaybe(Position pos) const {
   if (auto elem = getReferenceMaybe(pos))
     return *elem;
   else
     return none;
 }
 
-template<class T>
-bool PositionMap<T>::contains(Position pos) const {
+template <class T, PositionMapType Type>
+bool PositionMap<T, Type>::contains(Position pos) const {
   return !!getReferenceMaybe(pos);
 }
 
-template <class T>
-Table<optional<T>>& PositionMap<T>::getTable(Position pos) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  try {
-    return tables.at(levelId);
-  } catch (std::out_of_range) {
-    auto it = tables.insert(make_pair(levelId, Table<optional<T>>(pos.getLevel()->getBounds().minusMargin(-20))));
-    return it.first->second;
-  }
+template <class T, PositionMapType Type>
+T& PositionMap<T, Type>::getOrInit(Position pos) {
+  return getOrInitLevelData(pos).getOrInit(pos.getCoord());
 }
 
-template <class T>
-T& PositionMap<T>::getOrInit(Position pos) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  auto& table = getTable(pos);
-  if (pos.getCoord().inRectangle(table.getBounds())) {
-    if (!table[pos.getCoord()])
-      table[pos.getCoord()] = T();
-    return *table[pos.getCoord()];
-  }
-  else try {
-    return outliers.at(levelId).at(pos.getCoord());
-  } catch (std::out_of_range) {
-    return outliers[levelId][pos.getCoord()] = T();
-  }
-}
-
-template <class T>
-T& PositionMap<T>::getOrFail(Position pos) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  try {
-    auto& table = tables.at(levelId);
-    if (pos.getCoord().inRectangle(table.getBounds()))
-      return *table[pos.getCoord()];
-    else
-      return outliers.at(levelId).at(pos.getCoord());
-  } catch (std::out_of_range) {
-    FATAL << "getOrFail failed " << pos.getCoord();
-    static T t;
-    return t;
-  }
+template <class T, PositionMapType Type>
+T& PositionMap<T, Type>::getOrFail(Position pos) {
+  auto elem = getReferenceMaybe(pos);
+  CHECK(!!elem) << "getOrFail failed " << pos.getCoord();
+  return *elem;
 }
 
-template <class T>
-const T& PositionMap<T>::getOrFail(Position pos) const {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  try {
-    auto& table = tables.at(levelId);
-    if (pos.getCoord().inRectangle(table.getBounds()))
-      return *table[pos.getCoord()];
-    else
-      return outliers.at(levelId).at(pos.getCoord());
-  } catch (std::out_of_range) {
-    FATAL << "getOrFail failed " << pos.getCoord();
-    static T t;
-    return t;
-  }
+template <class T, PositionMapType Type>
+const T& PositionMap<T, Type>::getOrFail(Position pos) const {
+  auto elem = getReferenceMaybe(pos);
+  CHECK(!!elem) << "getOrFail failed " << pos.getCoord();
+  return *elem;
 }
 
-template <class T>
-void PositionMap<T>::set(Position pos, const T& elem) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  auto& table = getTable(pos);
-  if (pos.getCoord().inRectangle(table.getBounds()))
-    table[pos.getCoord()] = elem;
-  else
-    outliers[levelId][pos.getCoord()] = elem;
+template <class T, PositionMapType Type>
+void PositionMap<T, Type>::set(Position pos, const T& elem) {
+  getOrInit(pos) = elem;
 }
 
-template<class T>
-void PositionMap<T>::erase(Position pos) {
-  LevelId levelId = pos.getLevel()->getUniqueId();
-  if (auto table = ::getReferenceMaybe(tables, levelId))
-    if (pos.getCoord().inRectangle(table->getBounds()))
-      (*table)[pos.getCoord()] = none;
-  if (auto out = ::getReferenceMaybe(outliers, levelId))
-    if (auto elem = ::getReferenceMaybe(*out, pos.getCoord()))
-      elem = none;
-
+template <class T, PositionMapType Type>
+void PositionMap<T, Type>::erase(Position pos) {
+  if (auto data = getLevelData(pos.getLevel()->getUniqueId()))
+    data->erase(pos.getCoord());
 }
 
-template <class T>
-void PositionMap<T>::limitToModel(const WModel m) {
+template <class T, PositionMapType Type>
+void PositionMap<T, Type>::limitToModel(const WModel m) {
   std::set<LevelId> goodIds;
   for (WLevel l : m->getLevels())
     goodIds.insert(l->getUniqueId());
-  for (auto& elem : copyOf(tables))
-    if (!goodIds.count(elem.first))
-      tables.erase(elem.first);
-  for (auto& elem : copyOf(outliers))
-    if (!goodIds.count(elem.first))
-      outliers.erase(elem.first);
+  for (int i : AllReverse(levels))
+    if (!goodIds.count(levels[i].id))
+      levels.removeIndexPreserveOrder(i);
+  lastLevel = 0;
 }
 
-template <class T>
-template <class Archive> 
-void PositionMap<T>::serialize(Archive& ar, const unsigned int version) {
-  ar(tables, outliers);
+// Uses the same format as the maps of tables and outliers that used to be here.
+template <class T, PositionMapType Type>
+template <class Archive>
+void PositionMap<T, Type>::serialize(Archive& ar, const unsigned int version) {
+  if (Archive::is_loading::value) {
+    map<LevelId, Table<optional<T>>> tables;
+    map<LevelId, map<Vec2, T>> outliers;
+    ar(tables, outliers);
+    levels.clear();
+    lastLevel = 0;
+    for (auto& elem : tables) {
+      levels.push_back(LevelData(elem.first, elem.second.getBounds()));
+      auto& data = levels.back();
+      if (Type == PositionMapType::DENSE)
+        data.cells = std::move(elem.second);
+      else
+        for (Vec2 v : data.bounds)
+          if (elem.second[v])
+            data.getOrInit(v) = std::move(*elem.second[v]);
+    }
+    for (auto& elem : outliers) {
+      auto data = getLevelData(elem.first);
+      if (!data) {
+        levels.push_back(LevelData(elem.first, Rectangle(0, 0)));
+        data = &levels.back();
+      }
+      data->outliers = std::move(elem.second);
+    }
+  } else {
+    ar(cereal::make_size_tag(cereal::size_type(levels.size())));
+    for (auto& data : levels)
+      if (Type == PositionMapType::DENSE)
+        ar(cereal::make_map_item(data.id, data.cells));
+      else {
+        Table<optional<T>> cells(data.bounds);
+        for (auto& elem : data.values)
+          cells[elem.first] = elem.second;
+        ar(cereal::make_map_item(data.id, cells));
+      }
+    cereal::size_type numOutliers = 0;
+    for (auto& data : levels)
+      if (!data.outliers.empty())
+        ++numOutliers;
+    ar(cereal::make_size_tag(numOutliers));
+    for (auto& data : levels)
+      if (!data.outliers.empty())
+        ar(cereal::make_map_item(data.id, data.outliers));
+  }
 }
 
-template <class T>
-SERIALIZATION_CONSTRUCTOR_IMPL2(PositionMap<T>, PositionMap)
+template <class T, PositionMapType Type>
+PositionMap<T, Type>::PositionMap() {}
 
 SERIALIZABLE_TMPL(PositionMap, int)
+SERIALIZABLE_TMPL(PositionMap, int, PositionMapType::SPARSE)
 SERIALIZABLE_TMPL(PositionMap, bool)
 SERIALIZABLE_TMPL(PositionMap, double)
 
@@ -178,10 +229,9 @@ class Task;
 SERIALIZABLE_TMPL(PositionMap, WTask)
 SERIALIZABLE_TMPL(PositionMap, HighlightType)
 SERIALIZABLE_TMPL(PositionMap, vector<WTask>)
-SERIALIZABLE_TMPL(PositionMap, ViewIndex)
+SERIALIZABLE_TMPL(PositionMap, ViewIndex, PositionMapType::SPARSE)
 SERIALIZABLE_TMPL(PositionMap, vector<Position>)
 SERIALIZABLE_TMPL(PositionMap, ConstructionMap::FurnitureInfo);
 SERIALIZABLE_TMPL(PositionMap, ConstructionMap::TrapInfo);
 SERIALIZABLE_TMPL(PositionMap, EnumMap<FurnitureLayer, optional<FurnitureType>>)
 SERIALIZABLE_TMPL(PositionMap, Position)
-
@@ -5,7 +5,11 @@
 
 class Level;
 
-template <class T>
+// Sparse maps keep a table of indexes into a vector of the values that are set, which saves a lot of memory
+// when T is large and only a few positions are set.
+enum class PositionMapType { DENSE, SPARSE };
+
+template <class T, PositionMapType Type = PositionMapType::DENSE>
 class PositionMap {
   public:
   optional<const T&> getReferenceMaybe(Position) const;
@@ -22,8 +26,21 @@ class PositionMap {
   SERIALIZATION_DECL(PositionMap);
 
   private:
-  Table<optional<T>>& getTable(Position);
-  map<LevelId, Table<optional<T>>> SERIAL(tables);
-  map<LevelId, map<Vec2, T>> SERIAL(outliers);
+  struct LevelData {
+    LevelData(LevelId, Rectangle bounds);
+    const T* find(Vec2) const;
+    T& getOrInit(Vec2);
+    void erase(Vec2);
+    LevelId id;
+    Rectangle bounds;
+    Table<optional<T>> cells;
+    Table<int> indexes;
+    vector<pair<Vec2, T>> values;
+    map<Vec2, T> outliers;
+  };
+  const LevelData* getLevelData(LevelId) const;
+  LevelData* getLevelData(LevelId);
+  LevelData& getOrInitLevelData(Position);
+  vector<LevelData> levels;
+  mutable int lastLevel = 0;
 };
-
@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "profiler.h"
+#include "util.h"
+#include <iomanip>
+#include <limits>
+
+#ifndef EASY_PROFILER
+
+std::atomic<bool> Profiler::enabled(false);
+
+namespace {
+
+struct Event {
+  const char* name;
+  long long start;
+  long long end;
+};
+
+// Written only by its own thread. The buffers are never freed, so events of finished threads can still be dumped.
+struct ThreadBuffer {
+  ThreadBuffer(int id) : threadId(id), events(capacity) {}
+  static const int capacity = 1 << 18;
+  const int threadId;
+  std::vector<Event> events;
+  std::atomic<long long> numEvents {0};
+};
+
+std::mutex buffersMutex;
+std::vector<unique_ptr<ThreadBuffer>> buffers;
+thread_local ThreadBuffer* threadBuffer = nullptr;
+
+ThreadBuffer* getThreadBuffer() {
+  if (!threadBuffer) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffers.push_back(unique_ptr<ThreadBuffer>(new ThreadBuffer(buffers.size())));
+    threadBuffer = buffers.back().get();
+  }
+  return threadBuffer;
+}
+
+}
+
+void Profiler::setEnabled(bool e) {
+  if (e && !isEnabled()) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for (auto& buffer : buffers)
+      buffer->numEvents = 0;
+  }
+  enabled = e;
+}
+
+long long Profiler::getTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::record(const char* name, long long start, long long end) {
+  auto buffer = getThreadBuffer();
+  long long index = buffer->numEvents.load(std::memory_order_relaxed);
+  buffer->events[index % ThreadBuffer::capacity] = Event{name, start, end};
+  buffer->numEvents.store(index + 1, std::memory_order_release);
+}
+
+// Turns "bool Position::isSameLevel(WConstLevel) const" into "Position::isSameLevel".
+static string getShortName(const char* name) {
+  string s(name);
+  auto paren = s.find('(');
+  if (paren == string::npos || paren == 0)
+    return s;
+  auto begin = s.rfind(' ', paren);
+  return s.substr(begin == string::npos ? 0 : begin + 1, paren - (begin == string::npos ? 0 : begin + 1));
+}
+
+static string escapeJson(const string& s) {
+  string ret;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      ret += '\\';
+    ret += c;
+  }
+  return ret;
+}
+
+void Profiler::dump(const char* tracePath, const char* flatProfilePath) {
+  CHECK(!isEnabled());
+  struct FlatEntry {
+    long long count = 0;
+    long long totalTime = 0;
+    long long selfTime = 0;
+  };
+  map<string, FlatEntry> flatProfile;
+  map<const char*, string> shortNames;
+  auto getName = [&](const char* name) -> const string& {
+    auto it = shortNames.find(name);
+    if (it == shortNames.end())
+      it = shortNames.insert(make_pair(name, getShortName(name))).first;
+    return it->second;
+  };
+  ofstream trace(tracePath);
+  trace << "{\"traceEvents\":[\n";
+  bool first = true;
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  for (auto& buffer : buffers) {
+    long long numEvents = buffer->numEvents.load(std::memory_order_acquire);
+    std::vector<Event> events;
+    for (long long i = max(0LL, numEvents - ThreadBuffer::capacity); i < numEvents; ++i)
+      events.push_back(buffer->events[i % ThreadBuffer::capacity]);
+    // Events are recorded when their scope ends, so sort them to recover the nesting.
+    sort(events.begin(), events.end(), [](const Event& e1, const Event& e2) {
+      return e1.start < e2.start || (e1.start == e2.start && e1.end > e2.end);
+    });
+    std::vector<pair<const Event*, long long>> stack;
+    auto popFinished = [&](long long time) {
+      while (!stack.empty() && stack.back().first->end <= time) {
+        auto& entry = flatProfile[getName(stack.back().first->name)];
+        entry.selfTime += stack.back().first->end - stack.back().first->start - stack.back().second;
+        stack.pop_back();
+      }
+    };
+    for (auto& event : events) {
+      popFinished(event.start);
+      if (!stack.empty())
+        stack.back().second += event.end - event.start;
+      stack.push_back(make_pair(&event, 0LL));
+      auto& entry = flatProfile[getName(event.name)];
+      ++entry.count;
+      entry.totalTime += event.end - event.start;
+      if (!first)
+        trace << ",\n";
+      first = false;
+      trace << "{\"name\":\"" << escapeJson(getName(event.name)) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+          << buffer->threadId << ",\"ts\":" << std::fixed << std::setprecision(3) << double(event.start) / 1000
+          << ",\"dur\":" << double(event.end - event.start) / 1000 << "}";
+    }
+    popFinished(std::numeric_limits<long long>::max());
+  }
+  trace << "\n]}\n";
+  std::vector<pair<string, FlatEntry>> sorted(flatProfile.begin(), flatProfile.end());
+  sort(sorted.begin(), sorted.end(), [](const pair<string, FlatEntry>& e1, const pair<string, FlatEntry>& e2) {
+    return e1.second.selfTime > e2.second.selfTime;
+  });
+  ofstream flat(flatProfilePath);
+  flat << std::setw(12) << "self ms" << std::setw(12) << "total ms" << std::setw(12) << "calls" << "  name\n";
+  for (auto& elem : sorted)
+    flat << std::fixed << std::setprecision(3)
+        << std::setw(12) << double(elem.second.selfTime) / 1000000
+        << std::setw(12) << double(elem.second.totalTime) / 1000000
+        << std::setw(12) << elem.second.count << "  " << elem.first << "\n";
+}
+
+#endif
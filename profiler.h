@@ -15,8 +15,60 @@
 
 #else
 
-#define PROFILE
-#define PROFILE_BLOCK(...)
+#include <atomic>
+
+/** Built-in tracing profiler. When enabled, every PROFILE and PROFILE_BLOCK scope is recorded into a ring buffer
+    owned by the current thread. When disabled, a scope costs a single relaxed atomic load.*/
+class Profiler {
+  public:
+  static bool isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+  }
+  /** Enabling discards the events recorded in the previous session.*/
+  static void setEnabled(bool);
+  /** Writes the recorded events as Chrome trace-event JSON, viewable in chrome://tracing or Perfetto,
+      and an aggregated flat profile as text. Must not be called while the profiler is enabled.*/
+  static void dump(const char* tracePath, const char* flatProfilePath);
+
+  static long long getTime();
+  static void record(const char* name, long long start, long long end);
+
+  private:
+  static std::atomic<bool> enabled;
+};
+
+class ProfilerScope {
+  public:
+  ProfilerScope(const char* n) {
+    if (Profiler::isEnabled()) {
+      name = n;
+      start = Profiler::getTime();
+    }
+  }
+
+  ~ProfilerScope() {
+    if (name)
+      Profiler::record(name, start, Profiler::getTime());
+  }
+
+  ProfilerScope(const ProfilerScope&) = delete;
+
+  private:
+  const char* name = nullptr;
+  long long start = 0;
+};
+
+#ifdef _MSC_VER
+#define PROFILER_FUNCTION_NAME __FUNCSIG__
+#else
+#define PROFILER_FUNCTION_NAME __PRETTY_FUNCTION__
+#endif
+
+#define PROFILER_CONCAT2(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT2(a, b)
+
+#define PROFILE ProfilerScope PROFILER_CONCAT(profilerScope, __LINE__)(PROFILER_FUNCTION_NAME);
+#define PROFILE_BLOCK(name) ProfilerScope PROFILER_CONCAT(profilerBlock, __LINE__)(name)
 #define ENABLE_PROFILER
 
 #endif
@@ -18,77 +18,373 @@
 #include "level.h"
 
 
-Sectors::Sectors(Rectangle b, ExtraConnections con) : bounds(b), sectors(bounds, -1), extraConnections(std::move(con)) {
+Sectors::Sectors(Rectangle b, ExtraConnections con) : bounds(b), components(bounds, -1),
+    links((bounds.width() + chunkSize - 1) / chunkSize, (bounds.height() + chunkSize - 1) / chunkSize),
+    extraConnections(std::move(con)) {
+  for (Vec2 v : extraConnections.getBounds())
+    if (extraConnections[v])
+      extraConnectionCells.push_back(v);
 }
 
 bool Sectors::same(Vec2 v, Vec2 w) const {
-  return contains(v) && sectors[v] == sectors[w];
+  return contains(v) && contains(w) && componentSectors[components[v]] == componentSectors[components[w]];
 }
 
 bool Sectors::contains(Vec2 v) const {
-  return sectors[v] > -1;
+  return components[v] > -1;
 }
 
-bool Sectors::add(Vec2 pos) {
-  if (contains(pos))
-    return false;
-  set<int> neighbors;
-  for (Vec2 v : getNeighbors(pos))
-    if (v.inRectangle(bounds) && contains(v))
-      neighbors.insert(sectors[v]);
-  if (neighbors.size() == 0)
-    setSector(pos, getNewSector());
-  else
-  if (neighbors.size() == 1)
-    setSector(pos, *neighbors.begin());
-  else {
-    int largest = -1;
-    for (int elem : neighbors)
-      if (largest == -1 || sizes[largest] < sizes[elem])
-        largest = elem;
-    join(pos, largest);
-  }
-  return true;
+Vec2 Sectors::getChunk(Vec2 pos) const {
+  return (pos - bounds.topLeft()) / chunkSize;
 }
 
-void Sectors::setSector(Vec2 pos, int sector) {
-  CHECK(sectors[pos] != sector);
-  if (contains(pos))
-    --sizes[sectors[pos]];
-  sectors[pos] = sector;
-  ++sizes[sector];
+Rectangle Sectors::getChunkArea(Vec2 chunk) const {
+  Vec2 topLeft = bounds.topLeft() + chunk * chunkSize;
+  return Rectangle(topLeft.x, topLeft.y, min(bounds.right(), topLeft.x + chunkSize),
+      min(bounds.bottom(), topLeft.y + chunkSize));
+}
+
+bool Sectors::isOnChunkBorder(Vec2 pos) const {
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(bounds) && getChunk(v) != getChunk(pos))
+      return true;
+  return false;
 }
 
 int Sectors::getNewSector() {
-  sizes.push_back(0);
-  return sizes.size() - 1;
+  if (!freeSectors.empty()) {
+    int ret = freeSectors.back();
+    freeSectors.pop_back();
+    return ret;
+  }
+  sectorSizes.push_back(0);
+  return sectorSizes.size() - 1;
 }
 
-int Sectors::getNumSectors() const {
-  int ret = 0;
-  for (int s : sizes)
-    if (s > 0)
-      ++ret;
+int Sectors::getNewComponent(Vec2 chunk, int sector) {
+  int ret;
+  if (!freeComponents.empty()) {
+    ret = freeComponents.back();
+    freeComponents.pop_back();
+  } else {
+    ret = sizes.size();
+    sizes.push_back(0);
+    componentChunks.emplace_back();
+    componentSectors.emplace_back();
+  }
+  componentChunks[ret] = chunk;
+  componentSectors[ret] = sector;
+  ++sectorSizes[sector];
   return ret;
 }
 
-void Sectors::join(Vec2 pos1, int sector) {
+void Sectors::releaseComponent(int component) {
+  CHECK(sizes[component] == 0);
+  freeComponents.push_back(component);
+  if (--sectorSizes[componentSectors[component]] == 0)
+    freeSectors.push_back(componentSectors[component]);
+}
+
+void Sectors::relabel(Vec2 start, Rectangle area, int component) {
+  int oldComponent = components[start];
+  CHECK(oldComponent != component);
   queue<Vec2> q;
-  q.push(pos1);
-  setSector(pos1, sector);
+  q.push(start);
+  components[start] = component;
+  int count = 1;
   while (!q.empty()) {
     Vec2 pos = q.front();
     q.pop();
-    for (Vec2 v : getNeighbors(pos))
-      if (v.inRectangle(bounds) && sectors[v] > -1 && sectors[v] != sector) {
-        setSector(v, sector);
+    for (Vec2 v : pos.neighbors8())
+      if (v.inRectangle(area) && components[v] == oldComponent) {
+        components[v] = component;
+        ++count;
         q.push(v);
       }
   }
+  sizes[oldComponent] -= count;
+  sizes[component] += count;
+}
+
+void Sectors::addLink(Vec2 chunk, int component, int linked, int count) {
+  auto& chunkLinks = links[chunk];
+  for (int i : All(chunkLinks))
+    if (chunkLinks[i].component == component && chunkLinks[i].linked == linked) {
+      chunkLinks[i].count += count;
+      CHECK(chunkLinks[i].count >= 0);
+      if (chunkLinks[i].count == 0)
+        chunkLinks.removeIndex(i);
+      return;
+    }
+  CHECK(count > 0);
+  chunkLinks.push_back(Link{component, linked, count});
+}
+
+void Sectors::renameLinks(Vec2 chunk, int from, int to) {
+  // Links of the neighboring chunks refer to the components of this one too.
+  for (Vec2 dir : Rectangle(-1, -1, 2, 2)) {
+    Vec2 elem = chunk + dir;
+    if (!elem.inRectangle(links.getBounds()))
+      continue;
+    vector<Link> renamed;
+    for (auto& link : links[elem]) {
+      int& label = dir == Vec2(0, 0) ? link.component : link.linked;
+      if (label == from) {
+        label = to;
+        renamed.push_back(link);
+        link.count = 0;
+      }
+    }
+    links[elem] = links[elem].filter([](const Link& link) { return link.count > 0; });
+    for (auto& link : renamed)
+      addLink(elem, link.component, link.linked, link.count);
+  }
+}
+
+void Sectors::recomputeLinks(Vec2 chunk) {
+  links[chunk].clear();
+  auto area = getChunkArea(chunk);
+  auto addCell = [&](Vec2 v) {
+    if (contains(v))
+      for (Vec2 w : v.neighbors8())
+        if (w.inRectangle(bounds) && !w.inRectangle(area) && contains(w))
+          addLink(chunk, components[v], components[w], 1);
+  };
+  for (int x : Range(area.left(), area.right())) {
+    addCell(Vec2(x, area.top()));
+    if (area.height() > 1)
+      addCell(Vec2(x, area.bottom() - 1));
+  }
+  for (int y : Range(area.top() + 1, area.bottom() - 1)) {
+    addCell(Vec2(area.left(), y));
+    if (area.width() > 1)
+      addCell(Vec2(area.right() - 1, y));
+  }
+}
+
+vector<int> Sectors::getLinkedComponents(int component) const {
+  vector<int> ret;
+  for (auto& link : links[componentChunks[component]])
+    if (link.component == component)
+      ret.push_back(link.linked);
+  for (Vec2 v : extraConnectionCells)
+    if (components[v] == component && contains(*extraConnections[v]))
+      ret.push_back(components[*extraConnections[v]]);
+  return ret;
+}
+
+void Sectors::setSector(int start, int sector) {
+  int oldSector = componentSectors[start];
+  CHECK(oldSector != sector);
+  CHECK(oldSector > -1);
+  queue<int> q;
+  q.push(start);
+  componentSectors[start] = sector;
+  int count = 1;
+  while (!q.empty()) {
+    int component = q.front();
+    q.pop();
+    for (int linked : getLinkedComponents(component))
+      if (componentSectors[linked] == oldSector) {
+        componentSectors[linked] = sector;
+        ++count;
+        q.push(linked);
+      }
+  }
+  sectorSizes[sector] += count;
+  sectorSizes[oldSector] -= count;
+  if (sectorSizes[oldSector] == 0)
+    freeSectors.push_back(oldSector);
+}
+
+void Sectors::joinSectors(int component1, int component2) {
+  int sector1 = componentSectors[component1];
+  int sector2 = componentSectors[component2];
+  if (sector1 != sector2) {
+    if (sectorSizes[sector1] > sectorSizes[sector2])
+      setSector(component2, sector1);
+    else
+      setSector(component1, sector2);
+  }
+}
+
+bool Sectors::add(Vec2 pos) {
+  if (contains(pos))
+    return false;
+  Vec2 chunk = getChunk(pos);
+  auto area = getChunkArea(chunk);
+  vector<int> neighbors;
+  vector<Vec2> neighborCells;
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(area) && contains(v) && !neighbors.contains(components[v])) {
+      neighbors.push_back(components[v]);
+      neighborCells.push_back(v);
+    }
+  int component = -1;
+  if (neighbors.empty())
+    component = getNewComponent(chunk, getNewSector());
+  else {
+    for (int elem : neighbors)
+      if (component == -1 || sizes[component] < sizes[elem])
+        component = elem;
+    // The position connects these components within the chunk, so the smaller ones are merged into the largest.
+    for (int i : All(neighbors))
+      if (neighbors[i] != component) {
+        joinSectors(component, neighbors[i]);
+        relabel(neighborCells[i], area, component);
+        renameLinks(chunk, neighbors[i], component);
+        releaseComponent(neighbors[i]);
+      }
+  }
+  components[pos] = component;
+  ++sizes[component];
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(bounds) && !v.inRectangle(area) && contains(v)) {
+      addLink(chunk, component, components[v], 1);
+      addLink(getChunk(v), components[v], component, 1);
+    }
+  for (Vec2 v : getNeighbors(pos))
+    if (v.inRectangle(bounds) && contains(v))
+      joinSectors(component, components[v]);
+  return true;
 }
 
 static DirtyTable<int> bfsTable(Level::getMaxBounds(), -1);
 
+// Returns true if the given neighbors of a position are connected with each other without passing through it.
+static bool areConnectedAround(const vector<Vec2>& neighbors) {
+  if (neighbors.empty())
+    return true;
+  int reached = 1;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i : All(neighbors))
+      if (reached & (1 << i))
+        for (int j : All(neighbors))
+          if (!(reached & (1 << j)) && (neighbors[i] - neighbors[j]).length8() == 1) {
+            reached |= 1 << j;
+            changed = true;
+          }
+  }
+  return reached == (1 << neighbors.size()) - 1;
+}
+
+bool Sectors::remove(Vec2 pos) {
+  if (!contains(pos))
+    return false;
+  int component = components[pos];
+  Vec2 chunk = getChunk(pos);
+  auto area = getChunkArea(chunk);
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(bounds) && !v.inRectangle(area) && contains(v)) {
+      addLink(chunk, component, components[v], -1);
+      addLink(getChunk(v), components[v], component, -1);
+    }
+  components[pos] = -1;
+  --sizes[component];
+  vector<Vec2> neighbors;
+  for (Vec2 v : pos.neighbors8())
+    if (v.inRectangle(area) && components[v] == component)
+      neighbors.push_back(v);
+  bool split = false;
+  if (sizes[component] == 0)
+    releaseComponent(component);
+  else if (!areConnectedAround(neighbors)) {
+    bfsTable.clear();
+    queue<Vec2> q;
+    q.push(neighbors[0]);
+    bfsTable.setValue(neighbors[0], 0);
+    int count = 1;
+    while (!q.empty()) {
+      Vec2 v = q.front();
+      q.pop();
+      for (Vec2 w : v.neighbors8())
+        if (w.inRectangle(area) && components[w] == component && !bfsTable.isDirty(w)) {
+          bfsTable.setValue(w, 0);
+          ++count;
+          q.push(w);
+        }
+    }
+    // If the component was split, then the parts that weren't reached become new components of the same sector.
+    if (count < sizes[component]) {
+      split = true;
+      for (Vec2 v : neighbors)
+        if (components[v] == component && !bfsTable.isDirty(v))
+          relabel(v, area, getNewComponent(chunk, componentSectors[component]));
+      for (Vec2 dir : Rectangle(-1, -1, 2, 2))
+        if ((chunk + dir).inRectangle(links.getBounds()))
+          recomputeLinks(chunk + dir);
+    }
+  }
+  // Other chunks are only linked through the border cells and extra connections, so otherwise the sector
+  // can't have been split.
+  if (split || isOnChunkBorder(pos) || extraConnections[pos]) {
+    vector<int> linkedComponents;
+    for (Vec2 v : getNeighbors(pos))
+      if (v.inRectangle(bounds) && contains(v))
+        linkedComponents.push_back(components[v]);
+    // Every part that got cut off from the rest gets a new sector. A part that was already moved to a new sector
+    // isn't moved again.
+    if (!linkedComponents.empty()) {
+      int sector = componentSectors[linkedComponents[0]];
+      for (int elem : getDisjointComponents(linkedComponents))
+        if (componentSectors[elem] == sector)
+          setSector(elem, getNewSector());
+    }
+  }
+  return true;
+}
+
+vector<int> Sectors::getDisjointComponents(const vector<int>& start) const {
+  PROFILE;
+  // Searches from all components at the same pace, until the searches that are still going have met.
+  unordered_map<int, int> visited;
+  vector<queue<int>> queues;
+  for (int component : start)
+    if (!visited.count(component)) {
+      visited[component] = queues.size();
+      queues.emplace_back();
+      queues.back().push(component);
+    }
+  if (queues.size() < 2)
+    return {};
+  DisjointSets sets(queues.size());
+  int lastQueue = -1;
+  while (1) {
+    vector<int> activeQueues;
+    for (int i : All(queues))
+      if (!queues[i].empty()) {
+        activeQueues.push_back(i);
+        lastQueue = i;
+        int component = queues[i].front();
+        queues[i].pop();
+        for (int linked : getLinkedComponents(component)) {
+          auto it = visited.find(linked);
+          if (it == visited.end()) {
+            visited[linked] = i;
+            queues[i].push(linked);
+          } else
+            sets.join(it->second, i);
+        }
+      }
+    if (sets.same(activeQueues))
+      break;
+  }
+  vector<int> ret;
+  for (int component : start)
+    if (!sets.same(visited.at(component), lastQueue))
+      ret.push_back(component);
+  return ret;
+}
+
+int Sectors::getNumSectors() const {
+  int ret = 0;
+  for (int size : sectorSizes)
+    if (size > 0)
+      ++ret;
+  return ret;
+}
+
 vector<Vec2> Sectors::getDisjoint(Vec2 pos) const {
   vector<queue<Vec2>> queues;
   bfsTable.clear();
@@ -125,67 +421,153 @@ vector<Vec2> Sectors::getDisjoint(Vec2 pos) const {
       break;
     }
   }
-  int maxSector = sizes.size() - 1;
   vector<Vec2> ret;
   for (Vec2 v : getNeighbors(pos))
-    if (v.inRectangle(bounds) && sectors[v] <= maxSector && contains(v) &&
-          !sets.same(bfsTable.getDirtyValue(v), lastNeighbor))
+    if (v.inRectangle(bounds) && contains(v) && !sets.same(bfsTable.getDirtyValue(v), lastNeighbor))
       ret.push_back(v);
   return ret;
 }
 
 bool Sectors::isChokePoint(Vec2 pos) const {
+  // Usually the neighbors are connected around the position, which doesn't require a search.
+  if (!extraConnections[pos] || !contains(*extraConnections[pos])) {
+    vector<Vec2> neighbors;
+    for (Vec2 v : pos.neighbors8())
+      if (v.inRectangle(bounds) && contains(v))
+        neighbors.push_back(v);
+    if (areConnectedAround(neighbors))
+      return false;
+  }
   return !getDisjoint(pos).empty();
 }
 
 vector<Vec2> Sectors::getNeighbors(Vec2 pos) const {
-  auto ret = pos.neighbors8();
+  vector<Vec2> ret = pos.neighbors8();
   if (auto con = extraConnections[pos])
     ret.push_back(*con);
   return ret;
 }
 
 void Sectors::addExtraConnection(Vec2 pos1, Vec2 pos2) {
-  if (contains(pos1) && contains(pos2)) {
-    auto sector1 = sectors[pos1];
-    auto sector2 = sectors[pos2];
-    if (sector1 != sector2) {
-      if (sizes[sector1] > sizes[sector2])
-        join(pos2, sector1);
-      else
-        join(pos1, sector2);
-    }
-  }
   CHECK(!extraConnections[pos1] || extraConnections[pos1] == pos2);
   CHECK(!extraConnections[pos2] || extraConnections[pos2] == pos1);
   extraConnections[pos1] = pos2;
   extraConnections[pos2] = pos1;
+  for (Vec2 v : {pos1, pos2})
+    if (!extraConnectionCells.contains(v))
+      extraConnectionCells.push_back(v);
+  if (contains(pos1) && contains(pos2))
+    joinSectors(components[pos1], components[pos2]);
 }
 
 void Sectors::removeExtraConnection(Vec2 pos1, Vec2 pos2) {
   extraConnections[pos1] = none;
   extraConnections[pos2] = none;
-  join(pos1, getNewSector());
+  extraConnectionCells.removeElementMaybe(pos1);
+  extraConnectionCells.removeElementMaybe(pos2);
+  if (contains(pos1) && contains(pos2))
+    for (int elem : getDisjointComponents({components[pos1], components[pos2]}))
+      setSector(elem, getNewSector());
 }
 
-const Sectors::ExtraConnections Sectors::getExtraConnections() const {
+const Sectors::ExtraConnections& Sectors::getExtraConnections() const {
   return extraConnections;
 }
 
-bool Sectors::remove(Vec2 pos) {
-  if (!contains(pos))
-    return false;
-  --sizes[sectors[pos]];
-  sectors[pos] = -1;
-  for (Vec2 v : getDisjoint(pos))
-    join(v, getNewSector());
-  return true;
+void Sectors::initialize() {
+  int numComponents = 0;
+  for (Vec2 v : bounds)
+    numComponents = max(numComponents, components[v] + 1);
+  sizes = vector<int>(numComponents, 0);
+  componentChunks = vector<Vec2>(numComponents);
+  componentSectors = vector<int>(numComponents, -1);
+  for (Vec2 v : bounds)
+    if (contains(v)) {
+      ++sizes[components[v]];
+      componentChunks[components[v]] = getChunk(v);
+    }
+  freeComponents.clear();
+  for (int i : All(sizes))
+    if (sizes[i] == 0)
+      freeComponents.push_back(i);
+  for (Vec2 chunk : links.getBounds())
+    recomputeLinks(chunk);
+  sectorSizes.clear();
+  freeSectors.clear();
+  for (int i : All(sizes))
+    if (sizes[i] > 0 && componentSectors[i] == -1) {
+      int sector = getNewSector();
+      queue<int> q;
+      q.push(i);
+      componentSectors[i] = sector;
+      while (!q.empty()) {
+        int component = q.front();
+        q.pop();
+        ++sectorSizes[sector];
+        for (int linked : getLinkedComponents(component))
+          if (componentSectors[linked] == -1) {
+            componentSectors[linked] = sector;
+            q.push(linked);
+          }
+      }
+    }
+}
+
+template <class Archive>
+void Sectors::serialize(Archive& ar, const unsigned int) {
+  // The labels are run-length encoded chunk by chunk, where the components are contiguous.
+  vector<pair<int, int>> runs;
+  vector<pair<Vec2, Vec2>> connections;
+  auto forEachCell = [this](auto fun) {
+    for (Vec2 chunk : links.getBounds())
+      for (Vec2 v : getChunkArea(chunk))
+        fun(v);
+  };
+  if (!Archive::is_loading::value) {
+    forEachCell([&](Vec2 v) {
+      if (!runs.empty() && runs.back().first == components[v])
+        ++runs.back().second;
+      else
+        runs.push_back({components[v], 1});
+    });
+    for (Vec2 v : extraConnectionCells)
+      connections.push_back({v, *extraConnections[v]});
+  }
+  ar(bounds, runs, connections);
+  if (Archive::is_loading::value) {
+    components = Table<int>(bounds, -1);
+    links = Table<vector<Link>>((bounds.width() + chunkSize - 1) / chunkSize,
+        (bounds.height() + chunkSize - 1) / chunkSize);
+    int run = 0;
+    int numLeft = runs.empty() ? 0 : runs[0].second;
+    forEachCell([&](Vec2 v) {
+      while (numLeft == 0) {
+        CHECK(++run < runs.size()) << "Too few sector labels";
+        numLeft = runs[run].second;
+      }
+      components[v] = runs[run].first;
+      --numLeft;
+    });
+    CHECK(numLeft == 0 && run == runs.size() - 1) << "Too many sector labels";
+    extraConnections = ExtraConnections(bounds);
+    extraConnectionCells.clear();
+    for (auto& connection : connections) {
+      extraConnections[connection.first] = connection.second;
+      extraConnectionCells.push_back(connection.first);
+    }
+    initialize();
+  }
 }
 
+SERIALIZABLE(Sectors);
+SERIALIZATION_CONSTRUCTOR_IMPL(Sectors);
+
 void Sectors::dump() {
   for (int i : Range(bounds.height())) {
-    for (int j : Range(bounds.width()))
-      std::cout << sectors[j][i] << " ";
+    for (int j : Range(bounds.width())) {
+      Vec2 v = bounds.topLeft() + Vec2(j, i);
+      std::cout << (contains(v) ? componentSectors[components[v]] : -1) << " ";
+    }
     std::cout << endl;
   }
   std::cout << endl;
@@ -17,6 +17,10 @@
 
 #include "util.h"
 
+// Keeps track of which positions are connected to each other. The area is split into square chunks, and every
+// chunk is divided into components, which are connected within the chunk. The components are linked to the
+// touching components of neighboring chunks, and the sectors are the connected parts of that graph. A change
+// only searches its own chunk, and the graph of components if the change splits or joins sectors.
 class Sectors {
   public:
   using ExtraConnections = Table<optional<Vec2>>;
@@ -31,17 +35,48 @@ class Sectors {
   bool isChokePoint(Vec2) const;
   void addExtraConnection(Vec2, Vec2);
   void removeExtraConnection(Vec2, Vec2);
-  const ExtraConnections getExtraConnections() const;
+  const ExtraConnections& getExtraConnections() const;
+
+  // Only the component labels are saved, and everything else is recomputed from them.
+  SERIALIZATION_DECL(Sectors)
 
   private:
+  static constexpr int chunkSize = 16;
   vector<Vec2> getNeighbors(Vec2) const;
-  void setSector(Vec2, int);
-  int getNewSector();
-  void join(Vec2, int);
   vector<Vec2> getDisjoint(Vec2) const;
+  Vec2 getChunk(Vec2) const;
+  Rectangle getChunkArea(Vec2 chunk) const;
+  bool isOnChunkBorder(Vec2) const;
+  int getNewComponent(Vec2 chunk, int sector);
+  void releaseComponent(int);
+  int getNewSector();
+  void relabel(Vec2, Rectangle area, int component);
+  void addLink(Vec2 chunk, int component, int linked, int count);
+  void renameLinks(Vec2 chunk, int from, int to);
+  void recomputeLinks(Vec2 chunk);
+  vector<int> getLinkedComponents(int) const;
+  vector<int> getDisjointComponents(const vector<int>&) const;
+  void setSector(int component, int sector);
+  void joinSectors(int component1, int component2);
+  void initialize();
   Rectangle bounds;
-  Table<int> sectors;
+  Table<int> components;
+  // For every component, the number of cells, its chunk and its sector.
   vector<int> sizes;
+  vector<Vec2> componentChunks;
+  vector<int> componentSectors;
+  vector<int> freeComponents;
+  // For every sector, the number of components.
+  vector<int> sectorSizes;
+  vector<int> freeSectors;
+  struct Link {
+    int component;
+    int linked;
+    // The number of pairs of touching cells.
+    int count;
+  };
+  // For every chunk, the links from its components to the touching components of neighboring chunks.
+  Table<vector<Link>> links;
   ExtraConnections extraConnections;
+  vector<Vec2> extraConnectionCells;
 };
-
@@ -21,6 +21,8 @@
 #include "lasting_effect.h"
 #include "furniture.h"
 #include "furniture_usage.h"
+#include "benchmark.h"
+#include "portals.h"
 
 SERIALIZE_DEF(ShortestPath, path, target, bounds, reversed)
 SERIALIZATION_CONSTRUCTOR_IMPL(ShortestPath)
@@ -35,7 +37,6 @@ class DistanceTable {
   DistanceTable(Rectangle bounds) : ddist(bounds), dirty(bounds, 0) {} 
 
   double getDistance(Vec2 v) const {
-    PROFILE;
     return dirty[v] < counter ? ShortestPath::infinity : ddist[v];
   }
 
@@ -54,72 +55,137 @@ class DistanceTable {
   int counter = 1;
 };
 
-static DistanceTable distanceTable(Level::getMaxBounds());
-static DirtyTable<double> navigationCostCache(Level::getMaxBounds(), 0);
+struct QueueElem {
+  Vec2 pos;
+  double value;
+};
 
-static function<double(Vec2)> getCached(function<double(Vec2)> fun) {
-  return [fun] (Vec2 v) {
-    if (navigationCostCache.isDirty(v))
-      return navigationCostCache.getDirtyValue(v);
+bool inline operator < (const QueueElem& e1, const QueueElem& e2) {
+  return e1.value > e2.value || (e1.value == e2.value && e1.pos < e2.pos);
+}
+
+// A binary heap kept in a vector that is reused between searches, so that it doesn't allocate once it's grown.
+class SearchQueue {
+  public:
+  void clear() {
+    elems.clear();
+  }
+
+  bool empty() const {
+    return elems.empty();
+  }
+
+  void push(QueueElem elem) {
+    elems.push_back(elem);
+    std::push_heap(elems.begin(), elems.end());
+  }
+
+  Vec2 top() const {
+    return elems.front().pos;
+  }
+
+  void pop() {
+    std::pop_heap(elems.begin(), elems.end());
+    elems.pop_back();
+  }
+
+  private:
+  vector<QueueElem> elems;
+};
+
+// The tables used by a search are large, so they are reused and cleared in constant time by bumping a generation
+// counter. Every thread gets its own copy, so searches can run concurrently.
+struct SearchState {
+  SearchState() : distanceTable(Level::getMaxBounds()), navigationCostCache(Level::getMaxBounds(), 0) {}
+  DistanceTable distanceTable;
+  DirtyTable<double> navigationCostCache;
+  SearchQueue queue;
+};
+
+static SearchState& getSearchState() {
+  static thread_local SearchState state;
+  return state;
+}
+
+template <typename EntryFun>
+static auto getCached(EntryFun& fun, DirtyTable<double>& cache) {
+  return [&fun, &cache] (Vec2 v) {
+    if (cache.isDirty(v))
+      return cache.getDirtyValue(v);
     else {
-      auto res = fun(v);
-      navigationCostCache.setValue(v, res);
+      double res = fun(v);
+      cache.setValue(v, res);
       return res;
     }
   };
 }
 
+// Adapts the public interface, which lists the directions in a vector, to the callback that the search uses.
+static auto getDirectionsVisitor(function<vector<Vec2>(Vec2)>& directions) {
+  return [&directions] (Vec2 pos, auto visit) {
+    for (Vec2 dir : directions(pos))
+      visit(dir);
+  };
+}
+
 const int margin = 15;
 
 ShortestPath::ShortestPath(Rectangle a, function<double(Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun,
-    function<vector<Vec2>(Vec2)> directions, Vec2 to, Vec2 from, double mult) : target(to), bounds(a) {
-  PROFILE;
-  CHECK(Level::getMaxBounds().contains(a));
-  navigationCostCache.clear();
-  if (mult == 0)
-    init(getCached(entryFun), lengthFun, directions, target, from);
-  else {
-    init(getCached(entryFun), lengthFun, directions, target, none, revShortestLimit);
-    distanceTable.setDistance(target, infinity);
-    navigationCostCache.clear();
-    reverse(getCached(entryFun), lengthFun, directions, mult, from, revShortestLimit);
-  }
+    function<vector<Vec2>(Vec2)> directions, Vec2 to, Vec2 from, double mult) : ShortestPath(a, to) {
+  search(entryFun, lengthFun, getDirectionsVisitor(directions), from, mult);
 }
 
 ShortestPath::ShortestPath(Rectangle area, function<double (Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun,
-    vector<Vec2> directions, Vec2 target, Vec2 from, double mult) : ShortestPath(area, entryFun, lengthFun,
-    [directions](Vec2) { return directions; }, target, from, mult)
-{
+    vector<Vec2> directions, Vec2 target, Vec2 from, double mult) : ShortestPath(area, target) {
+  search(entryFun, lengthFun, [&directions] (Vec2, auto visit) {
+    for (Vec2 dir : directions)
+      visit(dir);
+  }, from, mult);
 }
 
-struct QueueElem {
-  Vec2 pos;
-  double value;
-};
+ShortestPath::ShortestPath(Rectangle area, Vec2 target) : target(target), bounds(area) {
+}
 
-bool inline operator < (const QueueElem& e1, const QueueElem& e2) {
-  return e1.value > e2.value || (e1.value == e2.value && e1.pos < e2.pos);
+template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+void ShortestPath::search(EntryFun& entryFun, LengthFun& lengthFun, DirectionsFun directions, Vec2 from, double mult) {
+  PROFILE;
+  CHECK(Level::getMaxBounds().contains(bounds));
+  auto& state = getSearchState();
+  state.navigationCostCache.clear();
+  auto cachedEntryFun = getCached(entryFun, state.navigationCostCache);
+  if (mult == 0)
+    init(cachedEntryFun, lengthFun, directions, target, from);
+  else {
+    init(cachedEntryFun, lengthFun, directions, target, none, revShortestLimit);
+    state.distanceTable.setDistance(target, infinity);
+    state.navigationCostCache.clear();
+    reverse(cachedEntryFun, lengthFun, directions, mult, from, revShortestLimit);
+  }
 }
 
-void ShortestPath::init(function<double(Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions, Vec2 target,
+template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+void ShortestPath::init(EntryFun& entryFun, LengthFun& lengthFun, DirectionsFun& directions, Vec2 target,
     optional<Vec2> from, optional<int> limit) {
   PROFILE;
+  BenchmarkTimer timer(BenchmarkSection::SHORTEST_PATH);
   reversed = false;
+  auto& distanceTable = getSearchState().distanceTable;
+  auto& q = getSearchState().queue;
   distanceTable.clear();
-  function<QueueElem(Vec2)> makeElem;
-  if (from)
-    makeElem = [&](Vec2 pos) ->QueueElem { return {pos, distanceTable.getDistance(pos) + lengthFun(*from, pos)}; };
-  else
-    makeElem = [&](Vec2 pos) ->QueueElem { return {pos, distanceTable.getDistance(pos)}; };
-  priority_queue<QueueElem, vector<QueueElem>> q;
+  q.clear();
+  auto makeElem = [&](Vec2 pos) -> QueueElem {
+    if (from)
+      return {pos, distanceTable.getDistance(pos) + lengthFun(*from, pos)};
+    else
+      return {pos, distanceTable.getDistance(pos)};
+  };
   distanceTable.setDistance(target, 0);
   q.push(makeElem(target));
   int numPopped = 0;
   while (!q.empty()) {
     ++numPopped;
-    Vec2 pos = q.top().pos;
+    Vec2 pos = q.top();
     double posDist = distanceTable.getDistance(pos);
-   // INFO << "Popping " << pos << " " << distance[pos]  << " " << (from ? (*from - pos).length4() : 0);
     if (from == pos || (limit && distanceTable.getDistance(pos) >= *limit)) {
       INFO << "Shortest path from " << (from ? *from : Vec2(-1, -1)) << " to " << target << " " << numPopped
         << " visited distance " << distanceTable.getDistance(pos);
@@ -127,34 +193,35 @@ void ShortestPath::init(function<double(Vec2)> entryFun, function<double(Vec2, V
       return;
     }
     q.pop();
-    {
-      PROFILE_BLOCK("Process neighbors");
-      for (Vec2 dir : directions(pos)) {
-        Vec2 next = pos + dir;
-        if (next.inRectangle(bounds)) {
-          double nextDist = distanceTable.getDistance(next);
-          if (posDist < nextDist) {
-            double dist = posDist + entryFun(next);
-            //CHECK(dist > cdist) << "Entry fun non positive " << dist - cdist;
-            if (dist < nextDist) {
-              distanceTable.setDistance(next, dist);
-              q.push(makeElem(next));
-            }
+    directions(pos, [&](Vec2 dir) {
+      Vec2 next = pos + dir;
+      if (next.inRectangle(bounds)) {
+        double nextDist = distanceTable.getDistance(next);
+        if (posDist < nextDist) {
+          double dist = posDist + entryFun(next);
+          if (dist < nextDist) {
+            distanceTable.setDistance(next, dist);
+            q.push(makeElem(next));
           }
         }
       }
-    }
+    });
   }
   INFO << "Shortest path exhausted, " << numPopped << " visited";
 }
 
-void ShortestPath::reverse(function<double(Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions,
-    double mult, Vec2 from, int limit) {
+template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+void ShortestPath::reverse(EntryFun& entryFun, LengthFun& lengthFun, DirectionsFun& directions, double mult,
+    Vec2 from, int limit) {
   PROFILE;
+  BenchmarkTimer timer(BenchmarkSection::SHORTEST_PATH);
   reversed = true;
-  function<QueueElem(Vec2)> makeElem = [&](Vec2 pos)->QueueElem { return {pos, distanceTable.getDistance(pos)
-      + lengthFun(from, pos)};};
-  priority_queue<QueueElem, vector<QueueElem>> q;
+  auto& distanceTable = getSearchState().distanceTable;
+  auto& q = getSearchState().queue;
+  q.clear();
+  auto makeElem = [&](Vec2 pos) -> QueueElem {
+    return {pos, distanceTable.getDistance(pos) + lengthFun(from, pos)};
+  };
   for (Vec2 v : bounds) {
     double dist = distanceTable.getDistance(v);
     if (dist <= limit) {
@@ -165,38 +232,41 @@ void ShortestPath::reverse(function<double(Vec2)> entryFun, function<double(Vec2
   int numPopped = 0;
   while (!q.empty()) {
     ++numPopped;
-    Vec2 pos = q.top().pos;
+    Vec2 pos = q.top();
     if (from == pos) {
       INFO << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
       constructPath(pos, directions, true);
       return;
     }
     q.pop();
-    for (Vec2 dir : directions(pos))
+    directions(pos, [&](Vec2 dir) {
       if ((pos + dir).inRectangle(bounds)) {
-        if (distanceTable.getDistance(pos + dir) > distanceTable.getDistance(pos) + entryFun(pos + dir) && 
+        if (distanceTable.getDistance(pos + dir) > distanceTable.getDistance(pos) + entryFun(pos + dir) &&
             distanceTable.getDistance(pos + dir) < 0) {
           distanceTable.setDistance(pos + dir, distanceTable.getDistance(pos) + entryFun(pos + dir));
           q.push(makeElem(pos + dir));
         }
       }
+    });
   }
   INFO << "Rev shortest path from " << " from " << target << " " << numPopped << " visited";
 }
 
-void ShortestPath::constructPath(Vec2 pos, function<vector<Vec2>(Vec2)> directions, bool reversed) {
+template <typename DirectionsFun>
+void ShortestPath::constructPath(Vec2 pos, DirectionsFun& directions, bool reversed) {
+  auto& distanceTable = getSearchState().distanceTable;
   vector<Vec2> ret;
   while (pos != target) {
     Vec2 next;
     double lowest = distanceTable.getDistance(pos);
     CHECK(lowest < infinity);
-    for (Vec2 dir : directions(pos)) {
+    directions(pos, [&](Vec2 dir) {
       double dist;
       if ((pos + dir).inRectangle(bounds) && (dist = distanceTable.getDistance(pos + dir)) < lowest) {
         lowest = dist;
         next = pos + dir;
       }
-    }
+    });
     if (lowest >= distanceTable.getDistance(pos)) {
       if (reversed)
         break;
@@ -240,12 +310,8 @@ Vec2 ShortestPath::getTarget() const {
   return target;
 }
 
-ShortestPath LevelShortestPath::makeShortestPath(WConstCreature creature, Position to, Position from, double mult) {
-  PROFILE;
-  WLevel level = from.getLevel();
-  Rectangle bounds = level->getBounds();
-  CHECK(to.isSameLevel(from));
-  auto entryFun = [=, movementType = creature->getMovementType()](Vec2 v) {
+static auto getEntryFun(WConstCreature creature, WLevel level) {
+  return [=, movementType = creature->getMovementType()](Vec2 v) {
     Position pos(v, level);
     if (creature->getPosition() == pos)
       return 1.0;
@@ -254,43 +320,187 @@ ShortestPath LevelShortestPath::makeShortestPath(WConstCreature creature, Positi
     else
       return ShortestPath::infinity;
   };
-  auto directionsFun = [=] (Vec2 v) {
-    Position pos(v, level);
-    vector<Vec2> ret = Vec2::directions8();
-    if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
-      if (f->getUsageType() == FurnitureUsageType::PORTAL)
-        if (auto otherPos = pos.getOtherPortal())
-          if (auto f2 = otherPos->getFurniture(FurnitureLayer::MIDDLE))
+}
+
+static auto getDirectionsFun(WLevel level, const Portals& portals) {
+  return [=, &portals] (Vec2 v, auto visit) {
+    for (Vec2 dir : Vec2::directions8())
+      visit(dir);
+    if (auto other = portals.getOtherPortal(v)) {
+      Position pos(v, level);
+      Position otherPos(*other, level);
+      if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
+        if (f->getUsageType() == FurnitureUsageType::PORTAL)
+          if (auto f2 = otherPos.getFurniture(FurnitureLayer::MIDDLE))
             if (f2->getUsageType() == FurnitureUsageType::PORTAL)
-              ret.push_back(otherPos->getCoord() - v);
-    return ret;
+              visit(*other - v);
+    }
   };
+}
+
+static Rectangle getSearchArea(Rectangle bounds, Vec2 from, Vec2 to) {
+  return bounds.intersection(Rectangle(min(to.x, from.x) - margin, min(to.y, from.y) - margin,
+      max(to.x, from.x) + margin, max(to.y, from.y) + margin));
+}
+
+ShortestPath LevelShortestPath::makeShortestPath(WConstCreature creature, Position to, Position from, double mult) {
+  PROFILE;
+  WLevel level = from.getLevel();
+  Rectangle bounds = level->getBounds();
+  CHECK(to.isSameLevel(from));
+  auto entryFun = getEntryFun(creature, level);
+  const Portals& portals = *level->portals;
+  auto directionsFun = getDirectionsFun(level, portals);
   CHECK(to.getCoord().inRectangle(level->getBounds()));
   CHECK(from.getCoord().inRectangle(level->getBounds()));
   if (mult == 0) {
-    auto lengthFun = [level](Vec2 from, Vec2 to) {
-      auto dist1 = Position(from, level).getDistanceToNearestPortal().value_or(10000);
-      auto dist2 = Position(to, level).getDistanceToNearestPortal().value_or(10000);
+    auto lengthFun = [&portals, noPortals = portals.isEmpty()](Vec2 from, Vec2 to) {
       // Use a suboptimal, but faster pathfinding.
-      return 2 * min<double>(from.dist8(to) + 0.1 * from.distD(to), dist1 + dist2);
+      double length = from.dist8(to) + 0.1 * from.distD(to);
+      if (noPortals)
+        return 2 * length;
+      auto dist1 = portals.getDistanceToNearest(from).value_or(10000);
+      auto dist2 = portals.getDistanceToNearest(to).value_or(10000);
+      return 2 * min<double>(length, dist1 + dist2);
     };
-    return ShortestPath(bounds, entryFun, lengthFun, directionsFun, to.getCoord(), from.getCoord(), mult);
+    ShortestPath ret(bounds, getWaypoint(creature->getMovementType(), to, from));
+    ret.search(entryFun, lengthFun, directionsFun, from.getCoord(), mult);
+    return ret;
   } else {
     auto lengthFun = [](Vec2 from, Vec2 to)->double { return from.dist8(to); };
-    Vec2 vTo = to.getCoord();
-    Vec2 vFrom = from.getCoord();
-    bounds = bounds.intersection(Rectangle(min(vTo.x, vFrom.x) - margin, min(vTo.y, vFrom.y) - margin,
-        max(vTo.x, vFrom.x) + margin, max(vTo.y, vFrom.y) + margin));
-    return ShortestPath(bounds, entryFun, lengthFun, directionsFun, to.getCoord(), from.getCoord(), mult);
+    ShortestPath ret(getSearchArea(bounds, from.getCoord(), to.getCoord()), to.getCoord());
+    ret.search(entryFun, lengthFun, directionsFun, from.getCoord(), mult);
+    return ret;
   }
 }
 
-SERIALIZE_DEF(LevelShortestPath, path, level)
+// Paths longer than this are only searched exactly up to a waypoint on a coarse route from the level's ClusterGraph.
+const int hierarchicalMinDistance = 3 * ClusterGraph::clusterSize;
+const int waypointDistance = 2 * ClusterGraph::clusterSize;
+
+Vec2 LevelShortestPath::getWaypoint(const MovementType& movement, Position to, Position from) {
+  PROFILE;
+  Vec2 vTo = to.getCoord();
+  Vec2 vFrom = from.getCoord();
+  if (vFrom.dist8(vTo) < hierarchicalMinDistance)
+    return vTo;
+  WLevel level = to.getLevel();
+  // Creatures are left out, because their moves don't invalidate the graph.
+  auto costFun = [level, &movement](Vec2 v) {
+    return Position(v, level).getEmptyNavigationCost(movement).value_or(ShortestPath::infinity);
+  };
+  // Entering a cell costs at least 1, and going through portals can be shorter than the straight distance.
+  double lowerBound = vFrom.dist8(vTo);
+  if (auto dist1 = from.getDistanceToNearestPortal())
+    if (auto dist2 = to.getDistanceToNearestPortal())
+      lowerBound = min<double>(lowerBound, *dist1 + *dist2);
+  // If the route is too expensive, the exact search is done instead.
+  if (auto route = level->getClusterGraph(movement).findRoute(level->getSectors(movement), costFun, vFrom, vTo,
+      lowerBound))
+    for (Vec2 v : *route)
+      if (v.dist8(vFrom) >= waypointDistance)
+        return v;
+  return vTo;
+}
+
+FlowField LevelShortestPath::makeFlowField(WLevel level, vector<Vec2> targets, const MovementType& movement) {
+  return FlowField(level->getBounds(), std::move(targets),
+      [level, movement](Vec2 v) {
+        return Position(v, level).getEmptyNavigationCost(movement).value_or(ShortestPath::infinity);
+      },
+      getDirectionsFun(level, *level->portals));
+}
+
+template <class Archive>
+void LevelShortestPath::serialize(Archive& ar, const unsigned int version) {
+  ar(path, level);
+  if (version >= 1)
+    ar(target);
+  else if (Archive::is_loading::value)
+    target = path.getTarget();
+  if (Archive::is_loading::value)
+    updateRegions();
+}
+
+SERIALIZABLE(LevelShortestPath);
 SERIALIZATION_CONSTRUCTOR_IMPL(LevelShortestPath);
 
 
 LevelShortestPath::LevelShortestPath(WConstCreature creature, Position to, Position from, double mult)
-    : path(makeShortestPath(creature, to, from, mult)), level(to.getLevel()) {
+    : path(makeShortestPath(creature, to, from, mult)), level(to.getLevel()), target(to.getCoord()),
+      movementCounter(level->getMovementCounter()) {
+  updateRegions();
+}
+
+void LevelShortestPath::updateRegions() {
+  regions.clear();
+  for (Vec2 v : path.path) {
+    Vec2 region = Level::getMovementRegion(v);
+    if (!regions.contains(region))
+      regions.push_back(region);
+  }
+}
+
+bool LevelShortestPath::isOutdated() const {
+  for (Vec2 region : regions)
+    if (level->movementChangedSince(region, movementCounter))
+      return true;
+  return false;
+}
+
+// A detour leaves the path this many steps before the blocked cell, and rejoins it this many steps after.
+const int repairRejoinDistance = 3;
+const int maxRepairs = 5;
+
+bool LevelShortestPath::repair(WConstCreature creature, optional<Position> blocked) {
+  PROFILE;
+  if (path.isReversed() || path.path.size() < 2)
+    return false;
+  movementCounter = level->getMovementCounter();
+  auto movement = creature->getMovementType();
+  // The path is kept in reverse, with the current position at the back.
+  auto& cells = path.path;
+  auto isBlocked = [&](Vec2 v) {
+    return (blocked && blocked->getCoord() == v) || !Position(v, level).getNavigationCost(movement);
+  };
+  auto entryFun = [&, fun = getEntryFun(creature, level)](Vec2 v) {
+    return blocked && blocked->getCoord() == v ? ShortestPath::infinity : fun(v);
+  };
+  auto lengthFun = [](Vec2 from, Vec2 to)->double { return from.dist8(to); };
+  auto spliceAround = [&](int blockedIndex) {
+    int startIndex = min<int>(cells.size() - 1, blockedIndex + repairRejoinDistance);
+    while (startIndex < cells.size() - 1 && isBlocked(cells[startIndex]))
+      ++startIndex;
+    int rejoinIndex = max(0, blockedIndex - repairRejoinDistance);
+    while (rejoinIndex > 0 && isBlocked(cells[rejoinIndex]))
+      --rejoinIndex;
+    if (isBlocked(cells[rejoinIndex]))
+      return false;
+    Vec2 from = cells[startIndex];
+    Vec2 to = cells[rejoinIndex];
+    ShortestPath detour(getSearchArea(level->getBounds(), from, to), to);
+    detour.search(entryFun, lengthFun, getDirectionsFun(level, *level->portals), from, 0);
+    if (!detour.isReachable(from))
+      return false;
+    cells = concat(getPrefix(cells, rejoinIndex), detour.path, getSuffix(cells, cells.size() - startIndex - 1));
+    return true;
+  };
+  // The counter was moved forward, so every blocked cell is spliced around, starting from the closest one. If there
+  // are too many of them, a new path is cheaper.
+  for (int numRepairs = 0; ; ++numRepairs) {
+    optional<int> blockedIndex;
+    for (int i = cells.size() - 2; i >= 0; --i)
+      if (isBlocked(cells[i])) {
+        blockedIndex = i;
+        break;
+      }
+    if (!blockedIndex) {
+      updateRegions();
+      return true;
+    }
+    if (numRepairs == maxRepairs || !spliceAround(*blockedIndex))
+      return false;
+  }
 }
 
 WLevel LevelShortestPath::getLevel() const {
@@ -317,7 +527,7 @@ optional<Position> LevelShortestPath::getNextNextMove(Position pos) {
 }
 
 Position LevelShortestPath::getTarget() const {
-  return Position(path.getTarget(), level);
+  return Position(target, level);
 }
 
 bool LevelShortestPath::isReversed() const {
@@ -326,8 +536,10 @@ bool LevelShortestPath::isReversed() const {
 
 Dijkstra::Dijkstra(Rectangle bounds, vector<Vec2> from, int maxDist, function<double(Vec2)> entryFun,
       vector<Vec2> directions) {
+  BenchmarkTimer timer(BenchmarkSection::SHORTEST_PATH);
+  auto& distanceTable = getSearchState().distanceTable;
   distanceTable.clear();
-  function<bool(Vec2, Vec2)> comparator = [](Vec2 pos1, Vec2 pos2) {
+  function<bool(Vec2, Vec2)> comparator = [&distanceTable](Vec2 pos1, Vec2 pos2) {
       double diff = distanceTable.getDistance(pos1) - distanceTable.getDistance(pos2);
       if (diff > 0 || (diff == 0 && pos1 < pos2))
         return 1;
@@ -378,7 +590,78 @@ const map<Vec2, double>& Dijkstra::getAllReachable() const {
   return reachable;
 }
 
+FlowField::FlowField(Rectangle bounds, vector<Vec2> t, function<double(Vec2)> entryFun, DirectionsFun dirs)
+    : targets(std::move(t)), distance(bounds, ShortestPath::infinity), directions(std::move(dirs)) {
+  PROFILE;
+  BenchmarkTimer timer(BenchmarkSection::SHORTEST_PATH);
+  auto& q = getSearchState().queue;
+  q.clear();
+  for (auto& v : targets)
+    if (v.inRectangle(bounds)) {
+      distance[v] = 0;
+      q.push({v, 0});
+    }
+  while (!q.empty()) {
+    Vec2 pos = q.top();
+    q.pop();
+    double cdist = distance[pos];
+    visitNeighbors(pos, [&](Vec2 next) {
+      if (next.inRectangle(bounds) && cdist < distance[next]) {
+        double dist = cdist + entryFun(next);
+        CHECK(dist > cdist) << "Entry fun non positive " << dist - cdist;
+        if (dist < distance[next]) {
+          distance[next] = dist;
+          q.push({next, dist});
+        }
+      }
+    });
+  }
+}
+
+void FlowField::visitNeighbors(Vec2 pos, function<void(Vec2)> visit) const {
+  if (directions)
+    directions(pos, [&](Vec2 dir) { visit(pos + dir); });
+  else
+    for (Vec2 v : pos.neighbors8())
+      visit(v);
+}
+
+double FlowField::getDistance(Vec2 v) const {
+  if (v.inRectangle(distance.getBounds()))
+    return distance[v];
+  else
+    return ShortestPath::infinity;
+}
+
+vector<Vec2> FlowField::getNextMoves(Vec2 pos) const {
+  if (!isValid(pos))
+    return {};
+  double cdist = getDistance(pos);
+  vector<Vec2> ret;
+  visitNeighbors(pos, [&](Vec2 v) {
+    if (getDistance(v) < cdist)
+      ret.push_back(v);
+  });
+  sort(ret.begin(), ret.end(), [this](Vec2 v1, Vec2 v2) { return getDistance(v1) < getDistance(v2); });
+  return ret;
+}
+
+void FlowField::onChanged(Vec2 pos) {
+  validBelow = min(validBelow, getDistance(pos));
+  visitNeighbors(pos, [&](Vec2 v) { validBelow = min(validBelow, getDistance(v)); });
+}
+
+bool FlowField::isValid(Vec2 pos) const {
+  // Unreachable cells are only known to stay that way if nothing has changed.
+  return validBelow == ShortestPath::infinity || getDistance(pos) < validBelow;
+}
+
+const vector<Vec2>& FlowField::getTargets() const {
+  return targets;
+}
+
 BfSearch::BfSearch(Rectangle bounds, Vec2 from, function<bool(Vec2)> entryFun, vector<Vec2> directions) {
+  auto& distanceTable = getSearchState().distanceTable;
   distanceTable.clear();
   queue<Vec2> q;
   distanceTable.setDistance(from, 0);
@@ -22,6 +22,8 @@
 
 class Creature;
 class Level;
+class MovementType;
+class FlowField;
 
 class ShortestPath {
   public:
@@ -52,10 +54,18 @@ class ShortestPath {
   SERIALIZATION_DECL(ShortestPath);
 
   private:
-  void init(function<double(Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions,
-      Vec2 target, optional<Vec2> from, optional<int> limit = none);
-  void reverse(function<double(Vec2)> entryFun, function<double(Vec2, Vec2)> lengthFun, function<vector<Vec2>(Vec2)> directions, double mult, Vec2 from, int limit);
-  void constructPath(Vec2 start, function<vector<Vec2>(Vec2)> directions, bool reversed = false);
+  friend class LevelShortestPath;
+  ShortestPath(Rectangle area, Vec2 target);
+  // The search is templated on the cost, heuristic and neighbor functions, so that they can be inlined. The
+  // neighbor function is called with a position and a callback that it should call for every direction.
+  template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+  void search(EntryFun&, LengthFun&, DirectionsFun, Vec2 from, double mult);
+  template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+  void init(EntryFun&, LengthFun&, DirectionsFun&, Vec2 target, optional<Vec2> from, optional<int> limit = none);
+  template <typename EntryFun, typename LengthFun, typename DirectionsFun>
+  void reverse(EntryFun&, LengthFun&, DirectionsFun&, double mult, Vec2 from, int limit);
+  template <typename DirectionsFun>
+  void constructPath(Vec2 start, DirectionsFun&, bool reversed = false);
   vector<Vec2> SERIAL(path);
   Vec2 SERIAL(target);
   Rectangle SERIAL(bounds);
@@ -71,17 +81,34 @@ class LevelShortestPath {
   Position getTarget() const;
   bool isReversed() const;
   WLevel getLevel() const;
+  // Returns true if the movement changed in any of the level's regions that the path crosses, since it was found
+  // or last repaired.
+  bool isOutdated() const;
+  // Replaces the parts of the path around the cells that can't be entered, and the blocked cell, with local detours.
+  // Returns false if one of them has no detour nearby, or there are too many of them, in which case a new path
+  // should be found.
+  bool repair(WConstCreature, optional<Position> blocked = none);
 
   static const double infinity;
 
+  // Returns a field that uses the same neighbors and entry costs as the path search, apart from creatures.
+  static FlowField makeFlowField(WLevel, vector<Vec2> targets, const MovementType&);
+
   SERIALIZATION_DECL(LevelShortestPath);
 
   private:
   static ShortestPath makeShortestPath(WConstCreature creature, Position to, Position from, double mult);
+  static Vec2 getWaypoint(const MovementType&, Position to, Position from);
+  void updateRegions();
   ShortestPath SERIAL(path);
   WLevel SERIAL(level);
+  Vec2 SERIAL(target);
+  vector<Vec2> regions;
+  int movementCounter = 0;
 };
 
+CEREAL_CLASS_VERSION(LevelShortestPath, 1);
+
 class Dijkstra {
   public:
   Dijkstra(Rectangle bounds, vector<Vec2> from, int maxDist, function<double(Vec2)> entryFun,
@@ -94,6 +121,30 @@ class Dijkstra {
   map<Vec2, double> reachable;
 };
 
+// Distances to the nearest of a set of targets, with the same semantics as Dijkstra, but kept in a table so that
+// a single field can give the next move to any number of creatures heading for the targets.
+class FlowField {
+  public:
+  // Calls the visitor with the direction to every neighbor of a cell. The default is the eight neighbors.
+  using DirectionsFun = function<void(Vec2, function<void(Vec2)>)>;
+  FlowField(Rectangle bounds, vector<Vec2> targets, function<double(Vec2)> entryFun, DirectionsFun = nullptr);
+  double getDistance(Vec2) const;
+  // Returns the neighbors that are closer to the targets, the closest first, or nothing if the cell isn't valid.
+  vector<Vec2> getNextMoves(Vec2) const;
+  // Should be called when the cost of entering the cell changes. A path to the targets never goes through a cell
+  // that is further away than its start, so the distances below those of the cell and its neighbors stay correct.
+  void onChanged(Vec2);
+  bool isValid(Vec2) const;
+  const vector<Vec2>& getTargets() const;
+
+  private:
+  void visitNeighbors(Vec2, function<void(Vec2)>) const;
+  vector<Vec2> targets;
+  Table<double> distance;
+  DirectionsFun directions;
+  double validBelow = ShortestPath::infinity;
+};
+
 class BfSearch {
   public:
   BfSearch(Rectangle bounds, Vec2 from, function<bool(Vec2)> entryFun, vector<Vec2> directions = Vec2::directions8());
@@ -79,7 +79,11 @@ void Square::onAddedToLevel(Position pos) const {
 void Square::tick(Position pos) {
   setDirty(pos);
   if (!inventory->isEmpty()) {
+    int numItems = inventory->size();
     inventory->tick(pos);
+    // Items that burn out or get discarded are removed by the inventory itself.
+    if (inventory->size() != numItems)
+      pos.getModel()->addEvent(EventInfo::ItemsChanged{pos});
     if (!pos.canEnterEmpty(MovementType(MovementTrait::WALK).setForced()))
       for (auto neighbor : pos.neighbors8(Random))
         if (neighbor.canEnterEmpty({MovementTrait::WALK})) {
@@ -161,6 +165,7 @@ void Square::dropItemsLevelGen(vector<PItem> items) {
 
 void Square::dropItems(Position pos, vector<PItem> items) {
   setDirty(pos);
+  pos.getModel()->addEvent(EventInfo::ItemsChanged{pos});
   pos.getLevel()->addTickingSquare(pos.getCoord());
   dropItemsLevelGen(std::move(items));
 }
@@ -192,11 +197,13 @@ WItem Square::getTopItem() const {
 
 PItem Square::removeItem(Position pos, WItem it) {
   setDirty(pos);
+  pos.getModel()->addEvent(EventInfo::ItemsChanged{pos});
   return getInventory().removeItem(it);
 }
 
 vector<PItem> Square::removeItems(Position pos, vector<WItem> it) {
   setDirty(pos);
+  pos.getModel()->addEvent(EventInfo::ItemsChanged{pos});
   return getInventory().removeItems(it);
 }
 
@@ -1476,6 +1476,24 @@ class DropItems : public Task {
     pickedUpCreature = c;
   }
 
+  // The creatures heading for a storage share a flow field, which leads to the closest square of the storage, so
+  // the items are dropped on any of them.
+  bool isDestination(Position pos) const {
+    return pos == target || positions.visit(
+        [&](const vector<Position>&) { return false; },
+        [&](const StorageInfo& info) { return info.collective->getStoragePositions(info.storage).contains(pos); }
+    );
+  }
+
+  CreatureAction moveToTarget(WCreature c) const {
+    return positions.visit(
+        [&](const vector<Position>&) { return c->moveTowards(*target); },
+        [&](const StorageInfo& info) {
+          return c->moveTowards(*target, info.collective->getStoragePositions(info.storage));
+        }
+    );
+  }
+
   virtual optional<StorageId> getStorageId(bool) const override {
     if (auto info = positions.getReferenceMaybe<StorageInfo>())
       return info->storage;
@@ -1491,7 +1509,7 @@ class DropItems : public Task {
           [this] (WCreature) {
             setDone();
           });
-    if (c->getPosition() == target) {
+    if (isDestination(c->getPosition())) {
       vector<WItem> myItems = c->getEquipment().getItems().filter(items.containsPredicate());
       if (auto action = c->drop(myItems).append([=] (WCreature) { setDone(); }))
         return {1.0, action.append([=](WCreature) {setDone();})};
@@ -1504,7 +1522,7 @@ class DropItems : public Task {
         if (WCreature other = target->getCreature())
           if (other->isAffected(LastingEffect::SLEEP))
             other->removeEffect(LastingEffect::SLEEP);
-      return c->moveTowards(*target);
+      return moveToTarget(c);
     }
   }
 
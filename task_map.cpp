@@ -3,8 +3,20 @@
 #include "creature.h"
 #include "task.h"
 #include "creature_name.h"
+#include "level.h"
 
-SERIALIZE_DEF(TaskMap, tasks, positionMap, reversePositions, taskByCreature, creatureByTask, marked, completionCost, priorityTasks, delayedTasks, highlight, taskById, taskByActivity, activityByTask);
+template <class Archive>
+void TaskMap::serialize(Archive& ar, const unsigned int) {
+  ar(tasks, positionMap, reversePositions, taskByCreature, creatureByTask, marked, completionCost, priorityTasks, delayedTasks, highlight, taskById, taskByActivity, activityByTask);
+  if (Archive::is_loading::value)
+    for (auto activity : ENUM_ALL(MinionActivity))
+      for (int i : All(taskByActivity[activity])) {
+        indexInActivity.set(taskByActivity[activity][i], i);
+        addToIndex(taskByActivity[activity][i], activity);
+      }
+}
+
+SERIALIZABLE(TaskMap);
 
 SERIALIZATION_CONSTRUCTOR_IMPL(TaskMap);
 
@@ -14,54 +26,116 @@ void TaskMap::clearFinishedTasks() {
       removeTask(t);
 }
 
-WTask TaskMap::getClosestTask(WConstCreature c, MinionActivity activity, bool priorityOnly) const {
-  PROFILE;
+static int getDistanceToBucket(Vec2 pos, Vec2 bucket, int bucketSize) {
+  Vec2 topLeft = bucket * bucketSize;
+  return max({0, topLeft.x - pos.x, pos.x - topLeft.x - bucketSize + 1, topLeft.y - pos.y,
+      pos.y - topLeft.y - bucketSize + 1});
+}
+
+WTask TaskMap::getClosestTask(WConstCreature c, const TaskBuckets& buckets, optional<StorageId> storageDropTask) const {
+  Position position = c->getPosition();
   WTask closest = nullptr;
-  auto isBetter = [&](WTask task, double dist) {
-    PROFILE_BLOCK("isBetter");
-    if (!closest)
-      return true;
-    bool pTask = isPriorityTask(task);
-    bool pClosest = isPriorityTask(closest);
-    if (pTask && !pClosest)
-      return true;
-    if (!pTask && pClosest)
-      return false;
-    return dist < getPosition(closest)->dist8(c->getPosition());
+  int closestDist = 0;
+  int closestIndex = 0;
+  auto check = [&](WTask task) {
+    Position pos = positionMap.getOrFail(task);
+    int dist = pos.dist8(position);
+    int index = indexInActivity.getOrFail(task);
+    if (closest && (dist > closestDist || (dist == closestDist && index > closestIndex)))
+      return;
+    PROFILE_BLOCK("Task check");
+    if (!task->canPerform(c) || (storageDropTask && storageDropTask != task->getStorageId(false)))
+      return;
+    WConstCreature owner = getOwner(task);
+    auto delayed = delayedTasks.getMaybe(task);
+    if (!task->isDone() &&
+        (!owner || (task->canTransfer() && pos.dist8(owner->getPosition()) > dist && dist <= 6)) &&
+        c->canNavigateTo(pos) &&
+        (!delayed || *delayed < c->getLocalTime())) {
+      closest = task;
+      closestDist = dist;
+      closestIndex = index;
+    }
   };
-  optional<StorageId> storageDropTask;
-  for (auto& task : taskByActivity[activity])
-    if (auto id = task->getStorageId(true))
-      if (task->canPerform(c)) {
-        storageDropTask = *id;
+  LevelId levelId = position.getLevel()->getUniqueId();
+  auto levelBuckets = buckets.find(levelId);
+  if (levelBuckets != buckets.end()) {
+    vector<pair<int, Vec2>> order;
+    for (auto& bucket : levelBuckets->second)
+      order.push_back({getDistanceToBucket(position.getCoord(), bucket.first, bucketSize), bucket.first});
+    sort(order.begin(), order.end());
+    for (auto& elem : order) {
+      if (closest && elem.first > closestDist)
         break;
-      }
-  for (auto& task : taskByActivity[activity])
-    if (task->canPerform(c) && (!priorityOnly || isPriorityTask(task)) &&
-        (!storageDropTask || storageDropTask == task->getStorageId(false)))
-      if (auto pos = getPosition(task)) {
-        PROFILE_BLOCK("Task check");
-        double dist = pos->dist8(c->getPosition());
-        WConstCreature owner = getOwner(task);
-        auto delayed = delayedTasks.getMaybe(task);
-        if (!task->isDone() &&
-            (!owner || (task->canTransfer() && pos->dist8(owner->getPosition()) > dist && dist <= 6)) &&
-            isBetter(task, dist) &&
-            c->canNavigateTo(*pos) &&
-            (!delayed || *delayed < c->getLocalTime())) {
-          closest = task;
-        }
-      }
+      for (WTask task : levelBuckets->second.at(elem.second))
+        check(task);
+    }
+  }
+  // Tasks on other levels are all equally far, so they're only considered if nothing was found on this level.
+  if (!closest)
+    for (auto& level : buckets)
+      if (level.first != levelId)
+        for (auto& bucket : level.second)
+          for (WTask task : bucket.second)
+            check(task);
   return closest;
 }
 
+WTask TaskMap::getClosestTask(WConstCreature c, MinionActivity activity, bool priorityOnly) const {
+  PROFILE;
+  auto& index = activityIndex[activity];
+  optional<StorageId> storageDropTask;
+  int storageDropIndex = 0;
+  for (auto& task : index.storageDropTasks) {
+    int taskIndex = indexInActivity.getOrFail(task);
+    if ((!storageDropTask || taskIndex < storageDropIndex) && task->canPerform(c)) {
+      storageDropTask = *task->getStorageId(true);
+      storageDropIndex = taskIndex;
+    }
+  }
+  if (auto task = getClosestTask(c, index.buckets[true], storageDropTask))
+    return task;
+  if (!priorityOnly)
+    return getClosestTask(c, index.buckets[false], storageDropTask);
+  return nullptr;
+}
+
+void TaskMap::addToIndex(WTask task, MinionActivity activity) {
+  auto& index = activityIndex[activity];
+  Position pos = positionMap.getOrFail(task);
+  index.buckets[isPriorityTask(task)][pos.getLevel()->getUniqueId()][pos.getCoord() / bucketSize].push_back(task);
+  // Only tasks that drop items in a storage have a drop storage id, and it doesn't change.
+  if (task->getStorageId(true))
+    index.storageDropTasks.push_back(task);
+}
+
+void TaskMap::removeFromIndex(WTask task, MinionActivity activity) {
+  auto& index = activityIndex[activity];
+  Position pos = positionMap.getOrFail(task);
+  auto& levelBuckets = index.buckets[isPriorityTask(task)][pos.getLevel()->getUniqueId()];
+  Vec2 bucket = pos.getCoord() / bucketSize;
+  auto& tasks = levelBuckets.at(bucket);
+  tasks.removeElement(task);
+  if (tasks.empty())
+    levelBuckets.erase(bucket);
+  if (index.storageDropTasks.contains(task))
+    index.storageDropTasks.removeElement(task);
+}
+
 vector<WConstTask> TaskMap::getAllTasks() const {
   return tasks.transform([] (const PTask& t) -> WConstTask { return t.get(); });
 }
 
 void TaskMap::setPriorityTasks(Position pos) {
   for (WTask t : getTasks(pos))
-    priorityTasks.insert(t);
+    if (!isPriorityTask(t)) {
+      auto activity = activityByTask.getMaybe(t);
+      if (activity)
+        removeFromIndex(t, *activity);
+      priorityTasks.insert(t);
+      if (activity)
+        addToIndex(t, *activity);
+    }
   pos.setNeedsRenderUpdate(true);
 }
 
@@ -88,16 +162,22 @@ CostInfo TaskMap::removeTask(WTask task) {
     creatureByTask.erase(task);
   }
   CHECK(taskByCreature.getSize() == creatureByTask.getSize());
+  if (auto activity = activityByTask.getMaybe(task)) {
+    removeFromIndex(task, *activity);
+    activityByTask.erase(task);
+    auto& activityTasks = taskByActivity[*activity];
+    int index = indexInActivity.getOrFail(task);
+    indexInActivity.erase(task);
+    activityTasks.removeIndex(index);
+    if (index < activityTasks.size())
+      indexInActivity.set(activityTasks[index], index);
+  }
   if (auto pos = positionMap.getMaybe(task)) {
     CHECK(reversePositions.contains(*pos)) << "Task position not found: " <<
         task->getDescription() << " " << pos->getCoord();
     reversePositions.getOrFail(*pos).removeElement(task);
     positionMap.erase(task);
   }
-  if (auto activity = activityByTask.getMaybe(task)) {
-    activityByTask.erase(task);
-    taskByActivity[*activity].removeElement(task);
-  }
   for (int i : All(tasks))
     if (tasks[i].get() == task) {
       taskById.erase(task);
@@ -188,8 +268,10 @@ WTask TaskMap::addTaskFor(PTask task, WCreature c) {
 WTask TaskMap::addTask(PTask task, Position position, MinionActivity activity) {
   setPosition(task.get(), position);
   taskById.set(task.get(), task.get());
+  indexInActivity.set(task.get(), taskByActivity[activity].size());
   taskByActivity[activity].push_back(task.get());
   activityByTask.set(task.get(), activity);
+  addToIndex(task.get(), activity);
   tasks.push_back(std::move(task));
   return tasks.back().get();
 }
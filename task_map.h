@@ -57,5 +57,19 @@ class TaskMap {
   EntitySet<Task> SERIAL(priorityTasks);
   EnumMap<MinionActivity, vector<WTask>> SERIAL(taskByActivity);
   EntityMap<Task, MinionActivity> SERIAL(activityByTask);
+  // The tasks of every activity are also bucketed by level and area, separately for priority and other tasks, so
+  // that getClosestTask() can look at the closest ones first. These aren't saved and are rebuilt on load.
+  using TaskBuckets = map<LevelId, unordered_map<Vec2, vector<WTask>, CustomHash<Vec2>>>;
+  struct ActivityIndex {
+    TaskBuckets buckets[2];
+    vector<WTask> storageDropTasks;
+  };
+  EnumMap<MinionActivity, ActivityIndex> activityIndex;
+  // The index of every task in taskByActivity, which breaks ties between equally close tasks.
+  EntityMap<Task, int> indexInActivity;
+  void addToIndex(WTask, MinionActivity);
+  void removeFromIndex(WTask, MinionActivity);
+  WTask getClosestTask(WConstCreature, const TaskBuckets&, optional<StorageId> storageDropTask) const;
+  const static int bucketSize = 10;
 };
 
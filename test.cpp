@@ -21,6 +21,7 @@
 #include "level_maker.h"
 #include "test.h"
 #include "sectors.h"
+#include "cluster_graph.h"
 #include "minion_equipment.h"
 #include "item_factory.h"
 #include "item_type.h"
@@ -36,9 +37,35 @@
 #include "level_builder.h"
 #include "model.h"
 #include "position_matching.h"
+#include "position_map.h"
 #include "dungeon_level.h"
 #include "villain_type.h"
 #include "roof_support.h"
+#include "time_queue.h"
+#include "clock.h"
+#include "entity_map.h"
+#include "entity_set.h"
+#include "settlement_info.h"
+#include "movement_type.h"
+#include "furniture_factory.h"
+#include "furniture_type.h"
+#include "field_of_view.h"
+#include "vision_id.h"
+#include "lighting.h"
+#include "task_map.h"
+#include "task.h"
+#include "danger_map.h"
+#include "collective.h"
+#include "collective_builder.h"
+#include "collective_config.h"
+#include "item_index.h"
+
+struct OwnedTestObject : public OwnedObject<OwnedTestObject> {
+  OwnedTestObject(int a = 0) : x(a) {}
+  int x;
+  WeakPointer<OwnedTestObject> other;
+  SERIALIZE_ALL(SUBCLASS(OwnedObject<OwnedTestObject>), x, other)
+};
 
 class Test {
   public:
@@ -71,6 +98,58 @@ class Test {
     CHECK(q.getNextCreature() == ra);*/
   }
 
+  void testTimeQueueOrder() {
+    PCreature a = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+    PCreature b = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+    PCreature c = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+    WCreature ra = a.get(), rb = b.get(), rc = c.get();
+    TimeQueue q;
+    q.addCreature(std::move(a), 1_local);
+    q.addCreature(std::move(b), 1_local);
+    q.addCreature(std::move(c), 2_local);
+    CHECK(q.getNextCreature(0) == nullptr);
+    CHECK(q.getNextCreature(100) == ra);
+    CHECK(q.willMoveThisTurn(rb));
+    CHECK(!q.willMoveThisTurn(rc));
+    CHECK(q.compareOrder(ra, rb));
+    q.increaseTime(ra, 2_visible);
+    CHECK(q.getNextCreature(100) == rb);
+    q.moveNow(rc);
+    q.makeExtraMove(rb);
+    CHECK(q.hasExtraMove(rb));
+    CHECK(q.getNextCreature(100) == rb);
+    q.increaseTime(rb, 1_visible);
+    CHECK(q.getNextCreature(100) == rc);
+    q.postponeMove(rc);
+    CHECK(q.getNextCreature(100) == rb);
+    CHECK(q.compareOrder(rb, rc));
+    PCreature removed = q.removeCreature(rb);
+    CHECK(q.getNextCreature(100) == rc);
+    CHECKEQ(q.getAllCreatures().size(), 2);
+  }
+
+  void testTimeQueuePerformance() {
+    TimeQueue q;
+    vector<WCreature> creatures;
+    for (int i : Range(500)) {
+      PCreature c = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+      creatures.push_back(c.get());
+      q.addCreature(std::move(c), LocalTime(Random.get(10)));
+    }
+    auto startTime = Clock::getRealMicros();
+    const int numMoves = 200000;
+    for (int i : Range(numMoves)) {
+      WCreature c = q.getNextCreature(1000000000);
+      if (Random.roll(10))
+        q.makeExtraMove(c);
+      else
+        q.increaseTime(c, TimeInterval(Random.get(1, 20)));
+    }
+    auto time = Clock::getRealMicros() - startTime;
+    std::cout << "TimeQueue: " << numMoves << " moves of " << creatures.size() << " creatures in "
+        << time.count() / 1000 << "ms\n";
+  }
+
   void testRectangleIterator() {
     vector<Vec2> v1, v2;
     for (Vec2 v : Rectangle(10, 10)) {
@@ -496,6 +575,22 @@ class Test {
     INFO << s.getNumSectors() << " sectors";
   }
 
+  void testSectorsSplitInThree() {
+    Rectangle bounds(20, 20);
+    Sectors s(bounds, Table<optional<Vec2>>(bounds));
+    for (Vec2 v : Rectangle(8, 8))
+      s.add(v);
+    for (Vec2 v : {Vec2(8, 8), Vec2(8, 9), Vec2(9, 7)})
+      s.add(v);
+    CHECKEQ(s.getNumSectors(), 1);
+    s.remove(Vec2(8, 8));
+    CHECKEQ(s.getNumSectors(), 3);
+    CHECK(!s.same(Vec2(9, 7), Vec2(7, 7)));
+    CHECK(!s.same(Vec2(8, 9), Vec2(7, 7)));
+    CHECK(!s.same(Vec2(8, 9), Vec2(9, 7)));
+    CHECK(s.same(Vec2(0, 0), Vec2(7, 7)));
+  }
+
   void testSectorsWithPortals() {
     Sectors s(Rectangle(7, 7), Table<optional<Vec2>>(7, 7));
     s.add(Vec2(2, 1));
@@ -531,6 +626,750 @@ class Test {
     CHECK(!s.same(Vec2(0, 0), Vec2(5, 5)));
   }
 
+  void testSectorsRandom() {
+    Rectangle bounds(70, 70);
+    Sectors s(bounds, Table<optional<Vec2>>(bounds));
+    Table<bool> t(bounds, false);
+    Table<optional<Vec2>> connections(bounds);
+    auto getComponents = [&](optional<Vec2> without) {
+      Table<int> ret(bounds, -1);
+      int cnt = 0;
+      for (Vec2 start : bounds)
+        if (t[start] && ret[start] == -1 && start != without) {
+          queue<Vec2> q;
+          q.push(start);
+          ret[start] = cnt;
+          while (!q.empty()) {
+            Vec2 pos = q.front();
+            q.pop();
+            vector<Vec2> neighbors = pos.neighbors8();
+            if (connections[pos])
+              neighbors.push_back(*connections[pos]);
+            for (Vec2 v : neighbors)
+              if (v.inRectangle(bounds) && t[v] && ret[v] == -1 && v != without) {
+                ret[v] = cnt;
+                q.push(v);
+              }
+          }
+          ++cnt;
+        }
+      return make_pair(ret, cnt);
+    };
+    for (Vec2 v : bounds)
+      if (Random.roll(2)) {
+        s.add(v);
+        t[v] = true;
+      }
+    for (int i : Range(20000)) {
+      Vec2 v = bounds.randomVec2();
+      Vec2 w = bounds.randomVec2();
+      if (Random.roll(40)) {
+        if (!connections[v] && !connections[w] && v != w) {
+          s.addExtraConnection(v, w);
+          connections[v] = w;
+          connections[w] = v;
+        }
+      } else if (Random.roll(40)) {
+        if (auto other = connections[v]) {
+          s.removeExtraConnection(v, *other);
+          connections[v] = connections[*other] = none;
+        }
+      } else if (Random.roll(2)) {
+        CHECK(s.remove(v) == t[v]);
+        t[v] = false;
+      } else {
+        CHECK(s.add(v) == !t[v]);
+        t[v] = true;
+      }
+      if (i % 200 == 0) {
+        auto components = getComponents(none);
+        CHECK(s.getNumSectors() == components.second);
+        for (Vec2 pos : bounds)
+          CHECK(s.same(pos, w) == (t[pos] && t[w] && components.first[pos] == components.first[w]));
+        auto without = getComponents(v).first;
+        vector<Vec2> neighbors = v.neighbors8();
+        if (connections[v])
+          neighbors.push_back(*connections[v]);
+        neighbors = neighbors.filter([&](Vec2 n) { return n.inRectangle(bounds) && t[n]; });
+        bool chokePoint = false;
+        for (Vec2 n : neighbors)
+          if (without[n] != without[neighbors[0]])
+            chokePoint = true;
+        CHECK(s.isChokePoint(v) == chokePoint);
+      }
+    }
+  }
+
+  void testSectorsSerialization() {
+    Rectangle bounds(50, 40);
+    Sectors s(bounds, Table<optional<Vec2>>(bounds));
+    for (Vec2 v : bounds)
+      if (Random.roll(2))
+        s.add(v);
+    s.add(Vec2(1, 1));
+    s.add(Vec2(45, 35));
+    s.addExtraConnection(Vec2(1, 1), Vec2(45, 35));
+    StreamCombiner<ostringstream, OutputArchive> output;
+    output.getArchive() << s;
+    StreamCombiner<istringstream, InputArchive> input(output.getStream().str());
+    Sectors loaded;
+    input.getArchive() >> loaded;
+    CHECK(loaded.getNumSectors() == s.getNumSectors());
+    CHECK(loaded.getExtraConnections()[Vec2(1, 1)] == Vec2(45, 35));
+    for (int i : Range(2000)) {
+      Vec2 v = bounds.randomVec2();
+      if (Random.roll(2)) {
+        s.remove(v);
+        loaded.remove(v);
+      } else {
+        s.add(v);
+        loaded.add(v);
+      }
+      Vec2 w = bounds.randomVec2();
+      CHECK(loaded.contains(w) == s.contains(w));
+      CHECK(loaded.same(v, w) == s.same(v, w));
+    }
+    CHECK(loaded.getNumSectors() == s.getNumSectors());
+  }
+
+  void testShortestPathHierarchical() {
+    Rectangle bounds(128, 128);
+    Table<bool> passable(bounds, true);
+    for (int i : Range(60)) {
+      Vec2 corner = bounds.randomVec2();
+      for (Vec2 v : Rectangle(corner, corner + Vec2(Random.get(2, 9), Random.get(2, 9))).intersection(bounds))
+        passable[v] = false;
+    }
+    for (int i : Range(1500))
+      passable[bounds.randomVec2()] = false;
+    Sectors sectors(bounds, Table<optional<Vec2>>(bounds));
+    for (Vec2 v : bounds)
+      if (passable[v])
+        sectors.add(v);
+    passable[Vec2(3, 3)] = passable[Vec2(120, 120)] = true;
+    sectors.add(Vec2(3, 3));
+    sectors.add(Vec2(120, 120));
+    sectors.addExtraConnection(Vec2(3, 3), Vec2(120, 120));
+    // Some cells are more expensive to enter, like doors that have to be destroyed.
+    Table<double> cost(bounds, 1);
+    for (int i : Range(500))
+      cost[bounds.randomVec2()] = 5;
+    auto costFun = [&cost](Vec2 v) { return cost[v]; };
+    auto getDistances = [&](Vec2 from) {
+      Table<double> ret(bounds, -1);
+      using QueueElem = pair<double, Vec2>;
+      priority_queue<QueueElem, vector<QueueElem>, std::greater<QueueElem>> q;
+      ret[from] = 0;
+      q.push({0, from});
+      while (!q.empty()) {
+        auto elem = q.top();
+        q.pop();
+        Vec2 pos = elem.second;
+        if (elem.first > ret[pos])
+          continue;
+        auto visit = [&](Vec2 v) {
+          if (v.inRectangle(bounds) && passable[v] && (ret[v] < 0 || ret[v] > ret[pos] + cost[v])) {
+            ret[v] = ret[pos] + cost[v];
+            q.push({ret[v], v});
+          }
+        };
+        for (Vec2 v : pos.neighbors8())
+          visit(v);
+        if (auto other = sectors.getExtraConnections()[pos])
+          visit(*other);
+      }
+      return ret;
+    };
+    const double maxDetour = 1.5;
+    ClusterGraph graph(bounds, maxDetour);
+    double totalLength = 0;
+    double totalDistance = 0;
+    int numRoutes = 0;
+    int numRejected = 0;
+    for (int i : Range(150)) {
+      // Change a few cells every round to exercise the incremental updates.
+      for (int j : Range(3)) {
+        Vec2 v = bounds.randomVec2();
+        passable[v] = !passable[v];
+        if (passable[v])
+          sectors.add(v);
+        else
+          sectors.remove(v);
+        graph.invalidate(v);
+      }
+      Vec2 from = bounds.randomVec2();
+      Vec2 to = bounds.randomVec2();
+      if (!passable[from] || !passable[to] || from == to)
+        continue;
+      auto fromDistances = getDistances(from);
+      // The exact distance is the best possible lower bound, so only routes that are too expensive are rejected.
+      auto route = graph.findRoute(sectors, costFun, from, to, fromDistances[to]);
+      CHECK(!route || fromDistances[to] > -1);
+      if (fromDistances[to] > -1)
+        ++numRoutes;
+      if (!route) {
+        if (fromDistances[to] > -1)
+          ++numRejected;
+        continue;
+      }
+      CHECK(route->back() == to);
+      // Refining every section of the route exactly shouldn't cost much more than the exact path.
+      double length = 0;
+      Vec2 previous = from;
+      for (Vec2 waypoint : *route) {
+        double distance = getDistances(previous)[waypoint];
+        CHECK(distance > -1);
+        length += distance;
+        previous = waypoint;
+      }
+      CHECK(length <= maxDetour * fromDistances[to]) << length << " " << fromDistances[to];
+      totalLength += length;
+      totalDistance += fromDistances[to];
+    }
+    CHECK(totalLength <= 1.1 * totalDistance) << totalLength << " " << totalDistance;
+    CHECK(numRejected * 10 <= numRoutes) << numRejected << " " << numRoutes;
+  }
+
+  void testShortestPathHierarchicalDetour() {
+    // A wall with a gap at the bottom, so the cheapest path between its two sides is much longer than the straight
+    // distance.
+    Rectangle bounds(64, 64);
+    Sectors sectors(bounds, Table<optional<Vec2>>(bounds));
+    for (Vec2 v : bounds)
+      if (v.x != 32 || v.y >= 60)
+        sectors.add(v);
+    auto costFun = [](Vec2) { return 1.0; };
+    Vec2 from(28, 4);
+    Vec2 to(36, 4);
+    // The exact path costs 112.
+    ClusterGraph graph(bounds, 2);
+    CHECK(!graph.findRoute(sectors, costFun, from, to, from.dist8(to)));
+    CHECK(!graph.findRoute(sectors, costFun, from, to, 50));
+    auto route = graph.findRoute(sectors, costFun, from, to, 70);
+    CHECK(!!route);
+    CHECK(route->back() == to);
+    ClusterGraph lenientGraph(bounds, 20);
+    CHECK(!!lenientGraph.findRoute(sectors, costFun, from, to, from.dist8(to)));
+  }
+
+  void testFlowField() {
+    Rectangle bounds(40, 40);
+    Table<double> cost(bounds, 1);
+    for (int i : Range(300))
+      cost[bounds.randomVec2()] = Random.roll(2) ? ShortestPath::infinity : 5;
+    vector<Vec2> targets {Vec2(3, 3), Vec2(30, 20)};
+    for (Vec2 v : targets)
+      cost[v] = 1;
+    auto entryFun = [&cost](Vec2 v) { return cost[v]; };
+    FlowField field(bounds, targets, entryFun);
+    Dijkstra dijkstra(bounds, targets, 100000, entryFun);
+    for (Vec2 v : bounds)
+      if (dijkstra.isReachable(v)) {
+        CHECKEQ(field.getDistance(v), dijkstra.getDist(v));
+        if (field.getDistance(v) > 0) {
+          auto moves = field.getNextMoves(v);
+          CHECK(!moves.empty());
+          CHECKEQ(field.getDistance(v), field.getDistance(moves[0]) + cost[v]);
+        }
+      } else
+        CHECK(field.getNextMoves(v).empty() || cost[v] == ShortestPath::infinity);
+    // Two cells connected like portals.
+    Vec2 portal1(10, 30);
+    Vec2 portal2(35, 35);
+    cost[portal1] = cost[portal2] = 1;
+    auto directions = [&](Vec2 v, function<void(Vec2)> visit) {
+      for (Vec2 dir : Vec2::directions8())
+        visit(dir);
+      if (v == portal1)
+        visit(portal2 - v);
+      if (v == portal2)
+        visit(portal1 - v);
+    };
+    FlowField withPortals(bounds, targets, entryFun, directions);
+    CHECKEQ(withPortals.getDistance(portal1), withPortals.getDistance(portal2) + 1);
+    // After some cells change, the distances that are still valid should be the same as in a new field.
+    for (int i : Range(30)) {
+      Vec2 changed = bounds.randomVec2();
+      if (targets.contains(changed))
+        continue;
+      cost[changed] = vector<double>{1, 5, ShortestPath::infinity}[Random.get(3)];
+      withPortals.onChanged(changed);
+      FlowField fresh(bounds, targets, entryFun, directions);
+      for (Vec2 v : bounds)
+        if (withPortals.isValid(v)) {
+          CHECKEQ(withPortals.getDistance(v), fresh.getDistance(v));
+          CHECKEQ(withPortals.getNextMoves(v), fresh.getNextMoves(v));
+        }
+    }
+    CHECK(withPortals.isValid(targets[0]));
+  }
+
+  void testGeometryPerformance() {
+    Rectangle bounds(200, 200);
+    Table<double> cost(bounds, 1);
+    for (int i : Range(4000))
+      cost[bounds.randomVec2()] = ShortestPath::infinity;
+    auto startTime = Clock::getRealMicros();
+    const int numPaths = 100;
+    for (int i : Range(numPaths)) {
+      Vec2 from = bounds.randomVec2();
+      Vec2 to = bounds.randomVec2();
+      cost[from] = cost[to] = 1;
+      ShortestPath path(bounds,
+          [&cost](Vec2 pos) { return cost[pos]; },
+          [] (Vec2 from, Vec2 to) { return from.dist8(to); },
+          Vec2::directions8(), to, from);
+    }
+    auto pathTime = Clock::getRealMicros() - startTime;
+    startTime = Clock::getRealMicros();
+    Sectors sectors(bounds, Table<optional<Vec2>>(bounds));
+    for (Vec2 v : bounds)
+      if (cost[v] == 1)
+        sectors.add(v);
+    const int numChanges = 100000;
+    for (int i : Range(numChanges)) {
+      Vec2 v = bounds.randomVec2();
+      if (Random.roll(3))
+        sectors.remove(v);
+      else
+        sectors.add(v);
+    }
+    auto sectorsTime = Clock::getRealMicros() - startTime;
+    std::cout << "ShortestPath: " << numPaths << " paths on " << bounds.width() << "x" << bounds.height()
+        << " in " << pathTime.count() / 1000 << "ms\n";
+    std::cout << "Sectors: " << numChanges << " changes in " << sectorsTime.count() / 1000 << "ms\n";
+  }
+
+  // A generated top level, which needs its model to stay alive.
+  struct TestLevel {
+    PModel model;
+    PLevel level;
+  };
+
+  TestLevel makeTestLevel(int width, BiomeId biome) {
+    PModel model = Model::create();
+    LevelBuilder builder(nullptr, Random, width, width, "", false, none);
+    PLevelMaker levelMaker = LevelMaker::topLevel(Random, none, {}, width, none, biome);
+    PLevel level = builder.build(model.get(), levelMaker.get(), 1234);
+    return TestLevel{std::move(model), std::move(level)};
+  }
+
+  void testShortestPathPerformance() {
+    for (auto biome : {BiomeId::GRASSLAND, BiomeId::MOUNTAIN}) {
+      auto testLevel = makeTestLevel(150, biome);
+      auto& level = testLevel.level;
+      PCreature creature = CreatureFactory::fromId(CreatureId::GOBLIN, TribeId::getMonster());
+      auto movementType = creature->getMovementType();
+      vector<Position> positions;
+      for (Vec2 v : level->getBounds()) {
+        Position pos(v, level.get());
+        if (pos.canEnterEmpty(movementType))
+          positions.push_back(pos);
+      }
+      // The second run goes through two pairs of portals.
+      for (int numPortals : {0, 4}) {
+        for (int i : Range(numPortals)) {
+          Position pos = Random.choose(positions);
+          if (!pos.getFurniture(FurnitureLayer::MIDDLE)) {
+            pos.addFurniture(FurnitureFactory::get(FurnitureType::PORTAL, TribeId::getMonster()));
+            pos.registerPortal();
+          }
+        }
+        const int numPaths = 100;
+        auto startTime = Clock::getRealMicros();
+        for (int i : Range(numPaths))
+          LevelShortestPath(creature.get(), Random.choose(positions), Random.choose(positions));
+        auto pathTime = Clock::getRealMicros() - startTime;
+        startTime = Clock::getRealMicros();
+        for (int i : Range(numPaths))
+          LevelShortestPath(creature.get(), Random.choose(positions), Random.choose(positions), -1.5);
+        auto fleeTime = Clock::getRealMicros() - startTime;
+        std::cout << "LevelShortestPath on " << EnumInfo<BiomeId>::getString(biome) << " with " << numPortals
+            << " portals: " << numPaths << " paths in " << pathTime.count() / 1000 << "ms, " << numPaths
+            << " flee paths in " << fleeTime.count() / 1000 << "ms\n";
+      }
+    }
+  }
+
+  void testPathRepair() {
+    auto testLevel = makeTestLevel(60, BiomeId::GRASSLAND);
+    auto& level = testLevel.level;
+    PCreature creature = CreatureFactory::fromId(CreatureId::GOBLIN, TribeId::getMonster());
+    auto movementType = creature->getMovementType();
+    auto getCells = [](LevelShortestPath path, Position from) {
+      vector<Position> ret {from};
+      while (ret.back() != path.getTarget()) {
+        CHECK(path.isReachable(ret.back()));
+        ret.push_back(path.getNextMove(ret.back()));
+      }
+      return ret;
+    };
+    int numRepaired = 0;
+    for (int i : Range(30)) {
+      Position from(level->getBounds().randomVec2(), level.get());
+      Position to(level->getBounds().randomVec2(), level.get());
+      if (!from.canEnterEmpty(movementType) || !to.canEnterEmpty(movementType) || from.dist8(to) < 10 ||
+          from.dist8(to) > 40 || !level->areConnected(from.getCoord(), to.getCoord(), movementType))
+        continue;
+      LevelShortestPath path(creature.get(), to, from);
+      auto cells = getCells(path, from);
+      // Two cells far apart, so that they need separate detours.
+      vector<Position> blocked {cells[cells.size() / 3], cells[2 * cells.size() / 3]};
+      if (blocked[0].getFurniture(FurnitureLayer::MIDDLE) || blocked[1].getFurniture(FurnitureLayer::MIDDLE))
+        continue;
+      CHECK(!path.isOutdated());
+      for (auto pos : blocked) {
+        pos.addFurniture(FurnitureFactory::get(FurnitureType::MOUNTAIN, TribeId::getMonster()));
+        CHECK(!pos.getNavigationCost(movementType));
+      }
+      CHECK(path.isOutdated());
+      if (path.repair(creature.get())) {
+        ++numRepaired;
+        CHECK(!path.isOutdated());
+        auto newCells = getCells(path, from);
+        for (auto pos : blocked)
+          CHECK(!newCells.contains(pos));
+      }
+    }
+    CHECK(numRepaired > 0);
+  }
+
+  // The shadowcasting that FieldOfView used before it kept the visible cells in bits.
+  static void calculateReferenceFOV(int left, int right, int up, int h, int x1, int y1, int x2, int y2,
+      function<bool (int, int)> isBlocking, function<void (int, int)> setVisible){
+    if (y2*x1>=y1*x2) return;
+    if (h>up) return;
+    int leftx=x1, lefty=y1, rightx=x2, righty=y2;
+    int left_v=(int)floor((double)x1/y1*(h)),
+        right_v=(int)ceil((double)x2/y2*(h)),
+        left_b=(int)floor((double)x1/y1*(h-1)),
+        right_b=(int)ceil((double)x2/y2*(h+1));
+    if (left_v % 2)
+      ++left_v;
+    if (right_v % 2)
+      --right_v;
+    if(left_b % 2)
+      ++left_b;
+    if(right_b % 2)
+      --right_b;
+    if(left_b>=-left && left_b<=right && isBlocking(left_b/2,h/2)){
+      leftx=left_b+1;
+      lefty=h+(left_b>=0?-1:1);
+    }
+    if(left_v<-left) left_v=-left;
+    if(right_v>right) right_v=right;
+    bool prevBlocking = false;
+    for (int i=left_v/2;i<=right_v/2;++i){
+      setVisible(i, h / 2);
+      bool blocking = isBlocking(i, h / 2);
+      if(i > left_v / 2 && blocking && !prevBlocking)
+        calculateReferenceFOV(left, right, up, h + 2, leftx, lefty, i * 2 - 1, h + (i<=0 ? -1:1), isBlocking,
+            setVisible);
+      if(blocking){
+        leftx=i*2+1;
+        lefty=h+(i>=0?-1:1);
+      }
+      prevBlocking = blocking;
+    }
+    calculateReferenceFOV(left, right, up, h + 2, leftx, lefty, rightx, righty, isBlocking, setVisible);
+  }
+
+  vector<Vec2> getReferenceFOV(Rectangle bounds, const Table<bool>& blocking, Vec2 pos) {
+    const int range = FieldOfView::sightRange;
+    Table<bool> visible(Rectangle::centered(pos, range), false);
+    vector<Vec2> ret;
+    auto setVisible = [&](int x, int y) {
+      Vec2 v = pos + Vec2(x, y);
+      if (v.inRectangle(bounds) && !visible[v] && x * x + y * y <= range * range) {
+        visible[v] = true;
+        ret.push_back(v);
+      }
+    };
+    calculateReferenceFOV(2 * range, 2 * range, 2 * range, 2, -1, 1, 1, 1,
+        [&](int x, int y) { return blocking[pos + Vec2(x, y)]; },
+        [&](int x, int y) { setVisible(x, y); });
+    calculateReferenceFOV(2 * range, 2 * range, 2 * range, 2, -1, 1, 1, 1,
+        [&](int x, int y) { return blocking[pos + Vec2(y, -x)]; },
+        [&](int x, int y) { setVisible(y, -x); });
+    calculateReferenceFOV(2 * range, 2 * range, 2 * range, 2, -1, 1, 1, 1,
+        [&](int x, int y) { return blocking[pos + Vec2(-x, -y)]; },
+        [&](int x, int y) { setVisible(-x, -y); });
+    calculateReferenceFOV(2 * range, 2 * range, 2 * range, 2, -1, 1, 1, 1,
+        [&](int x, int y) { return blocking[pos + Vec2(-y, x)]; },
+        [&](int x, int y) { setVisible(-y, x); });
+    setVisible(0, 0);
+    return ret;
+  }
+
+  void testFieldOfView() {
+    auto testLevel = makeTestLevel(70, BiomeId::MOUNTAIN);
+    auto& level = testLevel.level;
+    Table<bool> blocking(level->getBounds().minusMargin(-1));
+    auto updateBlocking = [&](Vec2 v) {
+      blocking[v] = !Position(v, level.get()).canSeeThru(VisionId::NORMAL);
+    };
+    for (Vec2 v : blocking.getBounds())
+      updateBlocking(v);
+    FieldOfView fov(level.get(), VisionId::NORMAL);
+    // A small budget, so that viewpoints are dropped and computed again.
+    fov.setCacheBudget(300000);
+    for (int i : Range(3000)) {
+      Position pos(level->getBounds().randomVec2(), level.get());
+      if (Random.roll(4) == 0) {
+        if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
+          pos.removeFurniture(f);
+        else
+          pos.addFurniture(FurnitureFactory::get(FurnitureType::MOUNTAIN, TribeId::getMonster()));
+        updateBlocking(pos.getCoord());
+        fov.squareChanged(pos.getCoord());
+      } else {
+        Vec2 from = pos.getCoord();
+        auto expected = getReferenceFOV(level->getBounds(), blocking, from);
+        CHECK(fov.getVisibleTiles(from) == expected) << from;
+        for (int j : Range(10)) {
+          Vec2 to = from + Vec2(Random.get(-35, 36), Random.get(-35, 36));
+          if (to.inRectangle(level->getBounds()))
+            CHECK(fov.canSee(from, to) == expected.contains(to)) << from << " " << to;
+        }
+      }
+      if (i % 100 == 0)
+        fov.trimCache();
+    }
+  }
+
+  void testLighting() {
+    auto testLevel = makeTestLevel(50, BiomeId::MOUNTAIN);
+    auto& level = testLevel.level;
+    Rectangle bounds = level->getBounds();
+    FieldOfView fov(level.get(), VisionId::NORMAL);
+    Lighting lighting;
+    Table<double> light(bounds, 0);
+    Table<double> lightCap(bounds, 1);
+    struct Source {
+      Vec2 pos;
+      double radius;
+      bool darkness;
+    };
+    vector<Source> sources;
+    for (int i : Range(400)) {
+      int op = Random.get(3);
+      if (op == 0 || sources.empty()) {
+        Source source {bounds.randomVec2(), Random.choose(5.5, 8.2), Random.roll(3) == 0};
+        lighting.addSource(source.pos, source.radius, source.darkness, 1);
+        sources.push_back(source);
+      } else if (op == 1) {
+        int index = Random.get(sources.size());
+        lighting.addSource(sources[index].pos, sources[index].radius, sources[index].darkness, -1);
+        sources.removeIndex(index);
+      } else {
+        Position pos(bounds.randomVec2(), level.get());
+        if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
+          pos.removeFurniture(f);
+        else
+          pos.addFurniture(FurnitureFactory::get(FurnitureType::MOUNTAIN, TribeId::getMonster()));
+        fov.squareChanged(pos.getCoord());
+        lighting.squareChanged(pos.getCoord());
+      }
+      if (Random.roll(4) == 0) {
+        Table<double> oldLight(light);
+        Table<double> oldLightCap(lightCap);
+        Table<bool> reported(bounds, false);
+        lighting.update(fov, light, lightCap, [&](Vec2 v) { reported[v] = true; });
+        FieldOfView newFov(level.get(), VisionId::NORMAL);
+        Table<double> expected(bounds, 0);
+        Table<double> expectedCap(bounds, 1);
+        for (auto& source : sources)
+          for (Vec2 v : newFov.getVisibleTiles(source.pos)) {
+            double dist = (v - source.pos).lengthD();
+            if (dist <= source.radius) {
+              if (source.darkness)
+                expectedCap[v] -= min(1.0, 1 - dist / source.radius);
+              else
+                expected[v] += min(1.0, 1 - dist / source.radius);
+            }
+          }
+        for (Vec2 v : bounds) {
+          CHECK(fabs(light[v] - expected[v]) < 0.000001) << v << " " << light[v] << " " << expected[v];
+          CHECK(fabs(lightCap[v] - expectedCap[v]) < 0.000001) << v << " " << lightCap[v] << " " << expectedCap[v];
+          if (light[v] != oldLight[v] || lightCap[v] != oldLightCap[v])
+            CHECK(reported[v]) << v;
+        }
+      }
+    }
+  }
+
+  void testCreaturesInView() {
+    auto testLevel = makeTestLevel(60, BiomeId::MOUNTAIN);
+    auto& level = testLevel.level;
+    Rectangle bounds = level->getBounds();
+    auto isFree = [&](Vec2 v) {
+      Position pos(v, level.get());
+      return v.inRectangle(bounds) && !pos.getFurniture(FurnitureLayer::MIDDLE) && !pos.getCreature();
+    };
+    vector<PCreature> creatures;
+    while (creatures.size() < 30) {
+      Vec2 v = bounds.randomVec2();
+      if (isFree(v)) {
+        creatures.push_back(CreatureFactory::fromId(CreatureId::GOBLIN, TribeId::getMonster()));
+        level->putCreature(v, creatures.back().get());
+      }
+    }
+    for (int i : Range(1000)) {
+      if (Random.roll(2)) {
+        WCreature c = creatures[Random.get(creatures.size())].get();
+        Vec2 dir = Vec2::directions8()[Random.get(8)];
+        if (isFree(c->getPosition().getCoord() + dir))
+          level->moveCreature(c, dir);
+      } else {
+        Position pos(bounds.randomVec2(), level.get());
+        if (auto f = pos.getFurniture(FurnitureLayer::MIDDLE))
+          pos.removeFurniture(f);
+        else if (!pos.getCreature())
+          pos.addFurniture(FurnitureFactory::get(FurnitureType::MOUNTAIN, TribeId::getMonster()));
+      }
+      WCreature c = creatures[Random.get(creatures.size())].get();
+      Vec2 from = c->getPosition().getCoord();
+      for (VisionId vision : ENUM_ALL(VisionId)) {
+        FieldOfView fov(level.get(), vision);
+        vector<WCreature> expected;
+        for (WCreature other : level->getAllCreatures())
+          if (fov.canSee(from, other->getPosition().getCoord()))
+            expected.push_back(other);
+        auto inView = level->getCreaturesInView(from, vision);
+        CHECKEQ(inView.size(), expected.size());
+        for (WCreature other : expected)
+          CHECK(inView.contains(other));
+      }
+    }
+  }
+
+  void testClosestTask() {
+    auto testLevel = makeTestLevel(60, BiomeId::MOUNTAIN);
+    auto& level = testLevel.level;
+    Rectangle bounds = level->getBounds();
+    vector<PCreature> creatures;
+    while (creatures.size() < 6) {
+      Position pos(bounds.randomVec2(), level.get());
+      if (!pos.getFurniture(FurnitureLayer::MIDDLE) && !pos.getCreature()) {
+        creatures.push_back(CreatureFactory::fromId(CreatureId::GOBLIN, TribeId::getMonster()));
+        level->putCreature(pos.getCoord(), creatures.back().get());
+      }
+    }
+    TaskMap taskMap;
+    vector<MinionActivity> activities {MinionActivity::DIGGING, MinionActivity::HAULING};
+    // Mirrors the order of tasks in the TaskMap, which is used to break ties.
+    EnumMap<MinionActivity, vector<WTask>> tasks;
+    auto getReferenceTask = [&](WCreature c, MinionActivity activity, bool priorityOnly) {
+      WTask closest = nullptr;
+      int closestDist = 0;
+      for (WTask task : tasks[activity]) {
+        Position pos = *taskMap.getPosition(task);
+        int dist = pos.dist8(c->getPosition());
+        WConstCreature owner = taskMap.getOwner(task);
+        bool priority = taskMap.isPriorityTask(task);
+        bool better = !closest || (priority && !taskMap.isPriorityTask(closest)) ||
+            (priority == taskMap.isPriorityTask(closest) && dist < closestDist);
+        if (better && task->canPerform(c) && (!priorityOnly || priority) && !task->isDone() &&
+            (!owner || (task->canTransfer() && pos.dist8(owner->getPosition()) > dist && dist <= 6)) &&
+            c->canNavigateTo(pos)) {
+          closest = task;
+          closestDist = dist;
+        }
+      }
+      return closest;
+    };
+    auto getRandomTask = [&] () -> WTask {
+      auto activity = Random.choose(activities);
+      if (tasks[activity].empty())
+        return nullptr;
+      return tasks[activity][Random.get(tasks[activity].size())];
+    };
+    for (int i : Range(3000)) {
+      int op = Random.get(6);
+      if (op < 2) {
+        auto activity = Random.choose(activities);
+        Position pos(bounds.randomVec2(), level.get());
+        PTask task = Random.roll(2) ? Task::construction(nullptr, pos, FurnitureType::MOUNTAIN) : Task::explore(pos);
+        tasks[activity].push_back(taskMap.addTask(std::move(task), pos, activity));
+      } else if (op == 2) {
+        if (WTask task = getRandomTask()) {
+          for (auto activity : activities)
+            if (tasks[activity].contains(task))
+              tasks[activity].removeElement(task);
+          taskMap.removeTask(task);
+        }
+      } else if (op == 3) {
+        WCreature c = creatures[Random.get(creatures.size())].get();
+        if (WTask task = getRandomTask())
+          if (!taskMap.getTask(c))
+            taskMap.takeTask(c, task);
+      } else if (op == 4) {
+        if (WTask task = getRandomTask())
+          taskMap.freeTask(task);
+      } else if (Random.roll(4)) {
+        if (WTask task = getRandomTask())
+          taskMap.setPriorityTasks(*taskMap.getPosition(task));
+      }
+      WCreature c = creatures[Random.get(creatures.size())].get();
+      for (auto activity : activities)
+        for (bool priorityOnly : {false, true})
+          CHECK(taskMap.getClosestTask(c, activity, priorityOnly) == getReferenceTask(c, activity, priorityOnly));
+    }
+  }
+
+  void testItemIndexDestroyedItem() {
+    auto testLevel = makeTestLevel(30, BiomeId::GRASSLAND);
+    auto& level = testLevel.level;
+    vector<Vec2> area;
+    for (Vec2 v : Rectangle(10, 10, 20, 20))
+      if (Position(v, level.get()).canEnterEmpty({MovementTrait::WALK}))
+        area.push_back(v);
+    CHECK(!area.empty());
+    auto collective = CollectiveBuilder(CollectiveConfig::noImmigrants(), TribeId::getMonster())
+        .setLevel(level.get())
+        .addArea(area)
+        .build();
+    Position pos(area[0], level.get());
+    pos.dropItems(ItemType(ItemType::WoodPlank{}).get(2));
+    pos.dropItem(ItemType(ItemType::Scroll{Effect::Teleport{}}).get());
+    CHECKEQ(collective->getNumItems(ItemIndex::WOOD), 2);
+    CHECKEQ(collective->getAllItems().size(), 3);
+    pos.fireDamage(1);
+    for (int i : Range(100))
+      level->tick();
+    CHECKEQ(pos.getItems().size(), 2);
+    CHECKEQ(collective->getNumItems(ItemIndex::WOOD), 2);
+    CHECKEQ(collective->getAllItems().size(), 2);
+  }
+
+  void testDangerMap() {
+    DangerMap danger;
+    Rectangle bounds(50, 50);
+    // A wall at x = 30 that ends at y = 40.
+    auto canEnter = [](Vec2 v) { return v.x != 30 || v.y >= 40; };
+    auto tribe = TribeId::getMonster();
+    auto other = TribeId::getHuman();
+    danger.markEnemies(tribe, bounds, canEnter, {Vec2(20, 20), Vec2(45, 45)}, 0_local, 20_local);
+    CHECK(danger.isDangerous(tribe, Vec2(20, 20), 10_local));
+    CHECK(danger.isDangerous(tribe, Vec2(30, 11), 10_local));
+    CHECK(danger.isDangerous(tribe, Vec2(49, 49), 10_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(31, 20), 10_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(20, 20), 20_local));
+    CHECK(!danger.isDangerous(other, Vec2(20, 20), 10_local));
+    danger.markEnemies(tribe, bounds, canEnter, {Vec2(25, 20)}, 10_local, 30_local);
+    CHECK(danger.isDangerous(tribe, Vec2(30, 20), 25_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(31, 20), 25_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(12, 20), 25_local));
+    CHECK(danger.isDangerous(tribe, Vec2(12, 20), 15_local));
+    danger.markEnemies(tribe, bounds, canEnter, {Vec2(25, 20)}, 10_local, 25_local);
+    CHECK(danger.isDangerous(tribe, Vec2(29, 20), 29_local));
+    // Going around the end of the wall is too long.
+    danger.markEnemies(tribe, bounds, canEnter, {Vec2(28, 36)}, 10_local, 30_local);
+    CHECK(danger.isDangerous(tribe, Vec2(31, 41), 25_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(31, 32), 25_local));
+    CHECK(!danger.isDangerous(tribe, Vec2(33, 30), 25_local));
+  }
+
   void testReverse() {
     vector<int> v1 {1, 2, 3, 4};
     vector<int> v2 {4, 3, 2, 1};
@@ -582,6 +1421,151 @@ class Test {
     CHECKEQ(numRef, 0);
   }
 
+  void testOwnerPointerDestruction() {
+    static bool checked = false;
+    checked = false;
+    struct tmp : public OwnedObject<tmp> {
+      ~tmp() {
+        CHECK(!self);
+        checked = true;
+      }
+      WeakPointer<tmp> self;
+    };
+    OwnerPointer<tmp> t = makeOwner<tmp>();
+    t->self = t.get();
+    CHECK(!!t->self);
+    t.clear();
+    CHECK(checked);
+  }
+
+  void testOwnerPointerSerialization() {
+    vector<OwnerPointer<OwnedTestObject>> objects;
+    for (int i : Range(3))
+      objects.push_back(makeOwner<OwnedTestObject>(i));
+    objects[0]->other = objects[1].get();
+    objects[1]->other = objects[0].get();
+    objects[2]->other = objects[2].get();
+    auto dead = makeOwner<OwnedTestObject>(3);
+    WeakPointer<OwnedTestObject> deadPointer = dead.get();
+    dead.clear();
+    WeakPointer<OwnedTestObject> first = objects[0].get();
+    StreamCombiner<ostringstream, OutputArchive> output;
+    output.getArchive() << deadPointer << objects << first;
+    StreamCombiner<istringstream, InputArchive> input(output.getStream().str());
+    vector<OwnerPointer<OwnedTestObject>> loaded;
+    WeakPointer<OwnedTestObject> loadedDead;
+    WeakPointer<OwnedTestObject> loadedFirst;
+    input.getArchive() >> loadedDead >> loaded >> loadedFirst;
+    CHECK(!loadedDead);
+    CHECKEQ(loaded.size(), 3);
+    for (int i : Range(3)) {
+      CHECKEQ(loaded[i]->x, i);
+      CHECK(loaded[i]->getThis() == loaded[i].get());
+    }
+    CHECK(loaded[0]->other == loaded[1].get());
+    CHECK(loaded[1]->other == loaded[0].get());
+    CHECK(loaded[2]->other == loaded[2].get());
+    CHECK(loadedFirst == loaded[0].get());
+    loaded[0].clear();
+    CHECK(!loadedFirst);
+    CHECK(!loaded[1]->other);
+    CHECK(!!loaded[2]->other);
+  }
+
+  void testOwnerPointerSlotReuse() {
+    struct Base : public OwnedObject<Base> {
+      virtual ~Base() {}
+    };
+    struct Derived : public Base {
+      Derived(int a) : x(a) {}
+      int x;
+    };
+    vector<WeakPointer<Base>> dead;
+    for (int i : Range(100)) {
+      OwnerPointer<Base> t = makeOwner<Derived>(i);
+      auto w = t.get();
+      CHECK(w == t->getThis());
+      WeakPointer<const Base> c = w;
+      CHECK(c == w);
+      auto d = w.dynamicCast<Derived>();
+      CHECK(!!d);
+      CHECKEQ(d->x, i);
+      // Objects created after these were destroyed are likely to reuse their slots.
+      for (auto& elem : dead)
+        CHECK(!elem);
+      dead.push_back(w);
+    }
+    for (auto& elem : dead) {
+      CHECK(!elem);
+      CHECK(elem == nullptr);
+      CHECK(!elem.dynamicCast<Derived>());
+    }
+  }
+
+  void testEntityMap() {
+    EntityMap<Creature, int> entityMap;
+    EntitySet<Creature> entitySet;
+    map<Creature::Id, int> reference;
+    vector<Creature::Id> ids;
+    for (int i : Range(300))
+      ids.push_back(Creature::Id(Random.getLL()));
+    for (int i : Range(20000)) {
+      auto id = Random.choose(ids);
+      if (Random.roll(3)) {
+        entityMap.erase(id);
+        entitySet.erase(id);
+        reference.erase(id);
+      } else {
+        entityMap.set(id, i);
+        entitySet.insert(id);
+        reference[id] = i;
+      }
+    }
+    CHECKEQ(entityMap.getSize(), reference.size());
+    CHECKEQ(entitySet.getSize(), reference.size());
+    for (auto id : ids) {
+      CHECK(entityMap.getMaybe(id) == getValueMaybe(reference, id));
+      CHECKEQ(entitySet.contains(id), reference.count(id) > 0);
+    }
+    for (auto& elem : entityMap)
+      CHECKEQ(elem.second, reference.at(elem.first));
+  }
+
+  void testEntityMapPerformance() {
+    const int numIds = 2000;
+    const int numRounds = 200;
+    vector<Creature::Id> ids;
+    for (int i : Range(numIds))
+      ids.push_back(Creature::Id(Random.getLL()));
+    auto measure = [&](auto& container, auto insert, auto lookup, auto erase) {
+      long long sum = 0;
+      auto startTime = Clock::getRealMicros();
+      for (int round : Range(numRounds)) {
+        for (auto id : ids)
+          insert(container, id, round);
+        for (int i : Range(10))
+          for (auto id : ids)
+            sum += lookup(container, id);
+        for (auto id : ids)
+          erase(container, id);
+      }
+      CHECKEQ(sum, 10ll * numIds * numRounds * (numRounds - 1) / 2);
+      return (Clock::getRealMicros() - startTime).count() / 1000;
+    };
+    EntityMap<Creature, int> entityMap;
+    auto entityMapTime = measure(entityMap,
+        [](EntityMap<Creature, int>& m, Creature::Id id, int v) { m.set(id, v); },
+        [](EntityMap<Creature, int>& m, Creature::Id id) { return m.getOrFail(id); },
+        [](EntityMap<Creature, int>& m, Creature::Id id) { m.erase(id); });
+    map<Creature::Id, int> stdMap;
+    auto stdMapTime = measure(stdMap,
+        [](map<Creature::Id, int>& m, Creature::Id id, int v) { m[id] = v; },
+        [](map<Creature::Id, int>& m, Creature::Id id) { return m.at(id); },
+        [](map<Creature::Id, int>& m, Creature::Id id) { m.erase(id); });
+    std::cout << "EntityMap: " << entityMapTime << "ms, std::map: " << stdMapTime << "ms ("
+        << numRounds << " rounds of inserting, looking up 10 times and erasing " << numIds << " ids)\n";
+  }
+
   void testMinionEquipment1() {
     PItem bow1 = ItemType(ItemType::Bow{}).get();
     PItem bow2 = ItemType(ItemType::Bow{}).get();
@@ -756,6 +1740,37 @@ class Test {
     CHECK(equipment.getItemsOwnedBy(human.get()).size() == items.size());
   }
 
+  void testMinionEquipmentRemoveOwner() {
+    PItem sword = ItemType(ItemType::Sword{}).get();
+    PItem boots = ItemType(ItemType::LeatherBoots{}).get();
+    PItem bow = ItemType(ItemType::Bow{}).get();
+    PCreature human1 = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+    PCreature human2 = CreatureFactory::fromId(CreatureId::BANDIT, TribeId::getBandit());
+    MinionEquipment equipment;
+    CHECK(equipment.tryToOwn(human1.get(), sword.get()));
+    CHECK(equipment.tryToOwn(human1.get(), boots.get()));
+    CHECK(equipment.tryToOwn(human2.get(), bow.get()));
+    equipment.setLocked(human1.get(), sword->getUniqueId(), true);
+    auto bootsId = boots->getUniqueId();
+    boots.clear();
+    equipment.removeOwner(human1.get());
+    CHECK(equipment.getOwner(sword.get()) == none);
+    CHECK(!equipment.isLocked(human1.get(), sword->getUniqueId()));
+    CHECK(equipment.getItemsOwnedBy(human1.get()).empty());
+    CHECK(equipment.isOwner(bow.get(), human2.get()));
+    equipment.discard(bootsId);
+    CHECK(equipment.tryToOwn(human1.get(), sword.get()));
+    PItem sword2 = ItemType(ItemType::Sword{}).get();
+    CHECK(equipment.tryToOwn(human2.get(), sword2.get()));
+    sword2.clear();
+    equipment.updateItems({sword.get(), bow.get()});
+    CHECK(equipment.isOwner(sword.get(), human1.get()));
+    CHECKEQ(equipment.getItemsOwnedBy(human2.get()), makeVec(bow.get()));
+    equipment.updateOwners({human2.get()});
+    CHECK(equipment.getOwner(sword.get()) == none);
+    CHECK(equipment.isOwner(bow.get(), human2.get()));
+  }
+
   void testContainerRange() {
     vector<string> v { "abc", "def", "ghi" };
     int i = 0;
@@ -980,6 +1995,95 @@ class Test {
       t.matching.addTarget(t.get(v.x, v.y));
   }
 
+  template <PositionMapType Type>
+  void testPositionMap() {
+    PModel model = Model::create();
+    LevelBuilder builder1(nullptr, Random, 10, 10, "", false, none);
+    LevelBuilder builder2(nullptr, Random, 10, 10, "", false, none);
+    PLevelMaker levelMaker = LevelMaker::emptyLevel(FurnitureType::MOUNTAIN);
+    vector<PLevel> levels;
+    levels.push_back(builder1.build(model.get(), levelMaker.get(), 1234));
+    levels.push_back(builder2.build(model.get(), levelMaker.get(), 1235));
+    PositionMap<int, Type> positionMap;
+    map<pair<int, Vec2>, int> reference;
+    for (int i : Range(5000)) {
+      int level = Random.get(2);
+      // Some positions lie outside of the level's table.
+      Vec2 coord(Random.get(-30, 40), Random.get(-30, 40));
+      Position pos(coord, levels[level].get());
+      if (Random.roll(3)) {
+        positionMap.erase(pos);
+        reference.erase(make_pair(level, coord));
+      } else {
+        positionMap.set(pos, i);
+        reference[make_pair(level, coord)] = i;
+      }
+    }
+    for (int level : Range(2))
+      for (Vec2 v : Rectangle(-30, -30, 40, 40)) {
+        Position pos(v, levels[level].get());
+        CHECK(positionMap.getValueMaybe(pos) == getValueMaybe(reference, make_pair(level, v)));
+      }
+  }
+
+  void testPositionSet() {
+    PModel model = Model::create();
+    LevelBuilder builder1(nullptr, Random, 10, 10, "", false, none);
+    LevelBuilder builder2(nullptr, Random, 10, 10, "", false, none);
+    PLevelMaker levelMaker = LevelMaker::emptyLevel(FurnitureType::MOUNTAIN);
+    vector<PLevel> levels;
+    levels.push_back(builder1.build(model.get(), levelMaker.get(), 1234));
+    levels.push_back(builder2.build(model.get(), levelMaker.get(), 1235));
+    using Reference = unordered_set<Position, CustomHash<Position>>;
+    auto randomSet = [&] (int numPositions, int range) {
+      PositionSet ret;
+      Reference reference;
+      for (int i : Range(numPositions)) {
+        Position pos(Vec2(Random.get(-range, range), Random.get(-range, range)), levels[Random.get(2)].get());
+        if (Random.roll(3)) {
+          CHECKEQ(ret.erase(pos), (int) reference.erase(pos));
+        } else
+          CHECKEQ(ret.insert(pos), reference.insert(pos).second);
+      }
+      CHECKEQ(ret.size(), reference.size());
+      CHECK(Reference(ret.begin(), ret.end()) == reference);
+      for (auto& level : levels)
+        for (Vec2 v : Rectangle(-range - 1, -range - 1, range + 2, range + 2)) {
+          Position pos(v, level.get());
+          CHECKEQ(ret.contains(pos), reference.count(pos) > 0);
+        }
+      return make_pair(ret, reference);
+    };
+    for (int i : Range(30)) {
+      auto set1 = randomSet(Random.get(40), Random.get(1, 100));
+      auto set2 = randomSet(Random.get(200), Random.get(1, 30));
+      auto check = [](const PositionSet& s, const Reference& reference) {
+        CHECKEQ(s.size(), reference.size());
+        CHECK(Reference(s.begin(), s.end()) == reference);
+        for (auto& pos : reference)
+          CHECK(s.contains(pos));
+      };
+      auto sum = set1.first;
+      sum.sumWith(set2.first);
+      auto sumReference = set1.second;
+      sumReference.insert(set2.second.begin(), set2.second.end());
+      check(sum, sumReference);
+      auto intersection = set1.first;
+      intersection.intersectWith(set2.first);
+      Reference intersectionReference;
+      for (auto& pos : set1.second)
+        if (set2.second.count(pos))
+          intersectionReference.insert(pos);
+      check(intersection, intersectionReference);
+      auto difference = set1.first;
+      difference.subtract(set2.first);
+      auto differenceReference = set1.second;
+      for (auto& pos : set2.second)
+        differenceReference.erase(pos);
+      check(difference, differenceReference);
+    }
+  }
+
   void testDungeonLevel() {
     DungeonLevel level;
     CHECKEQ(level.level, 0);
@@ -1080,6 +2184,7 @@ class Test {
 void testAll() {
   Test().testStringConvertion();
   Test().testTimeQueue();
+  Test().testTimeQueueOrder();
   Test().testRectangleIterator();
   Test().testValueCheck();
   Test().testSplit();
@@ -1107,11 +2212,28 @@ void testAll() {
   Test().testSectors1();
   Test().testSectors2();
   Test().testSectors3();
+  Test().testSectorsSplitInThree();
   Test().testSectorsWithPortals();
+  Test().testSectorsRandom();
+  Test().testSectorsSerialization();
+  Test().testShortestPathHierarchical();
+  Test().testShortestPathHierarchicalDetour();
+  Test().testFlowField();
+  Test().testPathRepair();
+  Test().testFieldOfView();
+  Test().testLighting();
+  Test().testCreaturesInView();
+  Test().testClosestTask();
+  Test().testItemIndexDestroyedItem();
+  Test().testDangerMap();
   Test().testReverse();
   Test().testReverse2();
   Test().testReverse3();
   Test().testOwnerPointer();
+  Test().testOwnerPointerDestruction();
+  Test().testOwnerPointerSerialization();
+  Test().testOwnerPointerSlotReuse();
+  Test().testEntityMap();
   Test().testMinionEquipment1();
   Test().testMinionEquipmentItemDestroyed();
   Test().testMinionEquipmentUpdateItems();
@@ -1119,6 +2241,7 @@ void testAll() {
   Test().testMinionEquipmentAutoAssign();
   Test().testMinionEquipmentLocking();
   Test().testMinionEquipment123();
+  Test().testMinionEquipmentRemoveOwner();
   Test().testContainerRange();
   Test().testContainerRangeMap();
   Test().testContainerRangeErase();
@@ -1133,6 +2256,9 @@ void testAll() {
   Test().testPositionMatching2();
   Test().testPositionMatching3();
   Test().testPositionMatching4();
+  Test().testPositionMap<PositionMapType::DENSE>();
+  Test().testPositionMap<PositionMapType::SPARSE>();
+  Test().testPositionSet();
   Test().testDungeonLevel();
   Test().testRoofSupport1();
   Test().testRoofSupport2();
@@ -1141,3 +2267,10 @@ void testAll() {
   Test().testRoofSupport5();
   INFO << "-----===== OK =====-----";
 }
+
+void benchmarkAll() {
+  Test().testTimeQueuePerformance();
+  Test().testGeometryPerformance();
+  Test().testShortestPathPerformance();
+  Test().testEntityMapPerformance();
+}
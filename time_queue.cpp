@@ -21,132 +21,205 @@
 
 template <class Archive> 
 void TimeQueue::serialize(Archive& ar, const unsigned int version) { 
+  EntityMap<Creature, ExtendedTime> timeMap;
+  map<ExtendedTime, Queue> queue;
+  if (Archive::is_saving::value) {
+    for (auto& entry : entries)
+      if (entry.creature)
+        timeMap.set(entry.creature, entry.time);
+    queue = getSerializedQueue();
+  }
   ar(creatures, timeMap, queue);
+  if (Archive::is_loading::value)
+    loadSerializedQueue(queue);
 }
 
 SERIALIZABLE(TimeQueue);
 
+map<TimeQueue::ExtendedTime, TimeQueue::Queue> TimeQueue::getSerializedQueue() const {
+  map<ExtendedTime, vector<const Entry*>> byTime;
+  for (auto& entry : entries)
+    if (entry.creature)
+      byTime[entry.time].push_back(&entry);
+  map<ExtendedTime, Queue> ret;
+  for (auto& elem : byTime) {
+    auto& sorted = elem.second;
+    sort(sorted.begin(), sorted.end(), [this](const Entry* e1, const Entry* e2) { return isBefore(*e1, *e2); });
+    auto& queue = ret[elem.first];
+    for (auto entry : sorted) {
+      if (entry->player) {
+        queue.orderMap.set(entry->creature, queue.players.size());
+        queue.players.push_back(entry->creature);
+      } else {
+        queue.orderMap.set(entry->creature, 1000000000 + queue.nonPlayers.size());
+        queue.nonPlayers.push_back(entry->creature);
+      }
+    }
+  }
+  return ret;
+}
+
+void TimeQueue::loadSerializedQueue(const map<ExtendedTime, Queue>& queue) {
+  entries.clear();
+  freeEntries.clear();
+  entryIndexes.clear();
+  for (auto& heap : heaps)
+    heap.clear();
+  for (auto& elem : queue)
+    for (auto q : {&elem.second.players, &elem.second.nonPlayers})
+      for (WCreature c : *q)
+        if (c) {
+          entryIndexes.set(c, entries.size());
+          entries.push_back(Entry{c, elem.first, false, 0, -1});
+          push(entries.size() - 1, elem.first, false, q == &elem.second.players);
+        }
+}
+
 void TimeQueue::addCreature(PCreature c, LocalTime time) {
-  timeMap.set(c.get(), time);
-  queue[time].push(c.get());
+  int index;
+  if (!freeEntries.empty()) {
+    index = freeEntries.back();
+    freeEntries.pop_back();
+  } else {
+    index = entries.size();
+    entries.emplace_back();
+  }
+  entries[index].creature = c.get();
+  entryIndexes.set(c.get(), index);
+  push(index, time, false, c->isPlayer());
   creatures.push_back(std::move(c));
 }
 
 LocalTime TimeQueue::getTime(WConstCreature c) {
-  return timeMap.getOrFail(c).time;
+  return entries[getEntryIndex(c)].time.time;
+}
+
+int TimeQueue::getEntryIndex(WConstCreature c) const {
+  return entryIndexes.getOrFail(c);
 }
 
-static void clearNull(deque<WCreature>& q) {
-  while (!q.empty() && q.back() == nullptr)
-    q.pop_back();
-  while (!q.empty() && q.front() == nullptr)
-    q.pop_front();
+bool TimeQueue::isBefore(const Entry& e1, const Entry& e2) const {
+  if (e1.time < e2.time)
+    return true;
+  if (e2.time < e1.time)
+    return false;
+  if (e1.player != e2.player)
+    return e1.player;
+  return e1.order < e2.order;
 }
 
-void TimeQueue::Queue::clearNull() {
-  ::clearNull(players);
-  ::clearNull(nonPlayers);
+void TimeQueue::swapInHeap(vector<int>& heap, int index1, int index2) {
+  swap(heap[index1], heap[index2]);
+  entries[heap[index1]].heapIndex = index1;
+  entries[heap[index2]].heapIndex = index2;
 }
 
-void TimeQueue::Queue::push(WCreature c) {
-  clearNull();
-  if (c->isPlayer()) {
-    int order = players.empty() ? 0 : orderMap.getOrFail(players.back()) + 1;
-    orderMap.set(c, order);
-    players.push_back(c);
-  } else {
-    int order = nonPlayers.empty() ? 1000000000 : orderMap.getOrFail(nonPlayers.back()) + 1;
-    orderMap.set(c, order);
-    nonPlayers.push_back(c);
+void TimeQueue::siftUp(vector<int>& heap, int index) {
+  while (index > 0) {
+    int parent = (index - 1) / 2;
+    if (!isBefore(entries[heap[index]], entries[heap[parent]]))
+      break;
+    swapInHeap(heap, index, parent);
+    index = parent;
   }
 }
 
-void TimeQueue::Queue::pushFront(WCreature c) {
-  clearNull();
-  if (c->isPlayer()) {
-    int order = players.empty() ? 0 : orderMap.getOrFail(players.front()) - 1;
-    orderMap.set(c, order);
-    players.push_front(c);
-  } else {
-    int order = nonPlayers.empty() ? 1000000000 : orderMap.getOrFail(nonPlayers.front()) - 1;
-    orderMap.set(c, order);
-    nonPlayers.push_front(c);
+void TimeQueue::siftDown(vector<int>& heap, int index) {
+  while (1) {
+    int best = index;
+    for (int child : {2 * index + 1, 2 * index + 2})
+      if (child < heap.size() && isBefore(entries[heap[child]], entries[heap[best]]))
+        best = child;
+    if (best == index)
+      break;
+    swapInHeap(heap, index, best);
+    index = best;
   }
 }
 
-bool TimeQueue::Queue::empty() {
-  clearNull();
-  return players.empty() && nonPlayers.empty();
+void TimeQueue::push(int entryIndex, ExtendedTime time, bool front, bool player) {
+  auto& entry = entries[entryIndex];
+  entry.time = time;
+  entry.player = player;
+  entry.order = front ? --frontOrder : ++backOrder;
+  auto& heap = heaps[time.extraTurn ? EXTRA_TURN : REGULAR];
+  entry.heapIndex = heap.size();
+  heap.push_back(entryIndex);
+  siftUp(heap, entry.heapIndex);
 }
 
-WCreature TimeQueue::Queue::front() {
-  clearNull();
-  if (!players.empty())
-    return players.front();
-  else
-    return nonPlayers.front();
+void TimeQueue::erase(int entryIndex) {
+  auto& heap = heaps[entries[entryIndex].time.extraTurn ? EXTRA_TURN : REGULAR];
+  int index = entries[entryIndex].heapIndex;
+  CHECK(heap[index] == entryIndex);
+  swapInHeap(heap, index, heap.size() - 1);
+  heap.pop_back();
+  if (index < heap.size()) {
+    siftUp(heap, index);
+    siftDown(heap, index);
+  }
+  entries[entryIndex].heapIndex = -1;
 }
 
-void TimeQueue::Queue::popFront() {
-  if (!players.empty())
-    return players.pop_front();
-  else
-    return nonPlayers.pop_front();
+const TimeQueue::Entry* TimeQueue::getTop(HeapId id) const {
+  if (heaps[id].empty())
+    return nullptr;
+  return &entries[heaps[id][0]];
 }
 
-void TimeQueue::Queue::erase(WCreature c) {
-  auto eraseFrom = [&c] (deque<WCreature>& queue) {
-    for (int i : All(queue))
-      if (queue[i] == c) {
-        queue[i] = nullptr;
-        return true;
-      }
-    return false;
-  };
-  CHECK(eraseFrom(players) || eraseFrom(nonPlayers));
+TimeQueue::ExtendedTime TimeQueue::getCurrentTime() const {
+  auto regular = getTop(REGULAR);
+  auto extra = getTop(EXTRA_TURN);
+  CHECK(regular || extra);
+  if (!extra || (regular && !(extra->time < regular->time)))
+    return regular->time;
+  else
+    return extra->time;
 }
 
 void TimeQueue::increaseTime(WCreature c, TimeInterval diff) {
-  auto& time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
+  int index = getEntryIndex(c);
+  auto time = entries[index].time;
+  erase(index);
   time.time += diff;
   time.extraTurn = false;
-  queue[time].push(c);
+  push(index, time, false, c->isPlayer());
 }
 
 void TimeQueue::makeExtraMove(WCreature c) {
-  auto& time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
+  int index = getEntryIndex(c);
+  auto time = entries[index].time;
+  erase(index);
   if (!time.extraTurn)
     time.extraTurn = true;
   else {
     time.time += 1_visible;
     time.extraTurn = false;
   }
-  queue[time].push(c);
+  push(index, time, false, c->isPlayer());
 }
 
 bool TimeQueue::hasExtraMove(WCreature c) {
-  return timeMap.getOrFail(c).extraTurn;
+  return entries[getEntryIndex(c)].time.extraTurn;
 }
 
 void TimeQueue::postponeMove(WCreature c) {
   CHECK(contains(c));
-  auto time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
-  queue.at(time).push(c);
+  int index = getEntryIndex(c);
+  erase(index);
+  push(index, entries[index].time, false, c->isPlayer());
 }
 
 void TimeQueue::moveNow(WCreature c) {
   CHECK(contains(c));
-  auto time = timeMap.getOrFail(c);
-  queue.at(time).erase(c);
-  queue.at(time).pushFront(c);
+  int index = getEntryIndex(c);
+  erase(index);
+  push(index, entries[index].time, true, c->isPlayer());
 }
 
 bool TimeQueue::willMoveThisTurn(WConstCreature c) {
-  auto hisTime = timeMap.getOrFail(c);
-  auto curTime = queue.begin()->first;
+  auto hisTime = entries[getEntryIndex(c)].time;
+  auto curTime = getCurrentTime();
   return hisTime.time == curTime.time && (!hisTime.extraTurn || curTime.extraTurn);
 }
 
@@ -157,21 +230,11 @@ bool TimeQueue::compareOrder(WConstCreature c1, WConstCreature c2) {
     return false;
   if (!willMoveThisTurn(c1))
     return c1->getLastMoveCounter() < c2->getLastMoveCounter();
-  auto time1 = timeMap.getOrFail(c1);
-  auto time2 = timeMap.getOrFail(c2);
-  if (time1 < time2)
-    return true;
-  if (time2 < time1)
-    return false;
-  auto& orderMap = queue.at(time1).orderMap;
-  return orderMap.getOrFail(c1) < orderMap.getOrFail(c2);
+  return isBefore(entries[getEntryIndex(c1)], entries[getEntryIndex(c2)]);
 }
 
-bool TimeQueue::contains(WCreature c) const {
-  for (auto& creature : creatures)
-    if (creature.get() == c)
-      return true;
-  return false;
+bool TimeQueue::contains(WConstCreature c) const {
+  return entryIndexes.hasKey(c);
 }
 
 TimeQueue::TimeQueue() {}
@@ -179,7 +242,11 @@ TimeQueue::TimeQueue() {}
 PCreature TimeQueue::removeCreature(WCreature cRef) {
   for (int i : All(creatures))
     if (creatures[i].get() == cRef) {
-      queue.at(timeMap.getOrFail(cRef)).erase(cRef);
+      int index = getEntryIndex(cRef);
+      erase(index);
+      entries[index].creature = nullptr;
+      freeEntries.push_back(index);
+      entryIndexes.erase(cRef);
       PCreature ret = std::move(creatures[i]);
       creatures.removeIndexPreserveOrder(i);
       return ret;
@@ -195,24 +262,15 @@ vector<WCreature> TimeQueue::getAllCreatures() const {
 WCreature TimeQueue::getNextCreature(double maxTime) {
   if (creatures.empty())
     return nullptr;
-  while (1) {
-    CHECK(!queue.empty());
-    if (!queue.begin()->second.empty())
-      break;
-    queue.erase(queue.begin());
-  }
-  auto nowTime = queue.begin()->first;
+  auto nowTime = getCurrentTime();
   if (nowTime.getDouble() > maxTime)
     return nullptr;
-  auto& q = queue.begin()->second;
-  if (!nowTime.extraTurn) {
-    auto nextQueue = ++queue.begin();
-    if (nextQueue != queue.end()) {
-      if (nextQueue->first.time == nowTime.time && !nextQueue->second.empty() && nextQueue->second.front()->isPlayer())
-        return nextQueue->second.front();
-    }
-  }
-  return q.front();
+  auto regular = getTop(REGULAR);
+  auto extra = getTop(EXTRA_TURN);
+  // A player waiting for an extra turn goes before everyone who is at the same time without one.
+  if (!nowTime.extraTurn && extra && extra->time.time == nowTime.time && extra->player)
+    return extra->creature;
+  return nowTime.extraTurn ? extra->creature : regular->creature;
 }
 
 TimeQueue::ExtendedTime::ExtendedTime() {}
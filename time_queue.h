@@ -38,29 +38,13 @@ class TimeQueue {
   void moveNow(WCreature);
   bool willMoveThisTurn(WConstCreature);
   bool compareOrder(WConstCreature, WConstCreature);
+  bool contains(WConstCreature) const;
 
   template <class Archive>
   void serialize(Archive& ar, const unsigned int version);
 
   private:
-  bool contains(WCreature) const;
-
   vector<PCreature> SERIAL(creatures);
-  struct Queue {
-    void push(WCreature);
-    void pushFront(WCreature);
-    bool empty();
-    WCreature front();
-    void popFront();
-    void erase(WCreature);
-    deque<WCreature> SERIAL(players);
-    deque<WCreature> SERIAL(nonPlayers);
-    EntityMap<Creature, int> SERIAL(orderMap);
-    SERIALIZE_ALL(players, nonPlayers, orderMap)
-
-    private:
-    void clearNull();
-  };
   struct ExtendedTime {
     ExtendedTime();
     ExtendedTime(LocalTime);
@@ -70,7 +54,41 @@ class TimeQueue {
     bool SERIAL(extraTurn) = false;
     SERIALIZE_ALL(time, extraTurn)
   };
-  map<ExtendedTime, Queue> SERIAL(queue);
-  EntityMap<Creature, ExtendedTime> SERIAL(timeMap);
-};
 
+  // Layout of the old map-of-deques scheduler, only used to keep the save format.
+  struct Queue {
+    deque<WCreature> SERIAL(players);
+    deque<WCreature> SERIAL(nonPlayers);
+    EntityMap<Creature, int> SERIAL(orderMap);
+    SERIALIZE_ALL(players, nonPlayers, orderMap)
+  };
+  map<ExtendedTime, Queue> getSerializedQueue() const;
+  void loadSerializedQueue(const map<ExtendedTime, Queue>&);
+
+  // Every scheduled creature has an entry, which sits in one of two indexed binary heaps:
+  // the regular one, or the one for creatures waiting for an extra turn.
+  struct Entry {
+    WCreature creature;
+    ExtendedTime time;
+    bool player;
+    long long order;
+    int heapIndex;
+  };
+  enum HeapId { REGULAR, EXTRA_TURN };
+  bool isBefore(const Entry&, const Entry&) const;
+  void push(int entryIndex, ExtendedTime, bool front, bool player);
+  void erase(int entryIndex);
+  void siftUp(vector<int>& heap, int index);
+  void siftDown(vector<int>& heap, int index);
+  void swapInHeap(vector<int>& heap, int index1, int index2);
+  int getEntryIndex(WConstCreature) const;
+  const Entry* getTop(HeapId) const;
+  ExtendedTime getCurrentTime() const;
+
+  vector<Entry> entries;
+  vector<int> freeEntries;
+  EntityMap<Creature, int> entryIndexes;
+  vector<int> heaps[2];
+  long long backOrder = 0;
+  long long frontOrder = 0;
+};
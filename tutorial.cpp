@@ -340,7 +340,6 @@ static const int corridorLength = 6;
 static const int roomWidth = 5;
 
 vector<Vec2> Tutorial::getHighlightedSquaresHigh(WConstGame game) const {
-  auto collective = game->getPlayerCollective();
   const Vec2 firstRoom(entrance - Vec2(0, corridorLength + roomWidth / 2));
   switch (state) {
     case State::DIG_ROOM: {
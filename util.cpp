@@ -198,9 +198,6 @@ string toString(const Vec2& v) {
   return ss.str();
 }
 
-Vec2::Vec2(int _x, int _y) : x(_x), y(_y) {
-}
-
 Vec2::Vec2(Dir dir) {
   switch (dir) {
     case Dir::N: x = 0; y = -1; break;
@@ -214,57 +211,20 @@ Vec2::Vec2(Dir dir) {
   }
 }
 
-Vec2 Vec2::mult(const Vec2& v) const {
-  return Vec2(x * v.x, y * v.y);
-}
-
-Vec2 Vec2::div(const Vec2& v) const {
-  return Vec2(x / v.x, y / v.y);
-}
-
-int Vec2::dotProduct(Vec2 a, Vec2 b) {
-  return a.x * b.x + a.y * b.y;
-}
-
-static const vector<Vec2> dir8 {
-  Vec2(0, -1), Vec2(0, 1), Vec2(1, 0), Vec2(-1, 0), Vec2(1, -1), Vec2(-1, -1), Vec2(1, 1), Vec2(-1, 1)
-};
-
-const vector<Vec2>& Vec2::directions8() {
-  return dir8;
-}
-
-vector<Vec2> Vec2::neighbors8() const {
-  return {Vec2(x, y + 1), Vec2(x + 1, y), Vec2(x, y - 1), Vec2(x - 1, y), Vec2(x + 1, y + 1), Vec2(x + 1, y - 1),
-      Vec2(x - 1, y - 1), Vec2(x - 1, y + 1)};
-}
-
-static const vector<Vec2> dir4 {
-  Vec2(0, -1), Vec2(0, 1), Vec2(1, 0), Vec2(-1, 0)
-};
-
-const vector<Vec2>& Vec2::directions4() {
-  return dir4;
-}
-
-vector<Vec2> Vec2::neighbors4() const {
-  return { Vec2(x, y + 1), Vec2(x + 1, y), Vec2(x, y - 1), Vec2(x - 1, y)};
-}
-
 vector<Vec2> Vec2::directions8(RandomGen& random) {
-  return random.permutation(directions8());
+  return random.permutation(asVector<Vec2>(directions8()));
 }
 
 vector<Vec2> Vec2::neighbors8(RandomGen& random) const {
-  return random.permutation(neighbors8());
+  return random.permutation(asVector<Vec2>(neighbors8()));
 }
 
 vector<Vec2> Vec2::directions4(RandomGen& random) {
-  return random.permutation(directions4());
+  return random.permutation(asVector<Vec2>(directions4()));
 }
 
 vector<Vec2> Vec2::neighbors4(RandomGen& random) const {
-  return random.permutation(neighbors4());
+  return random.permutation(asVector<Vec2>(neighbors4()));
 }
 
 bool Vec2::isCardinal4() const {
@@ -362,14 +322,6 @@ Rectangle Rectangle::apply(Vec2::LinearMap map) const {
   return Rectangle(min(v1.x, v2.x), min(v1.y, v2.y), max(v1.x, v2.x) + 1, max(v1.y, v2.y) + 1);
 }
 
-bool Rectangle::operator == (const Rectangle& r) const {
-  return px == r.px && py == r.py && kx == r.kx && ky == r.ky;
-}
-
-bool Rectangle::operator != (const Rectangle& r) const {
-  return !(*this == r);
-}
-
 template <class Archive>
 void Vec2::serialize(Archive& ar, const unsigned int) {
   ar(x, y);
@@ -377,82 +329,14 @@ void Vec2::serialize(Archive& ar, const unsigned int) {
 
 SERIALIZABLE(Vec2);
 
-bool Vec2::inRectangle(int px, int py, int kx, int ky) const {
-  return x >= px && x < kx && y >= py && y < ky;
-}
-
-bool Vec2::inRectangle(const Rectangle& r) const {
-  return x >= r.px && x < r.kx && y >= r.py && y < r.ky;
-}
-
-bool Vec2::operator== (const Vec2& v) const {
-  return v.x == x && v.y == y;
-}
-
-bool Vec2::operator!= (const Vec2& v) const {
-  return v.x != x || v.y != y;
-}
-
-Vec2& Vec2::operator +=(const Vec2& v) {
-  x += v.x;
-  y += v.y;
-  return *this;
-}
-
-Vec2 Vec2::operator + (const Vec2& v) const {
-  return Vec2(x + v.x, y + v.y);
-}
-
-Vec2 Vec2::operator * (int a) const {
-  return Vec2(x * a, y * a);
-}
-
 Vec2 Vec2::operator * (double a) const {
   return Vec2(x * a, y * a);
 }
 
-Vec2 Vec2::operator / (int a) const {
-  return Vec2(x / a, y / a);
-}
-
-Vec2& Vec2::operator -=(const Vec2& v) {
-  x -= v.x;
-  y -= v.y;
-  return *this;
-}
-
-Vec2 Vec2::operator - (const Vec2& v) const {
-  return Vec2(x - v.x, y - v.y);
-}
-
-Vec2 Vec2::operator - () const {
-  return Vec2(-x, -y);
-}
-
-bool Vec2::operator < (Vec2 v) const {
-  return x < v.x || (x == v.x && y < v.y);
-}
-
-int Vec2::length8() const {
-  return max(abs(x), abs(y));
-}
-
-int Vec2::dist8(Vec2 v) const {
-  return (v - *this).length8();
-}
-
-int Vec2::dist4(Vec2 v) const {
-  return (v - *this).length4();
-}
-
 double Vec2::distD(Vec2 v) const {
   return (v - *this).lengthD();
 }
 
-int Vec2::length4() const {
-  return abs(x) + abs(y);
-}
-
 double Vec2::lengthD() const {
   return sqrt(x * x + y * y);
 }
@@ -514,110 +398,10 @@ Vec2 Vec2::getCenterOfWeight(vector<Vec2> vs) {
   return ret / vs.size();
 }
 
-Rectangle::Rectangle(int _w, int _h) : px(0), py(0), kx(_w), ky(_h), w(_w), h(_h) {
-  if (w <= 0 || h <= 0) {
-    kx = ky = 0;
-    w = h = 0;
-  }
-}
-
-Rectangle::Rectangle(Vec2 d) : Rectangle(d.x, d.y) {
-}
-
-Rectangle::Rectangle(int px1, int py1, int kx1, int ky1) : px(px1), py(py1), kx(kx1), ky(ky1), w(kx1 - px1),
-    h(ky1 - py1) {
-  if (kx <= px || ky <= py) {
-    kx = px;
-    ky = py;
-    w = h = 0;
-  }
-}
-
-Rectangle::Rectangle(Vec2 p, Vec2 k) : Rectangle(min(p.x, k.x), min(p.y, k.y), max(p.x, k.x), max(p.y, k.y)) {
-}
-
-Rectangle::Rectangle(Range xRange, Range yRange)
-    : Rectangle(xRange.getStart(), yRange.getStart(), xRange.getEnd(), yRange.getEnd()) {
-}
-
-Rectangle::Iter::Iter(int x1, int y1, int px1, int py1, int kx1, int ky1) : pos(x1, y1), py(py1), ky(ky1) {}
-
 Vec2 Rectangle::randomVec2() const {
   return Vec2(Random.get(px, kx), Random.get(py, ky));
 }
 
-Vec2 Rectangle::middle() const {
-  return Vec2((px + kx) / 2, (py + ky) / 2);
-}
-
-int Rectangle::left() const {
-  return px;
-}
-
-int Rectangle::top() const {
-  return py;
-}
-
-Range Rectangle::getXRange() const {
-  return Range(px, kx);
-}
-
-Range Rectangle::getYRange() const {
-  return Range(py, ky);
-}
-
-int Rectangle::right() const {
-  return kx;
-}
-
-int Rectangle::bottom() const {
-  return ky;
-}
-
-int Rectangle::width() const {
-  return w;
-}
-
-int Rectangle::height() const {
-  return h;
-}
-
-int Rectangle::area() const {
-  return w * h;
-}
-
-Vec2 Rectangle::getSize() const {
-  return Vec2(w, h);
-}
-
-Vec2 Rectangle::topLeft() const {
-  return Vec2(px, py);
-}
-
-Vec2 Rectangle::bottomRight() const {
-  return Vec2(kx, ky);
-}
-
-Vec2 Rectangle::topRight() const {
-  return Vec2(kx, py);
-}
-
-Vec2 Rectangle::bottomLeft() const {
-  return Vec2(px, ky);
-}
-
-bool Rectangle::intersects(const Rectangle& other) const {
-  return max(px, other.px) < min(kx, other.kx) && max(py, other.py) < min(ky, other.ky);
-}
-
-bool Rectangle::contains(const Rectangle& other) const {
-  return px <= other.px && py <= other.py && kx >= other.kx && ky >= other.ky;
-}
-
-Rectangle Rectangle::intersection(const Rectangle& other) const {
-  return Rectangle(max(px, other.px), max(py, other.py), min(kx, other.kx), min(ky, other.ky));
-}
-
 int Rectangle::getDistance(const Rectangle& other) const {
   int ret = min(
       min(bottomRight().dist8(other.topLeft()), other.bottomRight().dist8(topLeft())),
@@ -631,42 +415,6 @@ int Rectangle::getDistance(const Rectangle& other) const {
   return ret;
 }
 
-Rectangle Rectangle::translate(Vec2 v) const {
-  return Rectangle(topLeft() + v, bottomRight() + v);
-}
-
-Rectangle Rectangle::minusMargin(int margin) const {
-  return Rectangle(px + margin, py + margin, kx - margin, ky - margin);
-}
-
-Vec2 Rectangle::Iter::operator* () const {
-  return pos;
-}
-bool Rectangle::Iter::operator != (const Iter& other) const {
-  return pos != other.pos;
-}
-
-const Rectangle::Iter& Rectangle::Iter::operator++ () {
-  ++pos.y;
-  if (pos.y >= ky) {
-    pos.y = py;
-    ++pos.x;
-  }
-  return *this;
-}
-
-Rectangle::Iter Rectangle::begin() const {
-  return Iter(px, py, px, py, kx, ky);
-}
-
-Rectangle::Iter Rectangle::end() const {
-  return Iter(kx, py, px, py, kx, ky);
-}
-
-Range::Range(int a, int b) : start(a), finish(b) {
-}
-Range::Range(int a) : Range(0, a) {}
-
 Range Range::singleElem(int a) {
   return Range(a, a + 1);
 }
@@ -695,18 +443,6 @@ Range Range::shorten(int r) {
   }
 }
 
-int Range::getStart() const {
-  return start;
-}
-
-int Range::getEnd() const {
-  return finish;
-}
-
-int Range::getLength() const {
-  return finish - start;
-}
-
 bool Range::contains(int p) const {
   return (increment > 0 && p >= start && p < finish) || (increment < 0 && p <= start && p > finish);
 }
@@ -720,33 +456,6 @@ Range Range::intersection(Range r) const {
   return Range(max(start, r.start), min(finish, r.finish));
 }
 
-Range::Iter Range::begin() {
-  if ((increment > 0 && start < finish) || (increment < 0 && start > finish))
-    return Iter(start, start, finish, increment);
-  else
-    return end();
-}
-
-Range::Iter Range::end() {
-  return Iter(finish, start, finish, increment);
-}
-
-Range::Iter::Iter(int i, int a, int b, int inc) : ind(i), /*min(a), max(b), */increment(inc) {}
-
-int Range::Iter::operator* () const {
-  return ind;
-}
-
-bool Range::Iter::operator != (const Iter& other) const {
-  return other.ind != ind;
-}
-
-const Range::Iter& Range::Iter::operator++ () {
-  ind += increment;
-  //CHECK(ind <= max && ind >= min) << ind << " " << min << " " << max;
-  return *this;
-}
-
 SERIALIZE_DEF(Range, NAMED(start), NAMED(finish), NAMED(increment))
 SERIALIZATION_CONSTRUCTOR_IMPL(Range);
 
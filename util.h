@@ -126,29 +126,90 @@ class Vec2 {
   public:
   int SERIAL(x); // HASH(x)
   int SERIAL(y); // HASH(y)
-  Vec2() : x(0), y(0) {}
-  Vec2(int x, int y);
+  constexpr Vec2() : x(0), y(0) {}
+  constexpr Vec2(int _x, int _y) : x(_x), y(_y) {}
   Vec2(Dir);
-  bool inRectangle(int px, int py, int kx, int ky) const;
-  bool inRectangle(const Rectangle&) const;
-  bool operator == (const Vec2& v) const;
-  bool operator != (const Vec2& v) const;
-  Vec2 operator + (const Vec2& v) const;
-  Vec2 operator * (int) const;
+
+  constexpr bool inRectangle(int px, int py, int kx, int ky) const {
+    return x >= px && x < kx && y >= py && y < ky;
+  }
+
+  constexpr bool inRectangle(const Rectangle&) const;
+
+  constexpr bool operator == (const Vec2& v) const {
+    return v.x == x && v.y == y;
+  }
+
+  constexpr bool operator != (const Vec2& v) const {
+    return v.x != x || v.y != y;
+  }
+
+  constexpr Vec2 operator + (const Vec2& v) const {
+    return Vec2(x + v.x, y + v.y);
+  }
+
+  constexpr Vec2 operator * (int a) const {
+    return Vec2(x * a, y * a);
+  }
+
   Vec2 operator * (double) const;
-  Vec2 operator / (int) const;
-  Vec2& operator += (const Vec2& v);
-  Vec2 operator - (const Vec2& v) const;
-  Vec2& operator -= (const Vec2& v);
-  Vec2 operator - () const;
-  bool operator < (Vec2) const;
-  Vec2 mult(const Vec2& v) const;
-  Vec2 div(const Vec2& v) const;
-  static int dotProduct(Vec2 a, Vec2 b);
-  int length8() const;
-  int length4() const;
-  int dist8(Vec2) const;
-  int dist4(Vec2) const;
+
+  constexpr Vec2 operator / (int a) const {
+    return Vec2(x / a, y / a);
+  }
+
+  constexpr Vec2& operator += (const Vec2& v) {
+    x += v.x;
+    y += v.y;
+    return *this;
+  }
+
+  constexpr Vec2 operator - (const Vec2& v) const {
+    return Vec2(x - v.x, y - v.y);
+  }
+
+  constexpr Vec2& operator -= (const Vec2& v) {
+    x -= v.x;
+    y -= v.y;
+    return *this;
+  }
+
+  constexpr Vec2 operator - () const {
+    return Vec2(-x, -y);
+  }
+
+  constexpr bool operator < (Vec2 v) const {
+    return x < v.x || (x == v.x && y < v.y);
+  }
+
+  constexpr Vec2 mult(const Vec2& v) const {
+    return Vec2(x * v.x, y * v.y);
+  }
+
+  constexpr Vec2 div(const Vec2& v) const {
+    return Vec2(x / v.x, y / v.y);
+  }
+
+  static constexpr int dotProduct(Vec2 a, Vec2 b) {
+    return a.x * b.x + a.y * b.y;
+  }
+
+  constexpr int length8() const {
+    return max(x >= 0 ? x : -x, y >= 0 ? y : -y);
+  }
+
+  constexpr int length4() const {
+    return (x >= 0 ? x : -x) + (y >= 0 ? y : -y);
+  }
+
+  constexpr int dist8(Vec2 v) const {
+    return (v - *this).length8();
+  }
+
+  constexpr int dist4(Vec2 v) const {
+    return (v - *this).length4();
+  }
+
   double distD(Vec2) const;
   double lengthD() const;
   Vec2 shorten() const;
@@ -160,10 +221,24 @@ class Vec2 {
   static Vec2 getCenterOfWeight(vector<Vec2>);
 
   vector<Vec2> box(int radius, bool shuffle = false);
-  static const vector<Vec2>& directions8();
-  vector<Vec2> neighbors8() const;
-  static const vector<Vec2>& directions4();
-  vector<Vec2> neighbors4() const;
+
+  static constexpr array<Vec2, 8> directions8() {
+    return {{Vec2(0, -1), Vec2(0, 1), Vec2(1, 0), Vec2(-1, 0), Vec2(1, -1), Vec2(-1, -1), Vec2(1, 1), Vec2(-1, 1)}};
+  }
+
+  constexpr array<Vec2, 8> neighbors8() const {
+    return {{Vec2(x, y + 1), Vec2(x + 1, y), Vec2(x, y - 1), Vec2(x - 1, y), Vec2(x + 1, y + 1), Vec2(x + 1, y - 1),
+        Vec2(x - 1, y - 1), Vec2(x - 1, y + 1)}};
+  }
+
+  static constexpr array<Vec2, 4> directions4() {
+    return {{Vec2(0, -1), Vec2(0, 1), Vec2(1, 0), Vec2(-1, 0)}};
+  }
+
+  constexpr array<Vec2, 4> neighbors4() const {
+    return {{Vec2(x, y + 1), Vec2(x + 1, y), Vec2(x, y - 1), Vec2(x - 1, y)}};
+  }
+
   static vector<Vec2> directions8(RandomGen&);
   vector<Vec2> neighbors8(RandomGen&) const;
   static vector<Vec2> directions4(RandomGen&);
@@ -183,39 +258,62 @@ extern string toString(const Vec2& v);
 
 class Range {
   public:
-  Range(int start, int end);
-  explicit Range(int end);
+  constexpr Range(int start, int end) : start(start), finish(end) {}
+  constexpr explicit Range(int end) : Range(0, end) {}
   static Range singleElem(int);
 
   bool isEmpty() const;
   Range reverse();
   Range shorten(int r);
 
-  int getStart() const;
-  int getEnd() const;
-  int getLength() const;
+  constexpr int getStart() const {
+    return start;
+  }
+
+  constexpr int getEnd() const {
+    return finish;
+  }
+
+  constexpr int getLength() const {
+    return finish - start;
+  }
+
   bool contains(int) const;
   bool intersects(Range) const;
   Range intersection(Range) const;
 
   class Iter {
     public:
-    Iter(int ind, int min, int max, int increment);
+    constexpr Iter(int ind, int increment) : ind(ind), increment(increment) {}
 
-    int operator* () const;
-    bool operator != (const Iter& other) const;
+    constexpr int operator* () const {
+      return ind;
+    }
 
-    const Iter& operator++ ();
+    constexpr bool operator != (const Iter& other) const {
+      return other.ind != ind;
+    }
+
+    constexpr const Iter& operator++ () {
+      ind += increment;
+      return *this;
+    }
 
     private:
     int ind;
-    //int min;
-    //int max;
     int increment;
   };
 
-  Iter begin();
-  Iter end();
+  constexpr Iter begin() const {
+    if ((increment > 0 && start < finish) || (increment < 0 && start > finish))
+      return Iter(start, increment);
+    else
+      return end();
+  }
+
+  constexpr Iter end() const {
+    return Iter(finish, increment);
+  }
 
   SERIALIZATION_DECL(Range)
   HASH_ALL(start, finish, increment)
@@ -231,65 +329,154 @@ class Rectangle {
   friend class Vec2;
   template<typename T>
   friend class Table;
-  Rectangle(int width, int height);
-  explicit Rectangle(Vec2 dim);
-  Rectangle(int px, int py, int kx, int ky);
-  Rectangle(Vec2 p, Vec2 k);
-  Rectangle(Range xRange, Range yRange);
+  constexpr Rectangle(int width, int height) : Rectangle(0, 0, width, height) {}
+  constexpr explicit Rectangle(Vec2 dim) : Rectangle(dim.x, dim.y) {}
+
+  constexpr Rectangle(int px, int py, int kx, int ky) : px(px), py(py), kx(kx), ky(ky), w(kx - px), h(ky - py) {
+    if (kx <= px || ky <= py) {
+      this->kx = px;
+      this->ky = py;
+      w = h = 0;
+    }
+  }
+
+  constexpr Rectangle(Vec2 p, Vec2 k) : Rectangle(min(p.x, k.x), min(p.y, k.y), max(p.x, k.x), max(p.y, k.y)) {}
+  constexpr Rectangle(Range xRange, Range yRange)
+      : Rectangle(xRange.getStart(), yRange.getStart(), xRange.getEnd(), yRange.getEnd()) {}
   static Rectangle boundingBox(const vector<Vec2>& v);
   static Rectangle centered(Vec2 center, int radius);
   static Rectangle centered(int radius);
 
-  int left() const;
-  int top() const;
-  int right() const;
-  int bottom() const;
-  int width() const;
-  int height() const;
-  Vec2 getSize() const;
-  Range getYRange() const;
-  Range getXRange() const;
-  int area() const;
-
-  Vec2 topLeft() const;
-  Vec2 bottomRight() const;
-  Vec2 topRight() const;
-  Vec2 bottomLeft() const;
-
-  bool intersects(const Rectangle& other) const;
-  bool contains(const Rectangle& other) const;
-  Rectangle intersection(const Rectangle& other) const;
+  constexpr int left() const {
+    return px;
+  }
+
+  constexpr int top() const {
+    return py;
+  }
+
+  constexpr int right() const {
+    return kx;
+  }
+
+  constexpr int bottom() const {
+    return ky;
+  }
+
+  constexpr int width() const {
+    return w;
+  }
+
+  constexpr int height() const {
+    return h;
+  }
+
+  constexpr Vec2 getSize() const {
+    return Vec2(w, h);
+  }
+
+  constexpr Range getYRange() const {
+    return Range(py, ky);
+  }
+
+  constexpr Range getXRange() const {
+    return Range(px, kx);
+  }
+
+  constexpr int area() const {
+    return w * h;
+  }
+
+  constexpr Vec2 topLeft() const {
+    return Vec2(px, py);
+  }
+
+  constexpr Vec2 bottomRight() const {
+    return Vec2(kx, ky);
+  }
+
+  constexpr Vec2 topRight() const {
+    return Vec2(kx, py);
+  }
+
+  constexpr Vec2 bottomLeft() const {
+    return Vec2(px, ky);
+  }
+
+  constexpr bool intersects(const Rectangle& other) const {
+    return max(px, other.px) < min(kx, other.kx) && max(py, other.py) < min(ky, other.ky);
+  }
+
+  constexpr bool contains(const Rectangle& other) const {
+    return px <= other.px && py <= other.py && kx >= other.kx && ky >= other.ky;
+  }
+
+  constexpr Rectangle intersection(const Rectangle& other) const {
+    return Rectangle(max(px, other.px), max(py, other.py), min(kx, other.kx), min(ky, other.ky));
+  }
+
   // can be negative if rectangles intersect
   int getDistance(const Rectangle& other) const;
 
-  Rectangle minusMargin(int margin) const;
-  Rectangle translate(Vec2 v) const;
+  constexpr Rectangle minusMargin(int margin) const {
+    return Rectangle(px + margin, py + margin, kx - margin, ky - margin);
+  }
+
+  constexpr Rectangle translate(Vec2 v) const {
+    return Rectangle(topLeft() + v, bottomRight() + v);
+  }
+
   Rectangle apply(Vec2::LinearMap) const;
 
   Vec2 randomVec2() const;
-  Vec2 middle() const;
+
+  constexpr Vec2 middle() const {
+    return Vec2((px + kx) / 2, (py + ky) / 2);
+  }
 
   vector<Vec2> getAllSquares() const;
 
-  bool operator == (const Rectangle&) const;
-  bool operator != (const Rectangle&) const;
+  constexpr bool operator == (const Rectangle& r) const {
+    return px == r.px && py == r.py && kx == r.kx && ky == r.ky;
+  }
+
+  constexpr bool operator != (const Rectangle& r) const {
+    return !(*this == r);
+  }
 
   class Iter {
     public:
-    Iter(int x, int y, int px, int py, int kx, int ky);
+    constexpr Iter(int x, int y, int py, int ky) : pos(x, y), py(py), ky(ky) {}
 
-    Vec2 operator* () const;
-    bool operator != (const Iter& other) const;
+    constexpr Vec2 operator* () const {
+      return pos;
+    }
 
-    const Iter& operator++ ();
+    constexpr bool operator != (const Iter& other) const {
+      return pos != other.pos;
+    }
+
+    constexpr const Iter& operator++ () {
+      ++pos.y;
+      if (pos.y >= ky) {
+        pos.y = py;
+        ++pos.x;
+      }
+      return *this;
+    }
 
     private:
     Vec2 pos;
-    int /*px, */py, /*kx, */ky;
+    int py, ky;
   };
 
-  Iter begin() const;
-  Iter end() const;
+  constexpr Iter begin() const {
+    return Iter(px, py, py, ky);
+  }
+
+  constexpr Iter end() const {
+    return Iter(kx, py, py, ky);
+  }
 
   SERIALIZATION_DECL(Rectangle);
 
@@ -302,6 +489,10 @@ class Rectangle {
   int SERIAL(h) = 0;
 };
 
+constexpr bool Vec2::inRectangle(const Rectangle& r) const {
+  return x >= r.px && x < r.kx && y >= r.py && y < r.ky;
+}
+
 template <class T>
 Range All(const T& container) {
   return Range(container.size());
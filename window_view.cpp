@@ -1260,6 +1260,16 @@ void WindowView::keyboardAction(const SDL_Keysym& key) {
       gui.loadImages();
       inputQueue.push(UserInputId::RELOAD_DATA);
       break;
+#ifndef EASY_PROFILER
+    case SDL::SDLK_F6:
+      if (Profiler::isEnabled()) {
+        Profiler::setEnabled(false);
+        Profiler::dump("profile.json", "profile.txt");
+        presentText("", "Profiling data written to profile.json and profile.txt");
+      } else
+        Profiler::setEnabled(true);
+      break;
+#endif
     case SDL::SDLK_TAB:
       // TODO: put it under different shortcut?
       inputQueue.push(UserInputId::CHEAT_SPELLS);